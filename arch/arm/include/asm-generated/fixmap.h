@@ -46,6 +46,12 @@ enum fixed_addresses_bs {
 #ifdef CONFIG_HIGHMEM_BS
         FIX_KMAP_BEGIN_BS, /* reserved pte's for temporary kernel mappings */
         FIX_KMAP_END_BS = FIX_KMAP_BEGIN_BS+(KM_TYPE_NR_BS*NR_CPUS_BS)-1,
+        FIX_KMAP_LOCAL_BEGIN_BS, /* per-cpu stacks for kmap_local */
+        FIX_KMAP_LOCAL_END_BS = FIX_KMAP_LOCAL_BEGIN_BS+
+					(KM_LOCAL_MAX_BS*NR_CPUS_BS)-1,
+        FIX_SCRATCH_BEGIN_BS, /* per-cpu page clear/copy windows */
+        FIX_SCRATCH_END_BS = FIX_SCRATCH_BEGIN_BS+
+					(KM_SCRATCH_NR_BS*NR_CPUS_BS)-1,
 #endif
         __end_of_permanent_fixed_addresses_bs,
         /* temporary boot-time mappings, used before ioremap() is functional */
@@ -26,4 +26,16 @@ D(13)	KM_TYPE_NR_BS
 
 #undef D
 
+/*
+ * Depth of the per-CPU stack of kmap_local mappings.
+ */
+#define KM_LOCAL_MAX_BS		16
+
+/*
+ * Per-CPU scratch windows of clear_highpage/copy_highpage.
+ */
+#define KM_SCRATCH_DST_BS	0
+#define KM_SCRATCH_SRC_BS	1
+#define KM_SCRATCH_NR_BS	2
+
 #endif
@@ -36,6 +36,13 @@ extern u32 BiscuitOS_PAGE_OFFSET;
  */
 #define PHYS_PFN_OFFSET_BS	(PHYS_OFFSET_BS >> PAGE_SHIFT_BS)
 
+/*
+ * Sparsemem sections are 64MB, counted from PHYS_OFFSET.
+ */
+#ifdef CONFIG_SPARSEMEM_BS
+#define SECTION_SIZE_BITS_BS	26
+#endif
+
 /*
  * Conversion between a struct page and a physical address.
  *
@@ -54,10 +61,13 @@ extern u32 BiscuitOS_PAGE_OFFSET;
  */
 #ifndef CONFIG_DISCONTIGMEM
 
+/* With CONFIG_SPARSEMEM_BS these come from biscuitos/mm.h */
+#ifndef CONFIG_SPARSEMEM_BS
 #define page_to_pfn_bs(page)	(((page) - mem_map_bs) + PHYS_PFN_OFFSET_BS)
 #define pfn_to_page_bs(pfn)	((mem_map_bs + (pfn)) - PHYS_PFN_OFFSET_BS)
 #define pfn_valid_bs(pfn)	((pfn) >= PHYS_PFN_OFFSET_BS && \
 				(pfn) < (PHYS_PFN_OFFSET_BS + max_mapnr_bs))
+#endif
 
 #define virt_to_page_bs(kaddr)	(pfn_to_page_bs(__pa_bs(kaddr) >> \
 							PAGE_SHIFT_BS))
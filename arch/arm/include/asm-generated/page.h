@@ -11,6 +11,18 @@
 /* to align the pointer to the (next) page boundary */
 #define PAGE_ALIGN_BS(addr)	(((addr)+PAGE_SIZE_BS-1)&PAGE_MASK_BS)
 
-#define clear_page_bs(page)	memzero_bs((void *)(page), PAGE_SIZE_BS)
+/*
+ * Keep the kernel virtual address of kmapped highmem pages in
+ * struct page, so page_address() does not need a hashed lookup.
+ */
+#ifdef CONFIG_HIGHMEM_BS
+#define WANT_PAGE_VIRTUAL_BS
+#endif
+
+extern void __clear_page_bs(void *page);
+extern void __copy_page_bs(void *to, const void *from);
+
+#define clear_page_bs(page)	__clear_page_bs((void *)(page))
+#define copy_page_bs(to,from)	__copy_page_bs((void *)(to), (void *)(from))
 
 #endif
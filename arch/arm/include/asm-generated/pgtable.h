@@ -576,7 +576,8 @@ typedef void (*cpu_set_pte_ext_t)(pte_t_bs *, pte_t_bs, unsigned int);
 /* Needs to be defined here and not in linux/mm.h, as it is arch dependent */
 /* FIXME: this is not correct */
 #define kern_addr_valid_bs(addr)	(1)
-#define pte_mkold_bs(x)			(0)
+#define pte_mkold_bs(pte)		(__pte_bs(pte_val_bs(pte) & \
+							~L_PTE_YOUNG_BS))
 
 #ifndef __HAVE_ARCH_PAGE_TEST_AND_CLEAR_YOUNG
 #define page_test_and_clear_young_bs(page)	(0)
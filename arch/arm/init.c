@@ -18,6 +18,7 @@
 #include "biscuitos/swap.h"
 #include "biscuitos/mman.h"
 #include "biscuitos/init.h"
+#include "biscuitos/cma.h"
 #include "asm-generated/setup.h"
 #include "asm-generated/arch.h"
 #include "asm-generated/memory.h"
@@ -359,6 +360,12 @@ static void __init bootmem_init_bs(struct meminfo *mi)
 
 	BUG_ON_BS(map_pg != bootmap_pfn + bootmap_pages);
 
+	/*
+	 * Set the contiguous areas aside before anyone else gets to
+	 * allocate from bootmem.
+	 */
+	cma_reserve_bs();
+
 	/* FIXME: bootmem_initcall entry, used to debug bootmem,
 	 * This code isn't default code */
 	DEBUG_CALL(bootmem);
@@ -371,7 +378,7 @@ static void __init bootmem_init_bs(struct meminfo *mi)
 void __init paging_init_bs(struct meminfo *mi, struct machine_desc_bs *mdesc)
 {
 	void *zero_page;
-	int node;
+	int node, bank;
 
 	bootmem_init_bs(mi);
 
@@ -391,6 +398,21 @@ void __init paging_init_bs(struct meminfo *mi, struct machine_desc_bs *mdesc)
 
 	flush_tlb_all_bs();
 
+	/*
+	 * With SPARSEMEM only the sections backing a bank get a mem_map.
+	 */
+	for (bank = 0; bank < mi->nr_banks; bank++)
+		memory_present_bs(mi->bank[bank].node,
+			O_PFN_UP(mi->bank[bank].start),
+			O_PFN_DOWN(mi->bank[bank].start + mi->bank[bank].size));
+#ifdef CONFIG_HIGHMEM_BS
+	for (bank = 0; bank < highmeminfo_bs.nr_banks; bank++)
+		memory_present_bs(0, O_PFN_UP(highmeminfo_bs.bank[bank].start),
+			O_PFN_DOWN(highmeminfo_bs.bank[bank].start +
+				   highmeminfo_bs.bank[bank].size));
+#endif
+	sparse_init_bs();
+
 	/*
 	 * initialize the zones within each node
 	 */
@@ -479,13 +501,16 @@ void __init mem_init_bs(void)
 	datapages = _end_bs - __data_start_bs;
 	initpages = __init_end_bs - __init_begin_bs;
 
-	max_mapnr_bs = virt_to_page_bs(high_memory_bs) - mem_map_bs;
+	max_mapnr_bs = (__pa_bs(high_memory_bs) >> PAGE_SHIFT_BS) -
+						PHYS_PFN_OFFSET_BS;
 
+#ifndef CONFIG_SPARSEMEM_BS
 	/*
 	 * We may have non-contiguous memory
 	 */
 	if (meminfo_bs.nr_banks != 1)
 		create_memmap_holes_bs(&meminfo_bs);
+#endif
 
 	/* this will put all unused low memory onto the freelists */
 	for_each_online_node_bs(node) {
@@ -494,6 +519,11 @@ void __init mem_init_bs(void)
 		if (pgdat->node_spanned_pages != 0)
 			totalram_pages_bs += free_all_bootmem_node_bs(pgdat);
 	}
+	/* and set up the rest of the mem_map in the background */
+	deferred_init_memmap_bs();
+
+	/* and lend the contiguous areas to the movable allocations */
+	totalram_pages_bs += cma_init_reserved_areas_bs();
 
 	/*
 	 * Since our memory may not be contiguous, calculate the
@@ -23,6 +23,11 @@
  */
 #include <linux/kernel.h>
 #include <linux/string.h>
+#include <linux/hardirq.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#endif
+#include "asm-generated/page.h"
 
 
 /*
@@ -73,3 +78,39 @@ void __memzero_bs(void *s, size_t n)
 	if (n & 1)
 		*u.ucp++ = 0;
 }
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+extern void __clear_page_neon_bs(void *page);
+extern void __copy_page_neon_bs(void *to, const void *from);
+#endif
+
+/*
+ * Clear/copy a whole page. With kernel mode NEON the page is moved
+ * with 64-byte NEON stores; NEON can't be used from interrupt context,
+ * so fall back to the integer routines there.
+ */
+void __clear_page_bs(void *page)
+{
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (!in_interrupt()) {
+		kernel_neon_begin();
+		__clear_page_neon_bs(page);
+		kernel_neon_end();
+		return;
+	}
+#endif
+	__memzero_bs(page, PAGE_SIZE_BS);
+}
+
+void __copy_page_bs(void *to, const void *from)
+{
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (!in_interrupt()) {
+		kernel_neon_begin();
+		__copy_page_neon_bs(to, from);
+		kernel_neon_end();
+		return;
+	}
+#endif
+	memcpy(to, from, PAGE_SIZE_BS);
+}
@@ -472,60 +472,47 @@ static void __init __map_init_section_bs(pmd_t_bs *pmd, unsigned long addr,
 	flush_pmd_entry_bs(p);
 }
 
-static void __init alloc_init_pmd_bs(pud_t_bs *pud, unsigned long addr,
-			unsigned long end, phys_addr_t phys,
-			const struct mem_types *type,
-			void *(*alloc)(unsigned long sz), bool ng)
-{
-	pmd_t_bs *pmd = pmd_offset_bs(pud, addr);
-	unsigned long next;
-
-	do {
-		/*
-		 * While LPAE, we must loop over to map
-		 * all the pmds for the given range.
-		 */
-		next = pmd_addr_end_bs(addr, end);
-
-		/*
-		 * Try a section mapping - addr, next and phys must all be
-		 * aligned to a section boundary.
-		 */
-		if (type->prot_sect &&
-			((addr | next | phys) & ~SECTION_MASK_BS) == 0) {
-			__map_init_section_bs(pmd, addr, next, phys, type, ng);
-		} else {
-			BS_DUP();
-		}
-
-		phys += next - addr;
-
-	} while (pmd++, addr = next, addr != end);
-}
+struct create_mapping_bs {
+	unsigned long virt;
+	phys_addr_t phys;
+	const struct mem_types *type;
+	void *(*alloc)(unsigned long sz);
+	bool ng;
+};
 
-static void __init alloc_init_pud_bs(pgd_t_bs *pgd, unsigned long addr,
-			unsigned long end, phys_addr_t phys,
-			const struct mem_types *type,
-			void *(alloc)(unsigned long sz), bool ng)
+static int __init alloc_init_pmd_bs(pmd_t_bs *pmd, unsigned long addr,
+			unsigned long next, struct mm_walk_bs *walk)
 {
-	pud_t_bs *pud = pud_offset_bs(pgd, addr);
-	unsigned long next;
+	struct create_mapping_bs *cm = walk->private;
+	phys_addr_t phys = cm->phys + (addr - cm->virt);
 
-	do {
-		next = pud_addr_end_bs(addr, end);
-		alloc_init_pmd_bs(pud, addr, next, phys, type, alloc, ng);
-		phys += next - addr;
-	} while (pud++, addr = next, addr != end);
+	/*
+	 * Try a section mapping - addr, next and phys must all be
+	 * aligned to a section boundary.
+	 */
+	if (cm->type->prot_sect &&
+		((addr | next | phys) & ~SECTION_MASK_BS) == 0) {
+		__map_init_section_bs(pmd, addr, next, phys, cm->type, cm->ng);
+	} else {
+		BS_DUP();
+	}
+	return 0;
 }
 
 static void __init __create_mapping_bs(struct mm_struct_bs *mm,
 		struct map_desc *md, void *(*alloc)(unsigned long sz),
 		bool ng)
 {
-	unsigned long addr, length, end;
+	unsigned long addr, length;
 	phys_addr_t phys;
 	const struct mem_types *type;
-	pgd_t_bs *pgd;
+	struct create_mapping_bs cm;
+	struct mm_walk_bs walk = {
+		.pmd_entry	= alloc_init_pmd_bs,
+		.mm		= mm,
+		.flags		= MM_WALK_ALLOC_BS,
+		.private	= &cm,
+	};
 
 	type = &mem_types_bs[md->type];
 
@@ -540,16 +527,12 @@ static void __init __create_mapping_bs(struct mm_struct_bs *mm,
 		return;
 	}
 
-	pgd = pgd_offset_bs(mm, addr);
-	end = addr + length;
-	do {
-		unsigned long next = pgd_addr_end_bs(addr, end);
-
-		alloc_init_pud_bs(pgd, addr, next, phys, type, alloc, ng);
-
-		phys += next - addr;
-		addr = next;
-	} while (pgd++, addr != end);
+	cm.virt = addr;
+	cm.phys = phys;
+	cm.type = type;
+	cm.alloc = alloc;
+	cm.ng = ng;
+	walk_page_range_bs(addr, addr + length, &walk);
 }
 
 #define vectors_base_bs()	(vectors_high_bs() ? 0xffff0000 : 0)
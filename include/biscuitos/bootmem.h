@@ -18,17 +18,12 @@ extern unsigned long min_low_pfn_bs;
 extern unsigned long max_pfn_bs;
 
 /*
- * node_bootmem_map is a map pointer - the bits represent all physical
- * memory pages (including holes) on the node.
+ * The span of a node.  Which parts of it are free is kept by memblock,
+ * see biscuitos/memblock.h.
  */
 typedef struct bootmem_data_bs {
 	unsigned long node_boot_start;
 	unsigned long node_low_pfn;
-	void *node_bootmem_map;
-	unsigned long last_offset;
-	unsigned long last_pos;
-	unsigned long last_success;	/* Previous allocation point.
-					 * To speed up searching */
 } bootmem_data_t_bs;
 
 extern unsigned long __init bootmem_bootmap_pages_bs(unsigned long);
@@ -0,0 +1,32 @@
+#ifndef _BISCUITOS_CMA_H
+#define _BISCUITOS_CMA_H
+
+#include <linux/mutex.h>
+
+/*
+ * Contiguous Memory Allocator.  Areas are set aside at boot with
+ * cma_bs=size[@base] and lent to the buddy allocator for movable pages,
+ * which are migrated out again when a driver asks for a range.
+ */
+#define MAX_CMA_AREAS_BS	4
+
+struct page_bs;
+
+struct cma_bs {
+	unsigned long	base_pfn;
+	unsigned long	count;		/* pages in the area */
+	unsigned long	*bitmap;	/* one bit per page handed out */
+	struct mutex	lock;		/* protects bitmap */
+};
+
+extern struct cma_bs cma_areas_bs[MAX_CMA_AREAS_BS];
+extern unsigned int cma_area_count_bs;
+
+extern void __init cma_reserve_bs(void);
+extern unsigned long __init cma_init_reserved_areas_bs(void);
+extern struct page_bs *cma_alloc_bs(struct cma_bs *cma, unsigned long count,
+						unsigned int align);
+extern int cma_release_bs(struct cma_bs *cma, struct page_bs *pages,
+						unsigned long count);
+
+#endif
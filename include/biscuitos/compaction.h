@@ -0,0 +1,22 @@
+#ifndef _BISCUITOS_COMPACTION_H
+#define _BISCUITOS_COMPACTION_H
+
+/* Return values for compact_zone() and try_to_compact_pages() */
+/* compaction didn't start as it was not possible or direct reclaim
+ * was more suitable */
+#define COMPACT_SKIPPED_BS	0
+/* compaction should continue to another pageblock */
+#define COMPACT_CONTINUE_BS	1
+/* direct compaction partially compacted a zone and there are suitable pages */
+#define COMPACT_PARTIAL_BS	2
+/* The full zone was compacted */
+#define COMPACT_COMPLETE_BS	3
+
+struct zone_bs;
+struct pglist_data_bs;
+
+extern int try_to_compact_pages_bs(struct zone_bs **zones, int order,
+						unsigned int gfp_mask);
+extern void compact_pgdat_bs(struct pglist_data_bs *pgdat, int order);
+
+#endif
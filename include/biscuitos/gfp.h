@@ -35,6 +35,8 @@
 #define __GFP_COMP_BS		0x4000u	/* Add compound page metadata */
 #define __GFP_ZERO_BS		0x8000u	/* Return zeroed page on success */
 #define __GFP_NOMEMALLOC_BS	0x10000u /* Don't use emergency reserves */
+#define __GFP_RECLAIMABLE_BS	0x20000u /* Freed by a shrinker */
+#define __GFP_MOVABLE_BS	0x40000u /* Can be migrated by compaction */
 
 #define __GFP_BITS_SHIFT_BS	20     /* Room for 20 __GFP_FOO bits */
 #define __GFP_BITS_MASK_BS	((1 << __GFP_BITS_SHIFT_BS) - 1)
@@ -46,7 +48,8 @@
 				 __GFP_NOWARN_BS | __GFP_REPEAT_BS | \
 				 __GFP_NOFAIL_BS | __GFP_NORETRY_BS | \
 				 __GFP_NO_GROW_BS | __GFP_COMP_BS | \
-				 __GFP_NOMEMALLOC_BS)
+				 __GFP_NOMEMALLOC_BS | __GFP_RECLAIMABLE_BS | \
+				 __GFP_MOVABLE_BS)
 
 #define GFP_ATOMIC_BS		(__GFP_HIGH_BS)
 #define GFP_NOIO_BS		(__GFP_WAIT_BS)
@@ -55,12 +58,23 @@
 #define GFP_USER_BS		(__GFP_WAIT_BS | __GFP_IO_BS | __GFP_FS_BS)
 #define GFP_HIGHUSER_BS		(__GFP_WAIT_BS | __GFP_IO_BS | __GFP_FS_BS | \
 						 __GFP_HIGHMEM_BS)
+#define GFP_HIGHUSER_MOVABLE_BS	(GFP_HIGHUSER_BS | __GFP_MOVABLE_BS)
 
 /* Flag - indicates that the buffer will be suitable for DMA.  Ignored on some
    platforms, used as appropriate on others */
 
 #define GFP_DMA_BS		__GFP_DMA_BS
 
+/* Convert GFP flags to the free lists they should be served from */
+static inline int gfpflags_to_migratetype_bs(unsigned int gfp_flags)
+{
+	if (gfp_flags & __GFP_MOVABLE_BS)
+		return MIGRATE_MOVABLE_BS;
+	if (gfp_flags & __GFP_RECLAIMABLE_BS)
+		return MIGRATE_RECLAIMABLE_BS;
+	return MIGRATE_UNMOVABLE_BS;
+}
+
 extern void __free_pages_bs(struct page_bs *page, unsigned int order);
 
 #define __free_page_bs(page)	__free_pages_bs((page), 0)
@@ -1,6 +1,7 @@
 #ifndef _BISCUITOS_HIGHMEM_H
 #define _BSICUTIOS_HIGHMEM_H
 
+#include <linux/string.h>
 #include "asm-generated/kmap_types.h"
 #include "asm-generated/fixmap.h"
 
@@ -10,14 +11,30 @@
 extern void *kmap_atomic_bs(struct page_bs *page, enum km_type_bs type);
 extern void kunmap_atomic_bs(void *kvaddr, enum km_type_bs type);
 extern struct page_bs *kmap_atomic_to_page_bs(void *ptr);
+extern void *kmap_local_page_bs(struct page_bs *page);
+extern void kunmap_local_bs(void *kvaddr);
 
-static inline void clear_highpage_bs(struct page_bs *page)
+static inline void memcpy_from_page_bs(char *to, struct page_bs *page,
+					size_t offset, size_t len)
 {
-	void *kaddr = kmap_atomic_bs(page, KM_USER0_BS);
-	clear_page_bs(kaddr);
-	kunmap_atomic_bs(kaddr, KM_USER0_BS);
+	char *from = kmap_local_page_bs(page);
+
+	memcpy(to, from + offset, len);
+	kunmap_local_bs(from);
+}
+
+static inline void memcpy_to_page_bs(struct page_bs *page, size_t offset,
+					const char *from, size_t len)
+{
+	char *to = kmap_local_page_bs(page);
+
+	memcpy(to + offset, from, len);
+	kunmap_local_bs(to);
 }
 
+extern void clear_highpage_bs(struct page_bs *page);
+extern void copy_highpage_bs(struct page_bs *to, struct page_bs *from);
+
 extern pte_t_bs *pkmap_page_table_bs;
 
 extern void *FASTCALL_BS(kmap_high_bs(struct page_bs *page));
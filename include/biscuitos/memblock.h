@@ -0,0 +1,73 @@
+#ifndef _BISCUITOS_MEMBLOCK_H
+#define _BISCUITOS_MEMBLOCK_H
+
+#include <linux/types.h>
+
+/*
+ * Early physical memory allocator.  Two sorted, non-overlapping arrays
+ * of regions: the RAM setup_arch() registered, and what is reserved or
+ * handed out inside it.  Everything is O(regions), whatever the size
+ * of memory.  bootmem.c keeps the old bootmem API on top of it.
+ */
+#define INIT_MEMBLOCK_REGIONS_BS	128
+
+struct memblock_region_bs {
+	unsigned long base;
+	unsigned long size;
+};
+
+struct memblock_type_bs {
+	unsigned long cnt;		/* number of regions */
+	unsigned long max;		/* size of the regions array */
+	unsigned long total_size;	/* bytes covered by all regions */
+	struct memblock_region_bs *regions;
+	char *name;
+};
+
+struct memblock_bs {
+	int bottom_up;			/* allocate upwards from the start? */
+	unsigned long current_limit;	/* highest address to allocate below */
+	struct memblock_type_bs memory;
+	struct memblock_type_bs reserved;
+};
+
+extern struct memblock_bs memblock_bs;
+
+#define MEMBLOCK_ALLOC_ANYWHERE_BS	(~0UL)
+
+extern int memblock_add_bs(unsigned long base, unsigned long size);
+extern int memblock_remove_bs(unsigned long base, unsigned long size);
+extern int memblock_reserve_bs(unsigned long base, unsigned long size);
+extern int memblock_free_bs(unsigned long base, unsigned long size);
+extern unsigned long memblock_find_in_range_bs(unsigned long start,
+			unsigned long end, unsigned long size,
+			unsigned long align);
+extern unsigned long memblock_alloc_range_bs(unsigned long size,
+			unsigned long align, unsigned long start,
+			unsigned long end);
+extern int memblock_is_memory_bs(unsigned long addr);
+extern int memblock_is_reserved_bs(unsigned long addr);
+extern void memblock_dump_all_bs(void);
+
+static inline void memblock_set_bottom_up_bs(int enable)
+{
+	memblock_bs.bottom_up = enable;
+}
+
+static inline void memblock_set_current_limit_bs(unsigned long limit)
+{
+	memblock_bs.current_limit = limit;
+}
+
+extern void __next_free_mem_range_bs(u64 *idx, unsigned long *out_start,
+			unsigned long *out_end);
+
+/*
+ * Walk the ranges that are memory and not reserved, in ascending order.
+ */
+#define for_each_free_mem_range_bs(i, p_start, p_end)			\
+	for (i = 0, __next_free_mem_range_bs(&i, p_start, p_end);	\
+	     i != (u64)ULLONG_MAX;					\
+	     __next_free_mem_range_bs(&i, p_start, p_end))
+
+#endif
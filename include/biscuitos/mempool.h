@@ -2,10 +2,41 @@
 #define _BISCUITOS_MEMPOOL_H
 
 #include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "biscuitos/cache.h"
 
 typedef void * (mempool_alloc_t_bs)(unsigned int __nocast gfp_mask, void *pool_data);
 typedef void (mempool_free_t_bs)(void *element, void *pool_data);
 
+/*
+ * mempool_create_flags() flags
+ */
+#define MEMPOOL_PERCPU_BS	0x01	/* per-CPU element stashes */
+#define MEMPOOL_RESERVE_FIRST_BS 0x02	/* serve from the reserve first */
+#define MEMPOOL_PAGES_BS	0x04	/* elements are buddy pages */
+#define MEMPOOL_ZERO_BS		0x08	/* page pools: hand out zeroed pages */
+
+/*
+ * Number of reserved elements each CPU may hold in its stash.
+ */
+#define MEMPOOL_STASH_BS	8
+
+struct mempool_stash_bs {
+	int nr;
+	void *elements[MEMPOOL_STASH_BS];
+} ____cacheline_aligned_in_smp_bs;
+
+/*
+ * Per-CPU mempool_alloc() statistics, summed up by /proc/mempoolinfo_bs.
+ */
+struct mempool_stats_bs {
+	unsigned long alloc_hit;	/* served by pool->alloc */
+	unsigned long reserve_hit;	/* served from the reserve */
+	unsigned long reserve_miss;	/* allocator and reserve both empty */
+	unsigned long wait;		/* slept on pool->wait */
+	unsigned long wait_us;		/* total time slept */
+} ____cacheline_aligned_in_smp_bs;
+
 typedef struct mempool_s_bs {
 	spinlock_t lock;
 	int min_nr;		/* nr of elements at *elements */
@@ -16,6 +47,28 @@ typedef struct mempool_s_bs {
 	mempool_alloc_t_bs *alloc;
 	mempool_free_t_bs *free;
 	wait_queue_head_t wait;
+
+	unsigned int flags;
+	/*
+	 * MEMPOOL_RESERVE_FIRST: refill_work tops the reserve up to
+	 * min_nr + high_nr in the background.
+	 */
+	int high_nr;
+	struct work_struct refill_work;
+	/*
+	 * MEMPOOL_PERCPU: stash[NR_CPUS] sits in front of *elements.
+	 * reserved counts the elements of both, and never exceeds
+	 * min_nr + high_nr.
+	 */
+	struct mempool_stash_bs *stash;
+	atomic_t reserved;
+
+	/* telemetry */
+	struct list_head list;		/* all pools, for mempoolinfo */
+	void *caller;			/* creator */
+	int low_nr;			/* low-water mark of reserved */
+	unsigned long max_wait_us;	/* longest single wait */
+	struct mempool_stats_bs stats[NR_CPUS_BS];
 } mempool_t_bs;
 
 /*
@@ -24,11 +77,27 @@ typedef struct mempool_s_bs {
  */
 void *mempool_alloc_slab_bs(unsigned int __nocast gfp_mask, void *pool_data);
 void mempool_free_slab_bs(void *element, void *pool_data);
+
+/*
+ * A mempool_alloc_t and mempool_free_t for pages of the order passed
+ * in through pool_data. See mempool_create_page_pool().
+ */
+void *mempool_alloc_pages_bs(unsigned int __nocast gfp_mask, void *pool_data);
+void mempool_free_pages_bs(void *element, void *pool_data);
+mempool_t_bs *mempool_create_page_pool_bs(int min_nr, int order, int high_nr,
+			unsigned int flags);
 void mempool_free_bs(void *element, mempool_t_bs *pool);
 void *mempool_alloc_bs(mempool_t_bs *pool, unsigned int __nocast gfp_mask);
 void mempool_destroy_bs(mempool_t_bs *pool);
 mempool_t_bs *mempool_create_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
 			mempool_free_t_bs *free_fn, void *pool_data);
+mempool_t_bs *mempool_create_flags_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
+			mempool_free_t_bs *free_fn, void *pool_data,
+			unsigned int flags);
+mempool_t_bs *mempool_create_reserve_bs(int min_nr, int high_nr,
+			mempool_alloc_t_bs *alloc_fn, mempool_free_t_bs *free_fn,
+			void *pool_data, unsigned int flags);
 int mempool_resize_bs(mempool_t_bs *, int, unsigned int __nocast);
+int mempool_resize_marks_bs(mempool_t_bs *, int, int, unsigned int __nocast);
 
 #endif
@@ -35,22 +35,39 @@ struct address_space;
  * it to keep track of whatever it is we are using the page for at the
  * moment. Note that we have no way to track which tasks are using
  * a page.
+ *
+ * The fields are ordered by who touches them.  The buddy allocator
+ * works on flags, _count, private and lru, reclaim on flags, _count,
+ * lru and mapping, rmap on mapping, index and _mapcount, so each of
+ * them reads one contiguous run of at most six words.  mem_map is cache
+ * line aligned and, without WANT_PAGE_VIRTUAL, eight words long, so no
+ * page straddles two lines on 32 bit ARM.
  */
+struct kmem_cache_s_bs;
+struct slab_bs;
+
 struct page_bs {
 	page_flags_t_bs flags;          /* Atomic flags, some possibly
 					 * updated asynchronously */
 	atomic_t _count;                /* Usage count, see below. */
-	atomic_t _mapcount;             /* Count of ptes mapped in mms,
-					 * to show when page is mapped
-					 * & limit reverse map searches.
-					 */
 	unsigned long private;          /* Mapping-private opaque data:
 					 * usually used for buffer_heads
 					 * if PagePrivate set; used for
 					 * swp_entry_t if PageSwapCache
 					 * When page is free, this indicates
-					 * order in the buddy system.
+					 * order in the buddy system, or
+					 * the migrate type on the per-cpu
+					 * lists.
 					 */
+	union {
+		struct list_head lru;   /* Pageout list, eg. active_list
+					 * protected by its LRU sublist lock !
+					 */
+		struct {                /* Pages owned by the slab */
+			struct kmem_cache_s_bs *slab_cache;
+			struct slab_bs *slab_page;
+		};
+	};
 	struct address_space *mapping; /* If low bit clear, points to
 					 * inode address_space, or NULL.
 					 * If page mapped as anonymous
@@ -59,8 +76,9 @@ struct page_bs {
 					 * see PAGE_MAPPING_ANON below.
 					 */
 	pgoff_t index;                  /* Our offset within mapping. */
-	struct list_head lru;           /* Pageout list, eg. active_list
-					 * protected by zone->lru_lock !
+	atomic_t _mapcount;             /* Count of ptes mapped in mms,
+					 * to show when page is mapped
+					 * & limit reverse map searches.
 					 */
 	/*
 	 * On machines where all RAM is mapped into kernel address space,
@@ -71,13 +89,26 @@ struct page_bs {
 	 *
 	 * Architectures with slow multiplication can define
 	 * WANT_PAGE_VIRTUAL in asm/page.h
+	 *
+	 * Only highmem pages read it, so it sits past the hot fields.
 	 */
-#if defined(WANT_PAGE_VIRTUAL)
+#if defined(WANT_PAGE_VIRTUAL) || defined(WANT_PAGE_VIRTUAL_BS)
 	void *virtual;                  /* Kernel virtual address (NULL if
 					   not kmapped, ie. highmem) */
-#endif /* WANT_PAGE_VIRTUAL */
+#endif /* WANT_PAGE_VIRTUAL || WANT_PAGE_VIRTUAL_BS */
 };
 
+/*
+ * Upper bound on sizeof(struct page_bs), checked at build time: mem_map
+ * is the largest boot time allocation, a word more per page is a word
+ * more per 4K of RAM.
+ */
+#if defined(WANT_PAGE_VIRTUAL) || defined(WANT_PAGE_VIRTUAL_BS)
+#define STRUCT_PAGE_MAX_WORDS_BS	9
+#else
+#define STRUCT_PAGE_MAX_WORDS_BS	8
+#endif
+
 /* FIXME: */
 struct shmem_page {
 	struct page page;
@@ -109,6 +140,13 @@ struct shmem_page {
 #define set_page_count_bs(p,v)	atomic_set(&(p)->_count, v - 1)
 #define __put_page_bs(p)	atomic_dec(&(p)->_count)
 
+static inline void get_page_bs(struct page_bs *page)
+{
+	if (unlikely(PageCompound_bs(page)))
+		page = (struct page_bs *)page->private;
+	atomic_inc(&page->_count);
+}
+
 static inline int page_count_bs(struct page_bs *p)
 {
 	if (PageCompound_bs(p))
@@ -128,6 +166,46 @@ static inline void set_page_zone_bs(struct page_bs *page,
 	page->flags |= nodezone_num << NODEZONE_SHIFT_BS;
 }
 
+#ifdef CONFIG_SPARSEMEM_BS
+/*
+ * The section number sits right below the node/zone bits.
+ */
+#define SECTIONS_PGSHIFT_BS	(NODEZONE_SHIFT_BS - SECTIONS_WIDTH_BS)
+#define SECTIONS_MASK_BS	((1UL << SECTIONS_WIDTH_BS) - 1)
+
+static inline unsigned long page_to_section_bs(struct page_bs *page)
+{
+	return (page->flags >> SECTIONS_PGSHIFT_BS) & SECTIONS_MASK_BS;
+}
+
+static inline void set_page_section_bs(struct page_bs *page,
+					unsigned long section)
+{
+	page->flags &= ~(SECTIONS_MASK_BS << SECTIONS_PGSHIFT_BS);
+	page->flags |= (section & SECTIONS_MASK_BS) << SECTIONS_PGSHIFT_BS;
+}
+
+static inline unsigned long page_to_pfn_bs(struct page_bs *page)
+{
+	return page - __section_mem_map_addr_bs(
+				__nr_to_section_bs(page_to_section_bs(page)));
+}
+
+static inline struct page_bs *pfn_to_page_bs(unsigned long pfn)
+{
+	return __section_mem_map_addr_bs(__pfn_to_section_bs(pfn)) + pfn;
+}
+#endif
+
+static inline void set_page_links_bs(struct page_bs *page, unsigned long zone,
+					int nid, unsigned long pfn)
+{
+	set_page_zone_bs(page, NODEZONE_BS(nid, zone));
+#ifdef CONFIG_SPARSEMEM_BS
+	set_page_section_bs(page, pfn_to_section_nr_bs(pfn));
+#endif
+}
+
 #define set_page_count_bs(p, v)		atomic_set(&(p)->_count, v - 1)
 
 /*      
@@ -144,6 +222,14 @@ static inline void page_alloc_init_bs(void)
 {
 }
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+extern void deferred_init_memmap_bs(void);
+extern void page_alloc_init_late_bs(void);
+#else
+static inline void deferred_init_memmap_bs(void) { }
+static inline void page_alloc_init_late_bs(void) { }
+#endif
+
 /*      
  * On an anonymous page mapped into a user virtual memory area,
  * page->mapping points to its anon_vma, not to a struct address_space;
@@ -193,12 +279,32 @@ kernel_map_pages_bs(struct page_bs *page, int numpages, int enable)
 }
 #endif
 
+static inline unsigned long pageblock_index_bs(struct page_bs *page)
+{
+	struct zone_bs *zone = page_zone_bs(page);
+
+	return (page_to_pfn_bs(page) >> pageblock_order_bs) -
+			(zone->zone_start_pfn >> pageblock_order_bs);
+}
+
+static inline int get_pageblock_migratetype_bs(struct page_bs *page)
+{
+	return page_zone_bs(page)->pageblock_migratetype[
+					pageblock_index_bs(page)];
+}
+
+static inline void
+set_pageblock_migratetype_bs(struct page_bs *page, int migratetype)
+{
+	page_zone_bs(page)->pageblock_migratetype[
+					pageblock_index_bs(page)] = migratetype;
+}
+
 static inline int page_mapcount_bs(struct page_bs *page)
 {
 	return atomic_read(&(page)->_mapcount) + 1;
 }
 
-void *page_address_bs(struct page_bs *page);
 void set_page_address_bs(struct page_bs *page, void *virtual);
 
 static inline void *lowmem_page_address_bs(struct page_bs *page)
@@ -206,9 +312,51 @@ static inline void *lowmem_page_address_bs(struct page_bs *page)
 	return __va_bs(page_to_pfn_bs(page) << PAGE_SHIFT_BS);
 }
 
+static inline void *page_address_bs(struct page_bs *page)
+{
+#if defined(WANT_PAGE_VIRTUAL_BS)
+	if (PageHighMem_bs(page))
+		return READ_ONCE(page->virtual);
+#endif
+	return lowmem_page_address_bs(page);
+}
+
 extern unsigned long num_physpages_bs;
 extern pte_t_bs *FASTCALL_BS(pte_alloc_kernel_bs(struct mm_struct_bs *mm,
 				pmd_t_bs *pmd, unsigned long address));
+
+/*
+ * Generic page table walker.  Each callback gets the entry and the
+ * [addr, next) span it covers, and a non-zero return stops the walk
+ * and is handed back by walk_page_range_bs().
+ *
+ * pte_entry is called once per PTE table with its first entry, not once
+ * per pte, so the callback runs the per-pte loop itself.  Empty or leaf
+ * upper entries are reported to pte_hole in one step.  With
+ * MM_WALK_ALLOC_BS missing tables are allocated instead (kernel page
+ * tables only) and pte_hole is never called.  When pmd_entry is set the
+ * walker does not descend below the pmd unless pte_entry is set too.
+ */
+struct mm_walk_bs {
+	int (*pgd_entry)(pgd_t_bs *pgd, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk);
+	int (*pud_entry)(pud_t_bs *pud, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk);
+	int (*pmd_entry)(pmd_t_bs *pmd, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk);
+	int (*pte_entry)(pte_t_bs *pte, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk);
+	int (*pte_hole)(unsigned long addr, unsigned long next,
+				struct mm_walk_bs *walk);
+	struct mm_struct_bs *mm;
+	unsigned int flags;
+	void *private;
+};
+
+#define MM_WALK_ALLOC_BS	0x0001	/* populate missing tables */
+
+extern int walk_page_range_bs(unsigned long addr, unsigned long end,
+				struct mm_walk_bs *walk);
 extern void show_free_areas_bs(void);
 struct sysinfo_bs;
 extern void si_meminfo_bs(struct sysinfo_bs *);
@@ -216,4 +364,40 @@ extern int __set_page_dirty_nobuffers_bs(struct page *page);
 extern void PAGE_TO_PAGE_BS(struct page *page, struct page_bs *page_bs);
 extern void PAGE_BS_TO_PAGE(struct page *page, struct page_bs *page_bs);
 
+/*
+ * A shrinker lets page reclaim trim a cache of reclaimable objects.
+ *
+ * count_objects() returns how many objects the cache could free right
+ * now.  scan_objects() tries to free sc->nr_to_scan of them and returns
+ * how many it freed, or SHRINK_STOP if it cannot make progress in this
+ * context (locks held, wrong gfp_mask).
+ *
+ * Reclaim asks each shrinker to scan in proportion to the fraction of
+ * the LRU it scanned itself, divided by `seeks': the cost of recreating
+ * an object relative to reading back a page.
+ */
+struct shrink_control_bs {
+	unsigned int gfp_mask;
+	unsigned long nr_to_scan;
+};
+
+#define SHRINK_STOP_BS		(~0UL)
+#define DEFAULT_SEEKS_BS	2	/* A good number if you don't know better. */
+
+struct shrinker_bs {
+	unsigned long (*count_objects)(struct shrinker_bs *,
+					struct shrink_control_bs *sc);
+	unsigned long (*scan_objects)(struct shrinker_bs *,
+					struct shrink_control_bs *sc);
+	int seeks;			/* seeks to recreate an obj */
+	long batch;			/* objects per scan_objects() call */
+
+	/* These are for internal use */
+	struct list_head list;
+	long nr;			/* objs pending delete */
+};
+
+extern void register_shrinker_bs(struct shrinker_bs *shrinker);
+extern void unregister_shrinker_bs(struct shrinker_bs *shrinker);
+
 #endif
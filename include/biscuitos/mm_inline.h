@@ -1,26 +1,149 @@
+/*
+ * Every helper below works on the LRU sublist a page hashes to, and must
+ * be called with that sublist's lock held.
+ */
+static inline struct lru_sublist_bs *page_lru_sublist_bs(struct page_bs *page)
+{
+	return &page_zone_bs(page)->lru[page_to_pfn_bs(page) &
+						(NR_LRU_SUBLISTS_BS - 1)];
+}
+
+#ifdef CONFIG_LRU_GEN_BS
+/*
+ * page->flags bits [LRU_GEN_PGOFF, LRU_GEN_PGOFF + LRU_GEN_WIDTH) hold the
+ * generation the page sits in plus one; zero means it is not on a
+ * generation list.  Everything below runs under the sublist lock, but
+ * other flag bits are changed with atomic bitops, so update with cmpxchg.
+ */
+#define LRU_GEN_PGOFF_BS	21
+#define LRU_GEN_WIDTH_BS	3
+#define LRU_GEN_MASK_BS		(((1UL << LRU_GEN_WIDTH_BS) - 1) << \
+							LRU_GEN_PGOFF_BS)
+
+static inline int lru_gen_from_seq_bs(unsigned long seq)
+{
+	return seq % MAX_NR_GENS_BS;
+}
+
+static inline int page_lru_gen_bs(struct page_bs *page)
+{
+	return ((page->flags & LRU_GEN_MASK_BS) >> LRU_GEN_PGOFF_BS) - 1;
+}
+
+static inline void set_page_lru_gen_bs(struct page_bs *page, int gen)
+{
+	unsigned long old, new;
+
+	do {
+		old = READ_ONCE(page->flags);
+		new = (old & ~LRU_GEN_MASK_BS) |
+				((gen + 1UL) << LRU_GEN_PGOFF_BS);
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+/*
+ * The generations all count as inactive pages, so that the sums in
+ * try_to_free_pages() and balance_pgdat() keep working unchanged.
+ */
+static inline void
+lru_gen_add_page_bs(struct lru_sublist_bs *lru, struct page_bs *page, int gen)
+{
+	ClearPageActive_bs(page);
+	set_page_lru_gen_bs(page, gen);
+	list_add(&page->lru, &lru->lrugen.lists[gen]);
+	lru->lrugen.nr_pages[gen]++;
+	lru->nr_inactive++;
+}
+
+static inline void
+lru_gen_del_page_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	int gen = page_lru_gen_bs(page);
+
+	list_del(&page->lru);
+	set_page_lru_gen_bs(page, -1);
+	lru->lrugen.nr_pages[gen]--;
+	lru->nr_inactive--;
+}
+
+/* The youngest generation plays the part of the active list */
+static inline int
+page_lru_active_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	return page_lru_gen_bs(page) == lru_gen_from_seq_bs(lru->lrugen.max_seq);
+}
+
+/* Active pages start out in the youngest generation ... */
+static inline void
+add_page_to_active_list_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	lru_gen_add_page_bs(lru, page,
+			lru_gen_from_seq_bs(lru->lrugen.max_seq));
+}
+
+/* ... and everything else one behind it. */
+static inline void
+add_page_to_inactive_list_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	lru_gen_add_page_bs(lru, page,
+			lru_gen_from_seq_bs(lru->lrugen.max_seq - 1));
+}
+
+/* Next in line for eviction: the far end of the oldest generation */
+static inline void
+add_page_to_inactive_list_tail_bs(struct lru_sublist_bs *lru,
+						struct page_bs *page)
+{
+	int gen = lru_gen_from_seq_bs(lru->lrugen.min_seq);
+
+	lru_gen_add_page_bs(lru, page, gen);
+	list_move_tail(&page->lru, &lru->lrugen.lists[gen]);
+}
+
+static inline void
+del_page_from_lru_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	lru_gen_del_page_bs(lru, page);
+	ClearPageActive_bs(page);
+}
+#else
+static inline int
+page_lru_active_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	return PageActive_bs(page);
+}
+
+static inline void
+add_page_to_active_list_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	list_add(&page->lru, &lru->active_list);
+	lru->nr_active++;
+}
 
 static inline void
-add_page_to_active_list_bs(struct zone_bs *zone, struct page_bs *page)
+add_page_to_inactive_list_bs(struct lru_sublist_bs *lru, struct page_bs *page)
 {
-	list_add(&page->lru, &zone->active_list);
-	zone->nr_active++;
+	list_add(&page->lru, &lru->inactive_list);
+	lru->nr_inactive++;
 }
 
 static inline void
-add_page_to_inactive_list_bs(struct zone_bs *zone, struct page_bs *page)
+add_page_to_inactive_list_tail_bs(struct lru_sublist_bs *lru,
+						struct page_bs *page)
 {
-	list_add(&page->lru, &zone->inactive_list);
-	zone->nr_inactive++;
+	list_add_tail(&page->lru, &lru->inactive_list);
+	lru->nr_inactive++;
 }
 
 static inline void
-del_page_from_lru_bs(struct zone_bs *zone, struct page_bs *page)
+del_page_from_lru_bs(struct lru_sublist_bs *lru, struct page_bs *page)
 {
 	list_del(&page->lru);
 	if (PageActive_bs(page)) {
 		ClearPageActive_bs(page);
-		zone->nr_active--;
+		lru->nr_active--;
 	} else {
-		zone->nr_inactive--;
+		lru->nr_inactive--;
 	}
 }
+#endif /* CONFIG_LRU_GEN_BS */
@@ -2,11 +2,15 @@
 #define _BISCUTIOS_MM_TYPES_H
 
 #include <linux/spinlock.h>
+#include <linux/list.h>
 
 struct mm_struct_bs
 {
 	pgd_t_bs *pgd;
 	spinlock_t page_table_lock;
+#ifdef CONFIG_LRU_GEN_BS
+	struct list_head lru_gen_list;	/* walked by lru_gen aging */
+#endif
 };
 
 #endif
@@ -57,13 +57,74 @@
 #define DEF_PRIORITY_BS		12
 
 
+#ifdef CONFIG_LRU_GEN_BS
+/*
+ * Multi-generational LRU.  Instead of an active and an inactive list each
+ * zone keeps up to MAX_NR_GENS generations of pages, indexed by sequence
+ * number modulo MAX_NR_GENS.  max_seq is the youngest generation and
+ * min_seq the oldest; reclaim evicts from min_seq and aging opens a new
+ * max_seq.  At least MIN_NR_GENS generations are always kept so that a
+ * freshly aged page is never the next one evicted.
+ */
+#define MIN_NR_GENS_BS		2
+#define MAX_NR_GENS_BS		4
+
+struct lru_gen_bs {
+	unsigned long		max_seq;
+	unsigned long		min_seq;
+	struct list_head	lists[MAX_NR_GENS_BS];
+	unsigned long		nr_pages[MAX_NR_GENS_BS];
+};
+#endif
+
+/*
+ * The LRU of each zone is split into NR_LRU_SUBLISTS sublists, each with
+ * its own lock, and a page always lives on the sublist its pfn hashes to.
+ * CPUs adding freshly faulted pages and reclaimers isolating old ones
+ * then mostly take different locks instead of all queueing on one.
+ */
+#define LRU_SUBLIST_SHIFT_BS	2
+#define NR_LRU_SUBLISTS_BS	(1 << LRU_SUBLIST_SHIFT_BS)
+
+struct lru_sublist_bs {
+	spinlock_t		lock;
+	struct list_head	active_list;
+	struct list_head	inactive_list;
+	unsigned long		nr_active;
+	unsigned long		nr_inactive;
+#ifdef CONFIG_LRU_GEN_BS
+	struct lru_gen_bs	lrugen;		/* replaces the two lists */
+#endif
+} ____cacheline_aligned_in_smp_bs;
+
+/*
+ * Free pages are grouped by how their users can give them back.  Each
+ * pageblock is owned by one migrate type and its free pages go back to
+ * that type's lists, so unmovable allocations stay packed in their own
+ * blocks instead of pinning down blocks that compaction could empty.
+ */
+#define MIGRATE_UNMOVABLE_BS	0
+#define MIGRATE_RECLAIMABLE_BS	1
+#define MIGRATE_MOVABLE_BS	2
+#define MIGRATE_CMA_BS		3	/* Lent out by CMA, movable only */
+#define MIGRATE_ISOLATE_BS	4	/* Being taken, never handed out */
+#define MIGRATE_TYPES_BS	5
+/* Only the first three have per-cpu lists */
+#define MIGRATE_PCPTYPES_BS	3
+
+#define is_migrate_movable_bs(mt)	\
+	((mt) == MIGRATE_MOVABLE_BS || (mt) == MIGRATE_CMA_BS)
+
+#define pageblock_order_bs	(MAX_ORDER_BS - 1)
+#define pageblock_nr_pages_bs	(1UL << pageblock_order_bs)
+
 struct free_area_bs {
-	struct list_head	free_list;
+	struct list_head	free_list[MIGRATE_TYPES_BS];
 	unsigned long		nr_free;
 };
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
+ * zone->lock and the LRU locks are two of the hottest locks in the kernel.
  * So add a wild amount of padding here to ensure that they fall into separate
  * cachelines.  There are very few zone structures in the machine, so space
  * consumption is not a concern here.
@@ -78,11 +139,11 @@ struct zone_padding_bs {
 #endif
 
 struct per_cpu_pages_bs {
-	int count;		/* number of pages in the list */
-	int low;		/* low watermark, refill needed */
+	int count;		/* number of pages on the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
-	struct list_head list;	/* the list of pages */
+	/* one list per migrate type, so allocation takes the first page */
+	struct list_head lists[MIGRATE_PCPTYPES_BS];
 };
 
 struct per_cpu_pageset_bs {
@@ -110,6 +171,12 @@ struct zone_bs {
 	/* Fields commonly accessed by the page allocator */
 	unsigned long		free_pages;
 	unsigned long		pages_min, pages_low, pages_high;
+	/*
+	 * Extra pages kswapd reclaims beyond pages_high after allocations
+	 * had to fall back to direct reclaim or found no free block large
+	 * enough.  Cleared once kswapd has met the raised target.
+	 */
+	unsigned long		watermark_boost;
 	/*
 	 * We don't know if the memory that we're going to allocate will 
 	 * be freeable or/and it will be released eventually, so to avoid
@@ -128,18 +195,17 @@ struct zone_bs {
 	 */
 	spinlock_t		lock;
 	struct free_area_bs	free_area[MAX_ORDER_BS];
+	/* Owning migrate type of each pageblock the zone spans */
+	unsigned char		*pageblock_migratetype;
 
 	ZONE_PADDING_BS(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;
-	struct list_head	active_list;
-	struct list_head	inactive_list;
+	struct lru_sublist_bs	lru[NR_LRU_SUBLISTS_BS];
 	unsigned long		nr_scan_active;
 	unsigned long		nr_scan_inactive;
-	unsigned long		nr_active;
-	unsigned long		nr_inactive;
-	unsigned long		pages_scanned;	    /* since last reclaim */
+	/* Scanned since last reclaim, bumped under the sublist locks */
+	atomic_long_t		pages_scanned;
 	int			all_unreclaimable;  /* All pages pinned */
 
 	/*
@@ -161,6 +227,22 @@ struct zone_bs {
 	int temp_priority;
 	int prev_priority;
 
+	/*
+	 * Compaction runs against this zone, how many of them freed a block
+	 * of the order asked for, and how many pages they moved.
+	 */
+	unsigned long		compact_stall;
+	unsigned long		compact_success;
+	unsigned long		compact_migrated;
+
+	/*
+	 * After a failed direct compaction the zone is skipped for the next
+	 * 1 << compact_defer_shift attempts at compact_order_failed or above.
+	 */
+	unsigned int		compact_considered;
+	unsigned int		compact_defer_shift;
+	int			compact_order_failed;
+
 	ZONE_PADDING_BS(_pad2_)
 	/* Rarely used or read-mostly fields */
 
@@ -210,6 +292,30 @@ struct zone_bs {
 	char                    *name;
 } ____cacheline_maxaligned_in_smp_bs;
 
+/*
+ * Unlocked sums over the LRU sublists, for the reclaim heuristics and
+ * for reporting.
+ */
+static inline unsigned long zone_nr_active_bs(struct zone_bs *zone)
+{
+	unsigned long nr = 0;
+	int i;
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++)
+		nr += zone->lru[i].nr_active;
+	return nr;
+}
+
+static inline unsigned long zone_nr_inactive_bs(struct zone_bs *zone)
+{
+	unsigned long nr = 0;
+	int i;
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++)
+		nr += zone->lru[i].nr_inactive;
+	return nr;
+}
+
 /*
  * One allocation request operates on a zonelist. A zonelist
  * is a list of zones, the first one is the 'goal' of the
@@ -243,8 +349,21 @@ typedef struct pglist_data_bs {
 	wait_queue_head_t kswapd_wait;
 	int kswapd_max_order;
 	struct task_struct *kswapd;
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+	/*
+	 * struct pages from here to the end of the node are set up
+	 * after boot, by deferred_init_memmap().
+	 */
+	unsigned long first_deferred_pfn;
+#endif
 } pg_data_t_bs;
 
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+#define pgdat_first_deferred_pfn_bs(pgdat)	((pgdat)->first_deferred_pfn)
+#else
+#define pgdat_first_deferred_pfn_bs(pgdat)	(~0UL)
+#endif
+
 extern struct pglist_data_bs contig_page_data_bs;
 extern struct pglist_data_bs *pgdat_list_bs;
 
@@ -301,6 +420,61 @@ static inline int is_normal_bs(struct zone_bs *zone)
 
 extern void __init build_all_zonelists_bs(void);
 
+#ifdef CONFIG_SPARSEMEM_BS
+/*
+ * SPARSEMEM: physical memory is cut into sections of 2^SECTION_SIZE_BITS
+ * bytes counted from PHYS_OFFSET, see asm-generated/memory.h.  Only the
+ * sections memory_present() was told about get a mem_map, so a hole
+ * between two banks costs one word per section instead of a struct
+ * page per missing page.  The section number is kept in page->flags.
+ */
+#define SECTIONS_WIDTH_BS	5
+#define NR_MEM_SECTIONS_BS	(1UL << SECTIONS_WIDTH_BS)
+#define PFN_SECTION_SHIFT_BS	(SECTION_SIZE_BITS_BS - PAGE_SHIFT_BS)
+#define PAGES_PER_SECTION_BS	(1UL << PFN_SECTION_SHIFT_BS)
+#define PAGE_SECTION_MASK_BS	(~(PAGES_PER_SECTION_BS - 1))
+
+struct mem_section_bs {
+	/*
+	 * The section's mem_map minus its first pfn, so that
+	 * pfn_to_page() is one add.  The low bits hold the flags below.
+	 */
+	unsigned long section_mem_map;
+};
+
+#define SECTION_MARKED_PRESENT_BS	(1UL << 0)
+#define SECTION_HAS_MEM_MAP_BS		(1UL << 1)
+#define SECTION_MAP_MASK_BS		(~3UL)
+
+extern struct mem_section_bs mem_section_bs[NR_MEM_SECTIONS_BS];
+
+#define pfn_to_section_nr_bs(pfn)	\
+	(((pfn) - PHYS_PFN_OFFSET_BS) >> PFN_SECTION_SHIFT_BS)
+#define section_nr_to_pfn_bs(sec)	\
+	(((unsigned long)(sec) << PFN_SECTION_SHIFT_BS) + PHYS_PFN_OFFSET_BS)
+#define __nr_to_section_bs(nr)		(&mem_section_bs[(nr)])
+#define __pfn_to_section_bs(pfn)	\
+	__nr_to_section_bs(pfn_to_section_nr_bs(pfn))
+#define __section_mem_map_addr_bs(section)	\
+	((struct page_bs *)((section)->section_mem_map & SECTION_MAP_MASK_BS))
+#define valid_section_bs(section)	\
+	((section)->section_mem_map & SECTION_HAS_MEM_MAP_BS)
+
+#define pfn_valid_bs(pfn)					\
+	((pfn) >= PHYS_PFN_OFFSET_BS &&				\
+	 pfn_to_section_nr_bs(pfn) < NR_MEM_SECTIONS_BS &&	\
+	 valid_section_bs(__pfn_to_section_bs(pfn)))
+#define early_pfn_valid_bs(pfn)	pfn_valid_bs(pfn)
+
+extern void __init memory_present_bs(int nid, unsigned long start,
+						unsigned long end);
+extern void __init sparse_init_bs(void);
+#else
+#define early_pfn_valid_bs(pfn)			(1)
+#define memory_present_bs(nid, start, end)	do { } while (0)
+#define sparse_init_bs()			do { } while (0)
+#endif
+
 /*
  * next_zone - helper magic for for_each_zone()
  * Thanks to William Lee Irwin III for this piece of ingenuity.
@@ -343,5 +517,7 @@ static inline struct zone_bs *next_zone_bs(struct zone_bs *zone)
 extern int zone_watermark_ok_bs(struct zone_bs *z, int order, 
   unsigned long mark, int classzone_idx, int can_try_harder, int gfp_high);
 extern void wakeup_kswapd_bs(struct zone_bs *zone, int order);
+extern void boost_watermark_bs(struct zone_bs *zone, int order);
+extern int watermark_boost_factor_bs;
 
 #endif
@@ -122,6 +122,7 @@ extern unsigned long __read_page_state_bs(unsigned offset);
 
 
 #define inc_page_state_bs(member)	mod_page_state_bs(member, 1UL)
+#define dec_page_state_bs(member)	mod_page_state_bs(member, 0UL - 1)
 
 #define PageReserved_bs(page)		test_bit(PG_reserved_bs, &(page)->flags)
 #define SetPageReserved_bs(page)	set_bit(PG_reserved_bs, &(page)->flags)
@@ -129,8 +130,15 @@ extern unsigned long __read_page_state_bs(unsigned offset);
 			__clear_bit(PG_reserved_bs, &(page)->flags)
 
 #define PageDirty_bs(page)		test_bit(PG_dirty_bs, &(page)->flags)
+#define SetPageDirty_bs(page)		set_bit(PG_dirty_bs, &(page)->flags)
 #define ClearPageDirty_bs(page)		clear_bit(PG_dirty_bs, &(page)->flags)
 
+#define PageWriteback_bs(page)		test_bit(PG_writeback_bs, \
+								&(page)->flags)
+
+#define PageSwapCache_bs(page)		test_bit(PG_swapcache_bs, \
+								&(page)->flags)
+
 #define PagePrivate_bs(page)		test_bit(PG_private_bs, \
 								&(page)->flags)
 #define __ClearPagePrivate_bs(page)	__clear_bit(PG_private_bs, \
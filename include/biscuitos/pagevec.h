@@ -45,8 +45,18 @@ static inline unsigned pagevec_add_bs(struct pagevec_bs *pvec,
 	return pagevec_space_bs(pvec);
 }
 
+extern void __pagevec_release_bs(struct pagevec_bs *pvec);
+extern void __pagevec_lru_add_bs(struct pagevec_bs *pvec);
+extern void __pagevec_lru_add_active_bs(struct pagevec_bs *pvec);
+extern void __pagevec_release_nonlru_bs(struct pagevec_bs *pvec);
 extern void __pagevec_free_bs(struct pagevec_bs *pvec);
 
+static inline void pagevec_release_bs(struct pagevec_bs *pvec)
+{
+	if (pagevec_count_bs(pvec))
+		__pagevec_release_bs(pvec);
+}
+
 static inline void pagevec_free_bs(struct pagevec_bs *pvec)
 {
 	if (pagevec_count_bs(pvec))
@@ -20,6 +20,15 @@ struct anon_vma_bs {
 	struct list_head head;	/* List of private "related" vmas */
 };
 
+struct pagevec_bs;
+
+struct vm_area_struct;
+
+extern void page_add_anon_rmap_bs(struct page_bs *,
+				struct vm_area_struct *, unsigned long);
+extern void page_remove_rmap_bs(struct page_bs *);
 extern int page_referenced_bs(struct page_bs *, int, int);
+extern void page_referenced_batch_bs(struct pagevec_bs *, int *, int, int);
+extern int page_migrate_anon_bs(struct page_bs *, struct page_bs *);
 
 #endif
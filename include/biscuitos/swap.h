@@ -59,10 +59,26 @@ extern unsigned int nr_free_pages_bs(void);
 extern void out_of_memory_bs(unsigned int __nocast gfp_mask);
 extern void __init swap_setup_bs(void);
 struct zone_bs;
+struct page_bs;
 extern int try_to_free_pages_bs(struct zone_bs **zones, 
 			unsigned int gfp_mask, unsigned int order);
 
+extern void release_pages_bs(struct page_bs **pages, int nr, int cold);
+extern void lru_cache_add_bs(struct page_bs *page);
+extern void lru_cache_add_active_bs(struct page_bs *page);
+extern void activate_page_bs(struct page_bs *page);
+extern void deactivate_page_bs(struct page_bs *page);
+extern void rotate_reclaimable_page_bs(struct page_bs *page);
+extern void mark_page_accessed_bs(struct page_bs *page);
 extern void lru_add_drain_bs(void);
+extern int lru_add_drain_all_bs(void);
+#ifdef CONFIG_LRU_GEN_BS
+struct mm_struct_bs;
+struct lru_sublist_bs;
+extern void __init lru_gen_init_sublist_bs(struct lru_sublist_bs *lru);
+extern void lru_gen_add_mm_bs(struct mm_struct_bs *mm);
+extern void lru_gen_del_mm_bs(struct mm_struct_bs *mm);
+#endif
 extern unsigned int nr_free_pagecache_pages_bs(void);
 extern long total_swap_pages_bs;
 
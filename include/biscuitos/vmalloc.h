@@ -17,6 +17,7 @@ struct vm_struct_bs {
 	unsigned int		nr_pages;
 	unsigned long		phys_addr;
 	struct vm_struct_bs	*next;
+	void			*caller;
 };
 
 void *vmalloc_bs(unsigned long size);
@@ -223,6 +223,7 @@ asmlinkage void __init start_kernel_bs(void)
 	vfs_caches_init_early_bs();
 	mem_init_bs();
 	kmem_cache_init_bs();
+	page_alloc_init_late_bs();
 	DEBUG_CALL(module);
 	DEBUG_CALL(vmalloc);
 	DEBUG_CALL(kmap);
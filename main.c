@@ -31,6 +31,7 @@ static u32 BiscuitOS_normal_size;
 static u32 BiscuitOS_pkmap_size;
 static u32 BiscuitOS_pkmap_last;
 static u32 BiscuitOS_fixmap_size;
+static u32 BiscuitOS_cma_size;
 u32 BiscuitOS_fixmap_top;
 
 EXPORT_SYMBOL_GPL(BiscuitOS_ram_base);
@@ -176,6 +177,13 @@ static int BiscuitOS_memory_probe(struct platform_device *pdev)
 		strcat((char *)cmdline_dts, tmp_cmdline);
 	}
 
+	/* Obtain cma-size information, the CMA area is optional */
+	if (!of_property_read_u32(mem, "cma-size", &BiscuitOS_cma_size)) {
+		sprintf((char *)tmp_cmdline, " cma_bs=%#lx",
+				(unsigned long)BiscuitOS_cma_size);
+		strcat((char *)cmdline_dts, tmp_cmdline);
+	}
+
 	/* Obtain kernel image information */
 	ret = of_property_read_u32_array(mem, "kernel-image", array, 8);
 	if (ret) {
@@ -14,12 +14,16 @@
 #include "biscuitos/bootmem.h"
 #include "biscuitos/mmzone.h"
 #include "biscuitos/page-flags.h"
+#include "biscuitos/memblock.h"
 #include "asm-generated/types.h"
 #include "internal.h"
 
 /*
  * Access to this subsystem has to be serialized externally. (this is
  * true for the boot process anyway)
+ *
+ * The allocator underneath is memblock: free_bootmem() registers and
+ * frees ranges, reserve_bootmem() and alloc_bootmem() reserve them.
  */
 unsigned long max_low_pfn_bs;
 unsigned long min_low_pfn_bs;
@@ -29,16 +33,17 @@ EXPORT_SYMBOL_GPL(max_pfn_bs);		/* This is exported so
 					 * dma_get_required_mask(), which uses
 					 * it, can be an inline function */
 
-/* return the number of _pages_ that will be allocated for the boot bitmap */
+#define BOOTMEM_PFN_UP_BS(x)	(((x) + PAGE_SIZE_BS - 1) >> PAGE_SHIFT_BS)
+#define BOOTMEM_PFN_DOWN_BS(x)	((x) >> PAGE_SHIFT_BS)
+
+/*
+ * return the number of _pages_ that will be allocated for the boot
+ * bitmap.  There is no bitmap any more, memblock keeps its regions in
+ * static arrays.
+ */
 unsigned long __init bootmem_bootmap_pages_bs(unsigned long pages)
 {
-	unsigned long mapsize;
-
-	mapsize = (pages+7)/8;
-	mapsize = (mapsize + ~PAGE_MASK_BS) & PAGE_MASK_BS;
-	mapsize >>= PAGE_SHIFT_BS;
-
-	return mapsize;
+	return 0;
 }
 
 /*
@@ -48,55 +53,41 @@ static unsigned long __init init_bootmem_core_bs(pg_data_t_bs *pgdat,
 	unsigned long mapstart, unsigned long start, unsigned long end)
 {
 	bootmem_data_t_bs *bdata = pgdat->bdata;
-	unsigned long mapsize = ((end - start)+7)/8;
 
 	pgdat->pgdat_next = pgdat_list_bs;
 	pgdat_list_bs = pgdat;
 
-	mapsize = (mapsize + (sizeof(long) - 1UL)) & ~(sizeof(long) - 1UL);
-	bdata->node_bootmem_map = phys_to_virt_bs(mapstart << PAGE_SHIFT_BS);
 	bdata->node_boot_start = (start << PAGE_SHIFT_BS);
 	bdata->node_low_pfn = end;
 
 	/*
 	 * Initially all pages are reserved - setup_arch() has to
-	 * register free RAM area explicitly.
+	 * register free RAM area explicitly.  memblock starts out
+	 * empty, which amounts to the same.
 	 */
-	memset(bdata->node_bootmem_map, 0xff, mapsize);
+	return 0;
+}
 
-	return mapsize;
+static unsigned long bootmem_node_end_bs(bootmem_data_t_bs *bdata)
+{
+	if (bdata->node_low_pfn >= (~0UL >> PAGE_SHIFT_BS))
+		return ~0UL;
+	return bdata->node_low_pfn << PAGE_SHIFT_BS;
 }
 
+/*
+ * The first free of a range registers it as memory, later ones hand
+ * back what was reserved or allocated.  Partially free pages stay
+ * reserved, free_all_bootmem() only releases whole pages.
+ */
 static void __init free_bootmem_core_bs(bootmem_data_t_bs *bdata,
 				unsigned long addr, unsigned long size)
 {
-	unsigned long i;
-	unsigned long start;
-	/*
-	 * round down end of usable mem, partially free pages are
-	 * considered reserved.
-	 */
-	unsigned long sidx;
-	unsigned long eidx = (addr + size - 
-				bdata->node_boot_start)/PAGE_SIZE_BS;
-	unsigned long end = (addr + size)/PAGE_SIZE_BS;
-
 	BUG_ON_BS(!size);
-	BUG_ON_BS(end > bdata->node_low_pfn);
-
-	if (addr < bdata->last_success)
-		bdata->last_success = addr;
+	BUG_ON_BS(BOOTMEM_PFN_DOWN_BS(addr + size) > bdata->node_low_pfn);
 
-	/*
-	 * Round up the beginning of the address.
-	 */
-	start = (addr + PAGE_SIZE_BS-1) / PAGE_SIZE_BS;
-	sidx = start - (bdata->node_boot_start/PAGE_SIZE_BS);
-
-	for (i = sidx; i < eidx; i++) {
-		if (unlikely(!test_and_clear_bit(i, bdata->node_bootmem_map)))
-			BUG_BS();
-	}
+	memblock_add_bs(addr, size);
+	memblock_free_bs(addr, size);
 }
 
 /*
@@ -107,46 +98,30 @@ static void __init free_bootmem_core_bs(bootmem_data_t_bs *bdata,
 static void __init reserve_bootmem_core_bs(bootmem_data_t_bs *bdata, 
 				unsigned long addr, unsigned long size)
 {
-	unsigned long i;
-	/*
-	 * round up, partially reserved pages are considered
-	 * fully reserved.
-	 */
-	unsigned long sidx = (addr - bdata->node_boot_start)/PAGE_SIZE_BS;
-	unsigned long eidx = (addr + size - bdata->node_boot_start +
-					PAGE_SIZE_BS-1)/PAGE_SIZE_BS;
-	unsigned long end = (addr + size + PAGE_SIZE_BS-1)/PAGE_SIZE_BS;
-
-	BUG_ON_BS(!size);
-	BUG_ON_BS(sidx >= eidx);
+	if (!size)
+		return;
 	BUG_ON_BS((addr >> PAGE_SHIFT_BS) >= bdata->node_low_pfn);
-	BUG_ON_BS(end > bdata->node_low_pfn);
+	BUG_ON_BS(BOOTMEM_PFN_UP_BS(addr + size) > bdata->node_low_pfn);
 
-	for (i = sidx; i < eidx; i++)
-		if (test_and_set_bit(i, bdata->node_bootmem_map)) {
-			printk("hm, page %#lx reserved twice.\n", 
-					i*PAGE_SIZE_BS);
-		}
+	if (memblock_is_reserved_bs(addr))
+		printk("hm, page %#lx reserved twice.\n", addr & PAGE_MASK_BS);
+	memblock_reserve_bs(addr, size);
 }
 
 /*
- * We 'merge' subsequest allocation to save space. We might 'lose'
- * some fraction of a page if allocations cannot be satisfied due to
- * size constraints on boxes where is physical RAM space fragmentation -
- * in these cases (mostly large memory boxes) this is not a problem.
- *
- * On low memory boxes we get it right in 100% of the cases.
+ * Allocate above goal first, then anywhere in the node.  Requests of a
+ * page or more start on a page boundary.  The result is a virtual
+ * address, so we stay below high_memory.
  *
  * alignment has to be a power of 2 value.
- *
- * NOTE: This function is _not_ reentrant.
  */
 static void * __init
 __alloc_bootmem_core_bs(struct bootmem_data_bs *bdata, unsigned long size,
 			unsigned long align, unsigned long goal)
 {
-	unsigned long offset, remaining_size, areasize, preferred;
-	unsigned long i, start = 0, incr, eidx;
+	unsigned long start = bdata->node_boot_start;
+	unsigned long end = bootmem_node_end_bs(bdata);
+	unsigned long addr = 0;
 	void *ret;
 
 	if (!size) {
@@ -155,99 +130,19 @@ __alloc_bootmem_core_bs(struct bootmem_data_bs *bdata, unsigned long size,
 	}
 	BUG_ON_BS(align & (align-1));
 
-	eidx = bdata->node_low_pfn - (bdata->node_boot_start >> PAGE_SHIFT_BS);
-	offset = 0;
-	if (align &&
-		(bdata->node_boot_start & (align - 1UL)) != 0)
-		offset = (align - (bdata->node_boot_start & (align - 1UL)));
-	offset >>= PAGE_SHIFT_BS;
+	if (size >= PAGE_SIZE_BS && align < PAGE_SIZE_BS)
+		align = PAGE_SIZE_BS;
+	if (high_memory_bs)
+		end = min(end, (unsigned long)__pa_bs(high_memory_bs));
 
-	/*
-	 * We try to allocate bootmem pages above 'goal'
-	 * first, then we try to allocate lower pages.
-	 */
-	if (goal && (goal >= bdata->node_boot_start) &&
-		((goal >> PAGE_SHIFT_BS) < bdata->node_low_pfn)) {
-		preferred = goal - bdata->node_boot_start;
-
-		if (bdata->last_success >= preferred)
-			preferred = bdata->last_success;
-	} else
-		preferred = 0;
-
-	preferred = ((preferred + align - 1) & ~(align - 1)) >> PAGE_SHIFT_BS;
-	preferred += offset;
-	areasize = (size+PAGE_SIZE_BS-1)/PAGE_SIZE_BS;
-	incr = align >> PAGE_SHIFT_BS ? : 1;
-
-restart_scan:
-	for (i = preferred; i < eidx; i += incr) {
-		unsigned long j;
-
-		i = find_next_zero_bit(bdata->node_bootmem_map, eidx, i);
-		i = ALIGN(i, incr);
-		if (test_bit(i, bdata->node_bootmem_map))
-			continue;
-		for (j = i + 1; j < i + areasize; ++j) {
-			if (j >= eidx)
-				goto fail_block;
-			if (test_bit(j, bdata->node_bootmem_map))
-				goto fail_block;
-		}
-		start = i;
-		goto found;
-	fail_block:
-		i = ALIGN(j, incr);
-	}
+	if (goal > start && goal < end)
+		addr = memblock_alloc_range_bs(size, align, goal, end);
+	if (!addr)
+		addr = memblock_alloc_range_bs(size, align, start, end);
+	if (!addr)
+		return NULL;
 
-	if (preferred > offset) {
-		preferred = offset;
-		goto restart_scan;
-	}
-	return NULL;
-
-found:
-	bdata->last_success = start << PAGE_SHIFT_BS;
-	BUG_ON_BS(start >= eidx);
-
-	/*
-	 * Is the next page of the previous allocation-end the start
-	 * of this allocation's buffer? If yes then we can 'merge'
-	 * the previous partial page with this allocation.
-	 */
-	if (align < PAGE_SIZE_BS &&
-		bdata->last_offset && bdata->last_pos+1 == start) {
-		offset = (bdata->last_offset+align-1) & ~(align-1);
-		BUG_ON_BS(offset > PAGE_SIZE_BS);
-		remaining_size = PAGE_SIZE_BS - offset;
-		if (size < remaining_size) {
-			areasize = 0;
-			/* last_pos unchanged */
-			bdata->last_offset = offset+size;
-			ret = phys_to_virt_bs(bdata->last_pos*PAGE_SIZE_BS +
-					offset + bdata->node_boot_start);
-		} else {
-			remaining_size = size - remaining_size;
-			areasize = (remaining_size+PAGE_SIZE_BS-1)/PAGE_SIZE_BS;
-			ret = phys_to_virt_bs(bdata->last_pos*PAGE_SIZE_BS +
-					offset + bdata->node_boot_start);
-			bdata->last_pos = start+areasize-1;
-			bdata->last_offset = remaining_size;
-		}
-		bdata->last_offset &= ~PAGE_MASK_BS;
-	} else {
-		bdata->last_pos = start + areasize - 1;
-		bdata->last_offset = size & ~PAGE_MASK_BS;
-		ret = phys_to_virt_bs(start * PAGE_SIZE_BS + 
-					bdata->node_boot_start);
-	}
-
-	/*
-	 * Reserve the area now:
-	 */
-	for (i = start; i < start+areasize; i++)
-		if (unlikely(test_and_set_bit(i, bdata->node_bootmem_map)))
-			BUG_BS();
+	ret = phys_to_virt_bs(addr);
 	memset(ret, 0, size);
 	return ret;
 }
@@ -257,80 +152,74 @@ void __init free_bootmem_bs(unsigned long addr, unsigned long size)
 	free_bootmem_core_bs(NODE_DATA_BS(0)->bdata, addr, size);
 }
 
-static unsigned long __init free_all_bootmem_core_bs(pg_data_t_bs *pgdat)
+/*
+ * Hand the pages bootmem left free in [start_pfn, end_pfn) to the buddy
+ * allocator.  Each free range goes in as the largest naturally aligned
+ * blocks it holds, so a free page no longer has to merge its way up
+ * from order 0.  Zones are MAX_ORDER aligned, no block straddles two.
+ */
+unsigned long free_bootmem_range_bs(pg_data_t_bs *pgdat,
+			unsigned long start_pfn, unsigned long end_pfn)
 {
-	struct page_bs *page;
-	bootmem_data_t_bs *bdata = pgdat->bdata;
-	unsigned long i, count, total = 0;
-	unsigned long idx;
-	unsigned long *map;
-	int gofast = 0;
-
-	BUG_ON_BS(!bdata->node_bootmem_map);
-
-	count = 0;
-	/* first extant page of the node */
-	page = virt_to_page_bs(phys_to_virt_bs(bdata->node_boot_start));
-	idx = bdata->node_low_pfn - (bdata->node_boot_start >> PAGE_SHIFT_BS);
-	map = bdata->node_bootmem_map;
-	/* Check physaddr is O(LOG2(BITS_PER_LONG)) page aligned */
-	if (bdata->node_boot_start == 0 ||
-	    ffs(bdata->node_boot_start) - PAGE_SHIFT > ffs(BITS_PER_LONG_BS))
-		gofast = 1;
-	for (i = 0; i < idx; ) {
-		unsigned long v = ~map[i / BITS_PER_LONG_BS];
-
-		if (gofast && v == ~0UL) {
-			int j, order;
-
-			count += BITS_PER_LONG_BS;
-			__ClearPageReserved_bs(page);
-			order = ffs(BITS_PER_LONG_BS) - 1;
-			set_page_refs_bs(page, order);
-			for (j = 1; j < BITS_PER_LONG_BS; j++) {
-				if (j + 16 < BITS_PER_LONG_BS)
-					prefetchw(page + j + 16);
-				__ClearPageReserved_bs(page + j);
-			}
-			__free_pages_bs(page, order);
-			i += BITS_PER_LONG_BS;
-			page += BITS_PER_LONG_BS;
-		} else if (v) {
-			unsigned long m;
-
-			for (m = 1; m && i < idx; m <<= 1, page++, i++) {
-				if (v & m) {
-					count++;
-					__ClearPageReserved_bs(page);
-					set_page_refs_bs(page, 0);
-					__free_page_bs(page);
-				}
-			}
-		} else {
-			i+= BITS_PER_LONG_BS;
-			page += BITS_PER_LONG_BS;
+	unsigned long start, end, total = 0;
+	u64 i;
+
+	for_each_free_mem_range_bs(i, &start, &end) {
+		unsigned long pfn = max(BOOTMEM_PFN_UP_BS(start), start_pfn);
+		unsigned long epfn = min(BOOTMEM_PFN_DOWN_BS(end), end_pfn);
+
+		if (pfn >= epfn)
+			continue;
+		total += epfn - pfn;
+
+		while (pfn < epfn) {
+			int order = MAX_ORDER_BS - 1;
+
+			if (pfn)
+				order = min_t(int, order, __ffs(pfn));
+			while ((1UL << order) > epfn - pfn)
+				order--;
+			__free_pages_bootmem_bs(pfn_to_page_bs(pfn), order);
+			pfn += 1UL << order;
 		}
 	}
-	total += count;
+	return total;
+}
+
+static unsigned long __init free_all_bootmem_core_bs(pg_data_t_bs *pgdat)
+{
+	bootmem_data_t_bs *bdata = pgdat->bdata;
+	unsigned long start_pfn, end_pfn, limit, pfn;
+	unsigned long start, end;
+	u64 i;
+
+	start_pfn = bdata->node_boot_start >> PAGE_SHIFT_BS;
+	end_pfn = bdata->node_low_pfn;
+	limit = min(end_pfn, pgdat_first_deferred_pfn_bs(pgdat));
+
+	if (limit == end_pfn)
+		return free_bootmem_range_bs(pgdat, start_pfn, end_pfn);
 
 	/*
-	 * Now free the allocator bitmap itself, it's not
-	 * needed anymore.
+	 * Free pages above first_deferred_pfn wait for
+	 * deferred_init_memmap(), everything else up there needs its
+	 * struct page now.
 	 */
-	page = virt_to_page_bs(bdata->node_bootmem_map);
-	count = 0;
-	for (i = 0; i < ((bdata->node_low_pfn - (bdata->node_boot_start >>
-			PAGE_SHIFT_BS))/8 + PAGE_SIZE_BS-1)/PAGE_SIZE_BS;
-						i++,page++) {
-		count++;
-		__ClearPageReserved_bs(page);
-		set_page_count_bs(page, 1);
-		__free_page_bs(page);
+	pfn = limit;
+	for_each_free_mem_range_bs(i, &start, &end) {
+		unsigned long fpfn = BOOTMEM_PFN_UP_BS(start);
+		unsigned long epfn = BOOTMEM_PFN_DOWN_BS(end);
+
+		if (fpfn >= epfn || epfn <= pfn)
+			continue;
+		for (; pfn < min(fpfn, end_pfn); pfn++)
+			init_reserved_page_bs(pfn);
+		pfn = max(pfn, epfn);
 	}
-	total += count;
-	bdata->node_bootmem_map = NULL;
+	for (; pfn < end_pfn; pfn++)
+		init_reserved_page_bs(pfn);
 
-	return total;
+	return free_bootmem_range_bs(pgdat, start_pfn, limit);
 }
 
 unsigned long __init
@@ -0,0 +1,212 @@
+/*
+ * linux/mm/cma.c
+ *
+ * Contiguous Memory Allocator.
+ *
+ * Each area is taken out of bootmem, pageblock aligned, and later handed
+ * to the buddy allocator as MIGRATE_CMA pageblocks.  Only movable
+ * allocations are served from them, so whenever a driver needs a range
+ * of the area, whatever sits there can be migrated elsewhere.  A bitmap
+ * per area tracks the pages drivers hold.
+ */
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/bitmap.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/init.h"
+#include "biscuitos/mmzone.h"
+#include "biscuitos/mm.h"
+#include "biscuitos/bootmem.h"
+#include "biscuitos/gfp.h"
+#include "biscuitos/cma.h"
+#include "asm-generated/setup.h"
+#include "internal.h"
+
+struct cma_bs cma_areas_bs[MAX_CMA_AREAS_BS];
+unsigned int cma_area_count_bs;
+
+/* Areas asked for on the command line, reserved by cma_reserve() */
+static struct {
+	unsigned long size;
+	unsigned long base;
+} cma_early_bs[MAX_CMA_AREAS_BS] __initdata;
+static unsigned int cma_early_count_bs __initdata;
+
+/*
+ * Pick out a CMA area.  We look for cma_bs=size[@base], where size and
+ * base are "size[KkMm]".  Without a base the area is placed anywhere
+ * above the DMA zone.
+ */
+static void __init early_cma_bs(char **p)
+{
+	if (cma_early_count_bs == MAX_CMA_AREAS_BS) {
+		printk(KERN_WARNING "cma: too many areas, ignoring %s\n", *p);
+		return;
+	}
+	cma_early_bs[cma_early_count_bs].base = 0;
+	cma_early_bs[cma_early_count_bs].size = memparse(*p, p);
+	if (**p == '@')
+		cma_early_bs[cma_early_count_bs].base = memparse(*p + 1, p);
+	cma_early_count_bs++;
+}
+__early_param_bs("cma_bs=", early_cma_bs);
+
+/*
+ * Set aside the areas asked for on the command line, while bootmem
+ * still owns all of memory.
+ */
+void __init cma_reserve_bs(void)
+{
+	unsigned long align = pageblock_nr_pages_bs << PAGE_SHIFT_BS;
+	unsigned int i;
+
+	for (i = 0; i < cma_early_count_bs; i++) {
+		unsigned long size = ALIGN(cma_early_bs[i].size, align);
+		unsigned long base = cma_early_bs[i].base;
+		struct cma_bs *cma = &cma_areas_bs[cma_area_count_bs];
+
+		if (!size)
+			continue;
+		if (base) {
+			if (base & (align - 1)) {
+				printk(KERN_ERR "cma: base %#lx is not aligned "
+						"to %#lx\n", base, align);
+				continue;
+			}
+			reserve_bootmem_bs(base, size);
+		} else {
+			base = __pa_bs(__alloc_bootmem_bs(size, align,
+					__pa_bs(MAX_DMA_ADDRESS_BS)));
+		}
+
+		cma->base_pfn = base >> PAGE_SHIFT_BS;
+		cma->count = size >> PAGE_SHIFT_BS;
+		cma->bitmap = alloc_bootmem_bs(BITS_TO_LONGS(cma->count) *
+							sizeof(long));
+		mutex_init(&cma->lock);
+		cma_area_count_bs++;
+		printk(KERN_INFO "cma: reserved %lu MiB at %#lx\n",
+						size >> 20, base);
+	}
+}
+
+/*
+ * Lend the reserved areas to the buddy allocator.  Called once bootmem
+ * has released the rest of memory; returns the number of pages lent.
+ */
+unsigned long __init cma_init_reserved_areas_bs(void)
+{
+	unsigned long total = 0;
+	unsigned int i;
+
+	for (i = 0; i < cma_area_count_bs; i++) {
+		struct cma_bs *cma = &cma_areas_bs[i];
+		unsigned long pfn = cma->base_pfn;
+		unsigned long end_pfn = pfn + cma->count;
+		struct zone_bs *zone = page_zone_bs(pfn_to_page_bs(pfn));
+
+		/* Contiguous ranges are taken under a single zone->lock */
+		if (page_zone_bs(pfn_to_page_bs(end_pfn - 1)) != zone) {
+			printk(KERN_ERR "cma: area at pfn %#lx spans zones, "
+					"leaving it reserved\n", pfn);
+			cma->count = 0;
+			continue;
+		}
+
+		for (; pfn < end_pfn; pfn += pageblock_nr_pages_bs) {
+			struct page_bs *page = pfn_to_page_bs(pfn);
+			unsigned long j;
+
+			for (j = 0; j < pageblock_nr_pages_bs; j++)
+				__ClearPageReserved_bs(page + j);
+			set_pageblock_migratetype_bs(page, MIGRATE_CMA_BS);
+			set_page_refs_bs(page, pageblock_order_bs);
+			__free_pages_bs(page, pageblock_order_bs);
+		}
+		total += cma->count;
+	}
+	return total;
+}
+
+static void cma_clear_bitmap_bs(struct cma_bs *cma, unsigned long pfn,
+						unsigned long count)
+{
+	mutex_lock(&cma->lock);
+	bitmap_clear(cma->bitmap, pfn - cma->base_pfn, count);
+	mutex_unlock(&cma->lock);
+}
+
+/**
+ * cma_alloc - allocate pages from a contiguous area
+ * @cma: the area to allocate from
+ * @count: number of pages to allocate
+ * @align: order the range is to be aligned to
+ *
+ * Pick a range of the area nobody holds and migrate the movable pages
+ * borrowing it elsewhere.  Ranges that cannot be emptied are skipped.
+ * Returns the first page of the range, each page holding a reference,
+ * or NULL.  Sleeps.
+ */
+struct page_bs *cma_alloc_bs(struct cma_bs *cma, unsigned long count,
+						unsigned int align)
+{
+	unsigned long mask, offset, start = 0;
+	int ret;
+
+	if (!cma || !cma->count || !count)
+		return NULL;
+
+	might_sleep();
+	mask = (1UL << min_t(unsigned int, align, pageblock_order_bs)) - 1;
+	for (;;) {
+		mutex_lock(&cma->lock);
+		offset = bitmap_find_next_zero_area(cma->bitmap, cma->count,
+							start, count, mask);
+		if (offset >= cma->count) {
+			mutex_unlock(&cma->lock);
+			return NULL;
+		}
+		bitmap_set(cma->bitmap, offset, count);
+		mutex_unlock(&cma->lock);
+
+		ret = alloc_contig_range_bs(cma->base_pfn + offset,
+					cma->base_pfn + offset + count);
+		if (!ret)
+			return pfn_to_page_bs(cma->base_pfn + offset);
+
+		cma_clear_bitmap_bs(cma, cma->base_pfn + offset, count);
+		if (ret != -EBUSY)
+			return NULL;
+		/* Something in there is pinned, try the next range */
+		start = offset + mask + 1;
+	}
+}
+EXPORT_SYMBOL_GPL(cma_alloc_bs);
+
+/**
+ * cma_release - give back pages taken with cma_alloc()
+ * @cma: the area the pages came from
+ * @pages: first page of the range
+ * @count: number of pages in the range
+ *
+ * Returns 0 if the pages do not belong to @cma, 1 otherwise.
+ */
+int cma_release_bs(struct cma_bs *cma, struct page_bs *pages,
+						unsigned long count)
+{
+	unsigned long pfn, i;
+
+	if (!cma || !pages)
+		return 0;
+
+	pfn = page_to_pfn_bs(pages);
+	if (pfn < cma->base_pfn || pfn + count > cma->base_pfn + cma->count)
+		return 0;
+
+	for (i = 0; i < count; i++)
+		__free_page_bs(pages + i);
+	cma_clear_bitmap_bs(cma, pfn, count);
+	return 1;
+}
+EXPORT_SYMBOL_GPL(cma_release_bs);
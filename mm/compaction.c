@@ -0,0 +1,588 @@
+/*
+ * linux/mm/compaction.c
+ *
+ * Memory compaction for the reduction of external fragmentation.
+ *
+ * A migrate scanner walks the zone up from its first pfn isolating
+ * movable LRU pages, a free scanner walks down from its last pfn
+ * isolating free pages, and each isolated page is migrated into a free
+ * one.  Used pages gather at the bottom of the zone, free pages at the
+ * top, where the buddy allocator merges them back into large blocks.
+ * Compaction stops as soon as the order asked for is available, or when
+ * the two scanners meet.
+ */
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/mmzone.h"
+#include "biscuitos/mm.h"
+#include "biscuitos/mm_inline.h"
+#include "biscuitos/swap.h"
+#include "biscuitos/pagevec.h"
+#include "biscuitos/page-flags.h"
+#include "biscuitos/highmem.h"
+#include "biscuitos/gfp.h"
+#include "biscuitos/cpuset.h"
+#include "biscuitos/rmap.h"
+#include "biscuitos/compaction.h"
+#include "internal.h"
+
+#define COMPACT_CLUSTER_MAX_BS	SWAP_CLUSTER_MAX_BS
+#define COMPACT_MAX_DEFER_SHIFT_BS	6
+
+/*
+ * compact_control is used to track pages being migrated and the free pages
+ * they are being migrated to during memory compaction.  The free_pfn starts
+ * at the end of a zone and migrate_pfn begins at the start.  Movable pages
+ * are moved to the end of a zone during a compaction run and the run
+ * completes when free_pfn <= migrate_pfn
+ */
+struct compact_control_bs {
+	struct list_head freepages;	/* List of free pages to migrate to */
+	struct list_head migratepages;	/* List of pages being migrated */
+	unsigned long nr_freepages;	/* Number of isolated free pages */
+	unsigned long nr_migratepages;	/* Number of pages to migrate */
+	unsigned long free_pfn;		/* isolate_freepages search base */
+	unsigned long migrate_pfn;	/* isolate_migratepages search base */
+	int order;			/* order a direct compactor needs */
+	struct zone_bs *zone;
+};
+
+/*
+ * Only mapped anonymous pages referenced by nothing but their ptes and
+ * our isolation are moved: page_migrate_anon() moves the pte references
+ * and we drop our own.  A page without a mapping is held by whoever
+ * allocated it, who would be left pointing at the old copy, and a file
+ * mapping we could not update.
+ */
+static inline int page_migratable_bs(struct page_bs *page)
+{
+	return PageAnon_bs(page) && page_mapped_bs(page) &&
+		!PageWriteback_bs(page) &&
+		page_count_bs(page) == 1 + page_mapcount_bs(page);
+}
+
+/*
+ * Isolate up to COMPACT_CLUSTER_MAX LRU pages between migrate_pfn and
+ * free_pfn.  Each holds a reference taken here.
+ */
+static void isolate_migratepages_bs(struct compact_control_bs *cc)
+{
+	unsigned long pfn;
+
+	for (pfn = cc->migrate_pfn; pfn < cc->free_pfn &&
+			cc->nr_migratepages < COMPACT_CLUSTER_MAX_BS; pfn++) {
+		struct lru_sublist_bs *lru;
+		struct page_bs *page;
+		int mt;
+
+		if (!pfn_valid_bs(pfn))
+			continue;
+		page = pfn_to_page_bs(pfn);
+		/*
+		 * Pages in other blocks are pinned by their neighbours.
+		 * Isolated blocks are being emptied for a contiguous range.
+		 */
+		mt = get_pageblock_migratetype_bs(page);
+		if (!is_migrate_movable_bs(mt) && mt != MIGRATE_ISOLATE_BS) {
+			pfn |= pageblock_nr_pages_bs - 1;
+			continue;
+		}
+		if (!PageLRU_bs(page) || PageLocked_bs(page))
+			continue;
+		/* Nothing else could be migrated */
+		if (!PageAnon_bs(page) || !page_mapped_bs(page))
+			continue;
+
+		lru = page_lru_sublist_bs(page);
+		spin_lock_irq(&lru->lock);
+		if (!PageLRU_bs(page)) {
+			spin_unlock_irq(&lru->lock);
+			continue;
+		}
+		if (get_page_testone_bs(page)) {
+			/*
+			 * It is being freed elsewhere
+			 */
+			__put_page_bs(page);
+			spin_unlock_irq(&lru->lock);
+			continue;
+		}
+		if (!TestClearPageLRU_bs(page))
+			BUG_BS();
+		del_page_from_lru_bs(lru, page);
+		spin_unlock_irq(&lru->lock);
+
+		list_add(&page->lru, &cc->migratepages);
+		cc->nr_migratepages++;
+	}
+	cc->migrate_pfn = pfn;
+}
+
+/*
+ * Isolate free pages walking down from free_pfn until there is one for
+ * every page waiting to be migrated.  zone->lock is dropped every
+ * cluster so that allocators are not held off for the whole walk.
+ */
+static void isolate_freepages_bs(struct compact_control_bs *cc)
+{
+	struct zone_bs *zone = cc->zone;
+	unsigned long pfn = cc->free_pfn;
+	unsigned long flags;
+
+	while (pfn > cc->migrate_pfn && cc->nr_freepages < cc->nr_migratepages) {
+		unsigned long end = pfn > COMPACT_CLUSTER_MAX_BS ?
+					pfn - COMPACT_CLUSTER_MAX_BS : 0;
+
+		if (end < cc->migrate_pfn)
+			end = cc->migrate_pfn;
+
+		spin_lock_irqsave(&zone->lock, flags);
+		while (pfn > end && cc->nr_freepages < cc->nr_migratepages) {
+			struct page_bs *page;
+			unsigned long nr, i;
+
+			pfn--;
+			if (!pfn_valid_bs(pfn))
+				continue;
+			page = pfn_to_page_bs(pfn);
+			/* Only fill blocks that will stay movable */
+			if (!is_migrate_movable_bs(
+					get_pageblock_migratetype_bs(page))) {
+				pfn &= ~(pageblock_nr_pages_bs - 1);
+				continue;
+			}
+			nr = isolate_free_block_bs(zone, page, cc->order);
+			for (i = 0; i < nr; i++)
+				list_add(&page[i].lru, &cc->freepages);
+			cc->nr_freepages += nr;
+		}
+		spin_unlock_irqrestore(&zone->lock, flags);
+	}
+	cc->free_pfn = pfn;
+}
+
+static void release_freepages_bs(struct compact_control_bs *cc)
+{
+	struct page_bs *page, *next;
+
+	list_for_each_entry_safe(page, next, &cc->freepages, lru) {
+		list_del(&page->lru);
+		__free_pages_bs(page, 0);
+	}
+	cc->nr_freepages = 0;
+}
+
+/*
+ * Return the isolated pages that could not be migrated to the LRU, and
+ * drop the references isolation took on them.
+ */
+static void putback_migratepages_bs(struct compact_control_bs *cc)
+{
+	struct pagevec_bs pvec;
+	struct page_bs *page, *next;
+
+	pagevec_init_bs(&pvec, 1);
+	list_for_each_entry_safe(page, next, &cc->migratepages, lru) {
+		struct lru_sublist_bs *lru = page_lru_sublist_bs(page);
+
+		list_del(&page->lru);
+		spin_lock_irq(&lru->lock);
+		if (TestSetPageLRU_bs(page))
+			BUG_BS();
+		if (PageActive_bs(page))
+			add_page_to_active_list_bs(lru, page);
+		else
+			add_page_to_inactive_list_bs(lru, page);
+		spin_unlock_irq(&lru->lock);
+		if (!pagevec_add_bs(&pvec, page))
+			__pagevec_release_bs(&pvec);
+	}
+	pagevec_release_bs(&pvec);
+	cc->nr_migratepages = 0;
+}
+
+/*
+ * Move the contents, state and mappings of @page over to @newpage and
+ * put @newpage on the LRU in its place.  On success the pte references
+ * have moved to @newpage and only the isolation reference on @page is
+ * left.  Returns -EAGAIN if the page is busy.
+ */
+static int migrate_page_bs(struct page_bs *newpage, struct page_bs *page)
+{
+	if (TestSetPageLocked_bs(page))
+		return -EAGAIN;
+
+	if (!page_migratable_bs(page))
+		goto busy;
+
+	if (page_migrate_anon_bs(page, newpage))
+		goto busy;
+
+	if (PageDirty_bs(page))
+		SetPageDirty_bs(newpage);
+	if (PageUptodate_bs(page))
+		SetPageUptodate_bs(newpage);
+	if (PageReferenced_bs(page))
+		SetPageReferenced_bs(newpage);
+	page->mapping = NULL;
+	ClearPageLocked_bs(page);
+
+	if (TestClearPageActive_bs(page))
+		lru_cache_add_active_bs(newpage);
+	else
+		lru_cache_add_bs(newpage);
+	/* The free page's own ref; its ptes keep it alive */
+	__put_page_bs(newpage);
+	return 0;
+
+busy:
+	ClearPageLocked_bs(page);
+	return -EAGAIN;
+}
+
+/*
+ * Migrate each isolated page into an isolated free page.  Migrated
+ * originals are freed, the rest stay on cc->migratepages.
+ */
+static void migrate_pages_bs(struct compact_control_bs *cc)
+{
+	struct pagevec_bs freed_pvec;
+	struct page_bs *page, *next;
+	LIST_HEAD(failed);
+
+	pagevec_init_bs(&freed_pvec, 1);
+	list_for_each_entry_safe(page, next, &cc->migratepages, lru) {
+		struct page_bs *newpage;
+
+		if (list_empty(&cc->freepages))
+			break;
+		newpage = list_entry(cc->freepages.next, struct page_bs, lru);
+		if (migrate_page_bs(newpage, page)) {
+			list_move(&page->lru, &failed);
+			continue;
+		}
+		list_del(&newpage->lru);
+		cc->nr_freepages--;
+		list_del(&page->lru);
+		cc->nr_migratepages--;
+		cc->zone->compact_migrated++;
+		if (!pagevec_add_bs(&freed_pvec, page))
+			__pagevec_release_nonlru_bs(&freed_pvec);
+	}
+	if (pagevec_count_bs(&freed_pvec))
+		__pagevec_release_nonlru_bs(&freed_pvec);
+	list_splice(&failed, &cc->migratepages);
+}
+
+static int compact_finished_bs(struct compact_control_bs *cc)
+{
+	struct zone_bs *zone = cc->zone;
+
+	if (cc->free_pfn <= cc->migrate_pfn)
+		return COMPACT_COMPLETE_BS;
+
+	if (zone_watermark_ok_bs(zone, cc->order, zone->pages_min, 0, 0, 0))
+		return COMPACT_PARTIAL_BS;
+
+	return COMPACT_CONTINUE_BS;
+}
+
+static int compact_zone_bs(struct zone_bs *zone, int order)
+{
+	struct compact_control_bs cc = {
+		.order = order,
+		.zone = zone,
+	};
+	int ret;
+
+	if (zone->present_pages == 0)
+		return COMPACT_SKIPPED_BS;
+
+	/* The block is there already, nothing to do */
+	if (zone_watermark_ok_bs(zone, order, zone->pages_min, 0, 0, 0))
+		return COMPACT_PARTIAL_BS;
+
+	/*
+	 * Migration needs free pages to migrate into.  Below this point
+	 * reclaim is the better tool.
+	 */
+	if (!zone_watermark_ok_bs(zone, 0, zone->pages_low + (2UL << order),
+								0, 0, 0))
+		return COMPACT_SKIPPED_BS;
+
+	INIT_LIST_HEAD(&cc.freepages);
+	INIT_LIST_HEAD(&cc.migratepages);
+	cc.migrate_pfn = zone->zone_start_pfn;
+	cc.free_pfn = zone->zone_start_pfn + zone->spanned_pages;
+	zone->compact_stall++;
+
+	/* Pages still sitting in the per-CPU LRU batches cannot be isolated */
+	lru_add_drain_bs();
+
+	while ((ret = compact_finished_bs(&cc)) == COMPACT_CONTINUE_BS) {
+		isolate_migratepages_bs(&cc);
+		if (!cc.nr_migratepages)
+			continue;
+
+		isolate_freepages_bs(&cc);
+		migrate_pages_bs(&cc);
+		putback_migratepages_bs(&cc);
+		/* Migrated pages were freed to the per-CPU lists */
+		drain_local_pages_bs();
+		cond_resched();
+	}
+
+	release_freepages_bs(&cc);
+	if (ret == COMPACT_PARTIAL_BS)
+		zone->compact_success++;
+	return ret;
+}
+
+/*
+ * A direct compaction of the whole zone failed to free a block of this
+ * order.  Skip the zone for twice as many attempts as last time, up to
+ * 1 << COMPACT_MAX_DEFER_SHIFT, so that a string of failed allocations
+ * does not rescan it every time.
+ */
+static void defer_compaction_bs(struct zone_bs *zone, int order)
+{
+	zone->compact_considered = 0;
+	if (zone->compact_defer_shift < COMPACT_MAX_DEFER_SHIFT_BS)
+		zone->compact_defer_shift++;
+	if (order < zone->compact_order_failed)
+		zone->compact_order_failed = order;
+}
+
+/* Returns 1 if direct compaction of this order should skip the zone */
+static int compaction_deferred_bs(struct zone_bs *zone, int order)
+{
+	unsigned long defer_limit = 1UL << zone->compact_defer_shift;
+
+	if (order < zone->compact_order_failed)
+		return 0;
+	if (++zone->compact_considered >= defer_limit) {
+		zone->compact_considered = defer_limit;
+		return 0;
+	}
+	return 1;
+}
+
+/* Compaction produced a block of this order: stop backing off */
+static void compaction_defer_reset_bs(struct zone_bs *zone, int order)
+{
+	zone->compact_considered = 0;
+	zone->compact_defer_shift = 0;
+	if (order >= zone->compact_order_failed)
+		zone->compact_order_failed = order + 1;
+}
+
+/**
+ * try_to_compact_pages - Direct compact to satisfy a high-order allocation
+ * @zones: The zonelist used for the current allocation
+ * @order: The order of the current allocation
+ * @gfp_mask: The GFP mask of the current allocation
+ *
+ * This is the main entry point for direct page compaction.
+ */
+int try_to_compact_pages_bs(struct zone_bs **zones, int order,
+						unsigned int gfp_mask)
+{
+	int rc = COMPACT_SKIPPED_BS;
+	int i;
+
+	/* Migration may sleep; atomic callers get what is there */
+	if (!order || !(gfp_mask & __GFP_WAIT_BS))
+		return rc;
+
+	for (i = 0; zones[i] != NULL; i++) {
+		int status;
+
+		if (!cpuset_zone_allowed_bs(zones[i]))
+			continue;
+		if (compaction_deferred_bs(zones[i], order))
+			continue;
+
+		status = compact_zone_bs(zones[i], order);
+		rc = max(status, rc);
+		if (status == COMPACT_PARTIAL_BS) {
+			compaction_defer_reset_bs(zones[i], order);
+			break;
+		}
+		/* Scanned the whole zone and still no block */
+		if (status == COMPACT_COMPLETE_BS)
+			defer_compaction_bs(zones[i], order);
+	}
+	return rc;
+}
+
+/*
+ * Background compaction from kswapd, once reclaim has balanced the node
+ * for a high-order waker.
+ */
+void compact_pgdat_bs(struct pglist_data_bs *pgdat, int order)
+{
+	int i;
+
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		struct zone_bs *zone = pgdat->node_zones + i;
+
+		if (zone_watermark_ok_bs(zone, order, zone->pages_high,
+								0, 0, 0))
+			continue;
+		compact_zone_bs(zone, order);
+	}
+}
+
+/*
+ * Serialises contiguous range allocations, which may isolate the same
+ * pageblocks.
+ */
+static DEFINE_MUTEX(contig_mutex_bs);
+
+/*
+ * Allocate a target for each page waiting to be migrated.  They come
+ * from outside the range, whose pageblocks are isolated.
+ */
+static int alloc_migrate_targets_bs(struct compact_control_bs *cc)
+{
+	while (cc->nr_freepages < cc->nr_migratepages) {
+		struct page_bs *page;
+
+		page = alloc_page_bs(GFP_HIGHUSER_MOVABLE_BS |
+				__GFP_NORETRY_BS | __GFP_NOWARN_BS);
+		if (!page)
+			return -ENOMEM;
+		list_add(&page->lru, &cc->freepages);
+		cc->nr_freepages++;
+	}
+	return 0;
+}
+
+/*
+ * The first pfn of the free buddy block holding @pfn, which may lie
+ * below it, or @pfn itself if no free block holds it.  Called with
+ * zone->lock held.
+ */
+static unsigned long free_block_start_bs(unsigned long pfn)
+{
+	int order;
+
+	for (order = 0; order < MAX_ORDER_BS; order++) {
+		unsigned long head = pfn & ~((1UL << order) - 1);
+		struct page_bs *page = pfn_to_page_bs(head);
+
+		if (PagePrivate_bs(page) && !page_count_bs(page) &&
+				head + (1UL << page_order_bs(page)) > pfn)
+			return head;
+	}
+	return pfn;
+}
+
+/*
+ * Take every page of [*start, *end) out of the buddy lists.  Free blocks
+ * straddling either end are taken whole, and *start and *end are moved
+ * out to what was taken.  Fails with -EBUSY, leaving the range free, if
+ * any page in it is still in use.
+ */
+static int take_free_range_bs(struct zone_bs *zone,
+				unsigned long *start, unsigned long *end)
+{
+	unsigned long first, pfn, nr, flags;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	first = free_block_start_bs(*start);
+	for (pfn = first; pfn < *end; pfn += nr) {
+		nr = isolate_free_block_bs(zone, pfn_to_page_bs(pfn),
+							MAX_ORDER_BS);
+		if (!nr)
+			break;
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+	if (pfn >= *end) {
+		*start = first;
+		*end = pfn;
+		return 0;
+	}
+
+	while (pfn > first)
+		__free_page_bs(pfn_to_page_bs(--pfn));
+	drain_all_pages_bs();
+	return -EBUSY;
+}
+
+/**
+ * alloc_contig_range - take a range of CMA pages off the allocator
+ * @start: first pfn of the range
+ * @end: pfn one past the range
+ *
+ * Isolate the pageblocks spanning the range, migrate the pages of the
+ * range out, and take the free range.  The rest of those pageblocks is
+ * left alone, so ranges sharing a pageblock can be held at once.  On
+ * success each page of the range holds a reference and is freed with
+ * __free_page().  The range has to lie in one zone's CMA pageblocks.
+ * Sleeps.
+ */
+int alloc_contig_range_bs(unsigned long start, unsigned long end)
+{
+	struct zone_bs *zone = page_zone_bs(pfn_to_page_bs(start));
+	struct compact_control_bs cc = {
+		.order = -1,
+		.zone = zone,
+	};
+	unsigned long block_start, block_end, outer_start, outer_end;
+	int tries = 0, ret = 0;
+
+	block_start = start & ~(pageblock_nr_pages_bs - 1);
+	block_end = ALIGN(end, pageblock_nr_pages_bs);
+	INIT_LIST_HEAD(&cc.freepages);
+	INIT_LIST_HEAD(&cc.migratepages);
+	cc.migrate_pfn = start;
+	cc.free_pfn = end;
+
+	mutex_lock(&contig_mutex_bs);
+	start_isolate_page_range_bs(zone, block_start, block_end);
+	/* Pages of the range may still sit on the per-CPU lists */
+	drain_all_pages_bs();
+	lru_add_drain_all_bs();
+
+	while (cc.migrate_pfn < end || cc.nr_migratepages) {
+		if (!cc.nr_migratepages) {
+			isolate_migratepages_bs(&cc);
+			tries = 0;
+			if (!cc.nr_migratepages)
+				continue;
+		} else if (++tries == 5) {
+			ret = -EBUSY;
+			break;
+		}
+
+		ret = alloc_migrate_targets_bs(&cc);
+		if (ret)
+			break;
+		migrate_pages_bs(&cc);
+		cond_resched();
+	}
+	putback_migratepages_bs(&cc);
+	release_freepages_bs(&cc);
+
+	/* The migrated originals were freed to the per-CPU lists */
+	drain_all_pages_bs();
+	outer_start = start;
+	outer_end = end;
+	if (!ret)
+		ret = take_free_range_bs(zone, &outer_start, &outer_end);
+	undo_isolate_page_range_bs(zone, block_start, block_end,
+							MIGRATE_CMA_BS);
+	mutex_unlock(&contig_mutex_bs);
+	if (ret)
+		return ret;
+
+	/* Give back the parts of straddling free blocks outside the range */
+	for (; outer_start < start; outer_start++)
+		__free_page_bs(pfn_to_page_bs(outer_start));
+	for (; end < outer_end; end++)
+		__free_page_bs(pfn_to_page_bs(end));
+	return 0;
+}
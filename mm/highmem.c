@@ -26,48 +26,31 @@
 #include "biscuitos/mm.h"
 #include "biscuitos/mempool.h"
 #include "biscuitos/highmem.h"
+#include "biscuitos/percpu.h"
 #include "asm-generated/highmem.h"
+#include "asm-generated/percpu.h"
 #include "asm-generated/pgtable.h"
 #include "asm-generated/tlbflush.h"
 
 #define PA_HASH_ORDER_BS	7
 
 /*
- * Describes one page->virtual association
- */
-struct page_address_map_bs {
-	struct page_bs *page;
-	void *virtual;
-	struct list_head list;
-};
-
-/*
- * Hash table bucket
+ * The virtual address of a kmapped highmem page is cached in
+ * page->virtual, so page_address() is a plain load and needs no lock.
+ * Installing or tearing down the address still has to be atomic with
+ * the pkmap_count bookkeeping; writers serialise on a lock hashed from
+ * the page.
  */
 static struct page_address_slot_bs {
-	struct list_head lh;		/* List of page_address_maps */
-	spinlock_t lock;		/* Protect this bucket's list */
+	spinlock_t lock;		/* Protect page->virtual of this bucket */
 } ____cacheline_aligned_in_smp_bs page_address_htable_bs[1 << PA_HASH_ORDER_BS];
 
-/*
- * page_address_map freelist, allocated from page_address_maps.
- */
-static struct list_head page_address_pool_bs;	/* freelist */
-static spinlock_t pool_lock_bs;
-static struct page_address_map_bs page_address_maps_bs[LAST_PKMAP_BS];
-
 void __init page_address_init_bs(void)
 {
 	int i;
 
-	INIT_LIST_HEAD(&page_address_pool_bs);
-	for (i = 0; i < ARRAY_SIZE(page_address_maps_bs); i++)
-		list_add(&page_address_maps_bs[i].list, &page_address_pool_bs);
-	for (i = 0; i < ARRAY_SIZE(page_address_htable_bs); i++) {
-		INIT_LIST_HEAD(&page_address_htable_bs[i].lh);
+	for (i = 0; i < ARRAY_SIZE(page_address_htable_bs); i++)
 		spin_lock_init(&page_address_htable_bs[i].lock);
-	}
-	spin_lock_init(&pool_lock_bs);
 }
 
 static struct page_address_slot_bs *page_slot_bs(struct page_bs *page)
@@ -75,195 +58,314 @@ static struct page_address_slot_bs *page_slot_bs(struct page_bs *page)
 	return &page_address_htable_bs[hash_ptr(page, PA_HASH_ORDER_BS)];
 }
 
-void *page_address_bs(struct page_bs *page)
+#ifdef WANT_PAGE_VIRTUAL_BS
+/*
+ * Look up the virtual address of @page. Caller holds pas->lock.
+ */
+static void *__page_address_lookup_bs(struct page_address_slot_bs *pas,
+						struct page_bs *page)
 {
-	unsigned long flags;
-	void *ret;
-	struct page_address_slot_bs *pas;	
-
-	if (!PageHighMem_bs(page))
-		return lowmem_page_address_bs(page);
-
-	pas = page_slot_bs(page);
-	ret = NULL;
-	spin_lock_irqsave(&pas->lock, flags);
-	if (!list_empty(&pas->lh)) {
-		struct page_address_map_bs *pam;
-
-		list_for_each_entry(pam, &pas->lh, list) {
-			if (pam->page == page) {
-				ret = pam->virtual;
-				goto done;
-			}
-		}
-	}
+	return page->virtual;
+}
 
-done:
-	spin_unlock_irqrestore(&pas->lock, flags);
-	return ret;
+/*
+ * Set or clear the page->virtual association. Caller holds pas->lock.
+ * The pte must be visible before the address is published to the
+ * lockless readers in page_address().
+ */
+static void __set_page_address_bs(struct page_address_slot_bs *pas,
+				struct page_bs *page, void *virtual)
+{
+	smp_wmb();
+	WRITE_ONCE(page->virtual, virtual);
 }
-EXPORT_SYMBOL_GPL(page_address_bs);
 
 void set_page_address_bs(struct page_bs *page, void *virtual)
 {
 	unsigned long flags;
 	struct page_address_slot_bs *pas;
-	struct page_address_map_bs *pam;
 
 	BUG_ON_BS(!PageHighMem_bs(page));
 
 	pas = page_slot_bs(page);
-	if (virtual) {
-		BUG_ON_BS(list_empty(&page_address_pool_bs));
+	spin_lock_irqsave(&pas->lock, flags);
+	__set_page_address_bs(pas, page, virtual);
+	spin_unlock_irqrestore(&pas->lock, flags);
+}
+#endif
 
-		spin_lock_irqsave(&pool_lock_bs, flags);
-		pam = list_entry(page_address_pool_bs.next,
-				 struct page_address_map_bs, list);
-		list_del(&pam->list);
-		spin_unlock_irqrestore(&pool_lock_bs, flags);
+#ifdef CONFIG_HIGHMEM_BS
+/*
+ * pkmap_count[] states:
+ *  -1 - free, sitting in some CPU's pkmap slot reserve
+ *   0 - free, unmapped and flushed, owned by nobody
+ *   1 - still mapped but unused, needs a TLB flush before reuse
+ *  >1 - mapped and in use by (count - 1) users
+ */
+#define PKMAP_RESERVED_BS	(-1)
 
-		pam->page = page;
-		pam->virtual = virtual;
+/*
+ * Each CPU keeps up to PKMAP_CPU_SLOTS_BS free slots so that kmap_high()
+ * only needs kmap_lock when its reserve runs dry, and then pulls
+ * PKMAP_CPU_BATCH_BS slots at once.  The reserve lock is only contended
+ * when the global pool is empty and another CPU drains the reserves back
+ * into it rather than sleep.
+ */
+#define PKMAP_CPU_SLOTS_BS	16
+#define PKMAP_CPU_BATCH_BS	(PKMAP_CPU_SLOTS_BS / 2)
 
-		spin_lock_irqsave(&pas->lock, flags);
-		list_add_tail(&pam->list, &pas->lh);
-		spin_unlock_irqrestore(&pas->lock, flags);
-	} else {	/* Remove */
-		spin_lock_irqsave(&pas->lock, flags);
-		list_for_each_entry(pam, &pas->lh, list) {
-			if (pam->page == page) {
-				list_del(&pam->list);
-				spin_unlock_irqrestore(&pas->lock, flags);
-				spin_lock_irqsave(&pool_lock_bs, flags);
-				list_add_tail(&pam->list, 
-						&page_address_pool_bs);
-				spin_unlock_irqrestore(&pool_lock_bs, flags);
-				goto done;
-			}
-		}
-		spin_unlock_irqrestore(&pas->lock, flags);
-	}
-done:
-	return;
-}
+struct pkmap_cpu_cache_bs {
+	spinlock_t lock;
+	unsigned int nr;
+	unsigned int slots[PKMAP_CPU_SLOTS_BS];
+};
 
-#ifdef CONFIG_HIGHMEM_BS
-static int pkmap_count_bs[LAST_PKMAP_BS];
+static atomic_t pkmap_count_bs[LAST_PKMAP_BS];
 static unsigned int last_pkmap_nr_bs;
 static __cacheline_aligned_in_smp_bs DEFINE_SPINLOCK(kmap_lock_bs);
 static DECLARE_WAIT_QUEUE_HEAD(pkmap_map_wait_bs);
+static DEFINE_PER_CPU_BS(struct pkmap_cpu_cache_bs, pkmap_cpu_cache_bs) = {
+	.lock	= __SPIN_LOCK_UNLOCKED(pkmap_cpu_cache_bs.lock),
+};
 
 pte_t_bs *pkmap_page_table_bs;
 
-static void flush_all_zero_pkmaps_bs(void)
+/*
+ * Unmap every slot with a count of 1 and do a single TLB flush for the
+ * whole batch. Called with kmap_lock held, returns the number of slots
+ * that became free.
+ */
+static int flush_all_zero_pkmaps_bs(void)
 {
-	int i;
+	int i, nr_freed = 0;
 
 	flush_cache_kmaps_bs();
 
 	for (i = 0; i < LAST_PKMAP_BS; i++) {
+		struct page_address_slot_bs *pas;
 		struct page_bs *page;
+		unsigned long flags;
 
 		/*
-		 * zero means we don't have anything to do,
+		 * zero or -1 means we don't have anything to do,
 		 * >1 means that it is still in use. Only
 		 * a count of 1 means that it is free but
 		 * needs to be unmapped
 		 */
-		if (pkmap_count_bs[i] != 1)
+		if (atomic_read(&pkmap_count_bs[i]) != 1)
 			continue;
-		pkmap_count_bs[i] = 0;
 
 		/* sanity check */
 		if (pte_none_bs(pkmap_page_table_bs[i]))
 			BUG_BS();
+
 		/*
-		 * Don't need an atomic fetch-and-clear op here;
-		 * no-one has the page mapped, and cannot get at
-		 * its virtual address (and hence PTE) without first
-		 * getting the kmap_lock (which is held here).
-		 * So no dangers, even with speculative execution.
+		 * kmap_high() looks the page up and takes its reference
+		 * under the page address lock, so dropping the count and
+		 * clearing page->virtual under that lock can't race with
+		 * a new user. The cmpxchg only fails if a user got in
+		 * before us.
 		 */
 		page = pte_page_bs(pkmap_page_table_bs[i]);
-		pte_clear_bs(&init_mm_bs,
-			(unsigned long)page_address_bs(page),
-			&pkmap_page_table_bs[i]);
+		pas = page_slot_bs(page);
+		spin_lock_irqsave(&pas->lock, flags);
+		if (atomic_cmpxchg(&pkmap_count_bs[i], 1, 0) != 1) {
+			spin_unlock_irqrestore(&pas->lock, flags);
+			continue;
+		}
+		__set_page_address_bs(pas, page, NULL);
+		spin_unlock_irqrestore(&pas->lock, flags);
 
-		set_page_address_bs(page, NULL);
+		/*
+		 * No-one can get at the slot again until we drop
+		 * kmap_lock, so the pte can be cleared outside the
+		 * page address lock.
+		 */
+		pte_clear_bs(&init_mm_bs, PKMAP_ADDR_BS(i),
+					&pkmap_page_table_bs[i]);
+		nr_freed++;
 	}
-	flush_tlb_kernel_range_bs(PKMAP_ADDR_BS(0),
-				  PKMAP_ADDR_BS(LAST_PKMAP_BS));
+	if (nr_freed)
+		flush_tlb_kernel_range_bs(PKMAP_ADDR_BS(0),
+					  PKMAP_ADDR_BS(LAST_PKMAP_BS));
+	return nr_freed;
 }
 
-static inline unsigned long map_new_virtual_bs(struct page_bs *page)
+/*
+ * Move up to @nr free slots from the global pool into @slots.
+ * Called with kmap_lock held.
+ */
+static int pkmap_grab_slots_bs(unsigned int *slots, int nr)
 {
-	unsigned long vaddr;
-	int count;
+	int count = LAST_PKMAP_BS;
+	int got = 0;
 
-start:
-	count = LAST_PKMAP_BS;
-	/* Find an empty entry */
-	for (;;) {
+	while (got < nr && count--) {
 		last_pkmap_nr_bs = (last_pkmap_nr_bs + 1) & LAST_PKMAP_MASK_BS;
-		if (!last_pkmap_nr_bs) {
-			flush_all_zero_pkmaps_bs();
-			count = LAST_PKMAP_BS;
+		if (atomic_cmpxchg(&pkmap_count_bs[last_pkmap_nr_bs], 0,
+					PKMAP_RESERVED_BS) == 0)
+			slots[got++] = last_pkmap_nr_bs;
+	}
+	return got;
+}
+
+/*
+ * Hand the slots sitting in every CPU's reserve back to the global pool.
+ * Called with kmap_lock held once the pool is empty, so that nobody
+ * sleeps on pkmap_map_wait while free slots are parked on other CPUs.
+ */
+static int pkmap_drain_cpu_slots_bs(void)
+{
+	int cpu, nr_freed = 0;
+
+	for (cpu = 0; cpu < NR_CPUS_BS; cpu++) {
+		struct pkmap_cpu_cache_bs *pcc;
+
+		pcc = &per_cpu_bs(pkmap_cpu_cache_bs, cpu);
+		spin_lock(&pcc->lock);
+		while (pcc->nr) {
+			atomic_set(&pkmap_count_bs[pcc->slots[--pcc->nr]], 0);
+			nr_freed++;
 		}
-		if (!pkmap_count_bs[last_pkmap_nr_bs])
-			break; /* Found a usable entry */
-		if (--count)
+		spin_unlock(&pcc->lock);
+	}
+	return nr_freed;
+}
+
+/*
+ * Slow path: refill from the global pool. Only once no free slot is
+ * left are the unused mappings torn down, which is the only place the
+ * global TLB flush happens.
+ */
+static int pkmap_refill_slots_bs(unsigned int *slots)
+{
+	int got;
+
+	spin_lock(&kmap_lock_bs);
+	for (;;) {
+		DECLARE_WAITQUEUE(wait, current);
+
+		got = pkmap_grab_slots_bs(slots, PKMAP_CPU_BATCH_BS);
+		if (got)
+			break;
+		if (flush_all_zero_pkmaps_bs() || pkmap_drain_cpu_slots_bs())
 			continue;
 
 		/*
-		 * Sleep for somebody else to unmap their entries
+		 * Sleep for somebody else to unmap their entries. Check
+		 * again after queueing ourselves: kunmap_high() and
+		 * pkmap_put_slot() test waitqueue_active() without
+		 * kmap_lock.
 		 */
-		{
-			DECLARE_WAITQUEUE(wait, current);
-
-			__set_current_state(TASK_UNINTERRUPTIBLE);
-			add_wait_queue(&pkmap_map_wait_bs, &wait);
+		add_wait_queue(&pkmap_map_wait_bs, &wait);
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		got = pkmap_grab_slots_bs(slots, PKMAP_CPU_BATCH_BS);
+		if (!got && !flush_all_zero_pkmaps_bs() &&
+					!pkmap_drain_cpu_slots_bs()) {
 			spin_unlock(&kmap_lock_bs);
 			schedule();
-			remove_wait_queue(&pkmap_map_wait_bs, &wait);
 			spin_lock(&kmap_lock_bs);
-
-			/* Somebody else might have mapped it while we slept */
-			if (page_address_bs(page))
-				return (unsigned long)page_address_bs(page);
-
-			/* Re-start */
-			goto start;
 		}
+		__set_current_state(TASK_RUNNING);
+		remove_wait_queue(&pkmap_map_wait_bs, &wait);
+		if (got)
+			break;
 	}
-	vaddr = PKMAP_ADDR_BS(last_pkmap_nr_bs);
-	set_pte_at_bs(&init_mm_bs, vaddr,
-			&(pkmap_page_table_bs[last_pkmap_nr_bs]),
-			mk_pte_bs(page, kmap_prot_bs));
+	spin_unlock(&kmap_lock_bs);
+	return got;
+}
 
-	pkmap_count_bs[last_pkmap_nr_bs] = 1;
-	set_page_address_bs(page, (void *)vaddr);
+/*
+ * Give an unused (never mapped) slot back to the local reserve, or to
+ * the global pool if the reserve is full.
+ */
+static void pkmap_put_slot_bs(unsigned int nr)
+{
+	struct pkmap_cpu_cache_bs *pcc;
+
+	pcc = &get_cpu_var_bs(pkmap_cpu_cache_bs);
+	spin_lock(&pcc->lock);
+	if (pcc->nr < PKMAP_CPU_SLOTS_BS) {
+		pcc->slots[pcc->nr++] = nr;
+		nr = LAST_PKMAP_BS;
+	}
+	spin_unlock(&pcc->lock);
+	put_cpu_var_bs(pkmap_cpu_cache_bs);
+
+	if (nr < LAST_PKMAP_BS) {
+		atomic_set(&pkmap_count_bs[nr], 0);
+		smp_mb();
+		if (waitqueue_active(&pkmap_map_wait_bs))
+			wake_up(&pkmap_map_wait_bs);
+	}
+}
 
-	return vaddr;
+static unsigned int pkmap_get_slot_bs(void)
+{
+	struct pkmap_cpu_cache_bs *pcc;
+	unsigned int slots[PKMAP_CPU_BATCH_BS];
+	unsigned int nr;
+	int got;
+
+	pcc = &get_cpu_var_bs(pkmap_cpu_cache_bs);
+	spin_lock(&pcc->lock);
+	if (pcc->nr) {
+		nr = pcc->slots[--pcc->nr];
+		spin_unlock(&pcc->lock);
+		put_cpu_var_bs(pkmap_cpu_cache_bs);
+		return nr;
+	}
+	spin_unlock(&pcc->lock);
+	put_cpu_var_bs(pkmap_cpu_cache_bs);
+
+	got = pkmap_refill_slots_bs(slots);
+	nr = slots[--got];
+	/* We may have slept and migrated, stash the rest on this CPU */
+	while (got)
+		pkmap_put_slot_bs(slots[--got]);
+	return nr;
 }
 
 void fastcall_bs *kmap_high_bs(struct page_bs *page)
 {
+	struct page_address_slot_bs *pas = page_slot_bs(page);
+	unsigned int nr = LAST_PKMAP_BS;
 	unsigned long vaddr;
+	unsigned long flags;
 
 	/*
 	 * For highmem pages, we can't trust "virtual" until
-	 * after we have the lock.
+	 * after we have the page address lock. The reference is taken
+	 * under the same lock, which keeps flush_all_zero_pkmaps
+	 * from tearing the mapping down under us.
 	 *
 	 * We cannot call this from interrupts, as it may block
 	 */
-	spin_lock(&kmap_lock_bs);
-	vaddr = (unsigned long)page_address_bs(page);
-	if (!vaddr)
-		vaddr = map_new_virtual_bs(page);
-	pkmap_count_bs[PKMAP_NR_BS(vaddr)]++;
-	if (pkmap_count_bs[PKMAP_NR_BS(vaddr)] < 2)
-		BUG_BS();
-	spin_unlock(&kmap_lock_bs);
+again:
+	spin_lock_irqsave(&pas->lock, flags);
+	vaddr = (unsigned long)__page_address_lookup_bs(pas, page);
+	if (vaddr) {
+		if (atomic_inc_return(
+			&pkmap_count_bs[PKMAP_NR_BS(vaddr)]) < 2)
+			BUG_BS();
+	} else if (nr < LAST_PKMAP_BS) {
+		vaddr = PKMAP_ADDR_BS(nr);
+		set_pte_at_bs(&init_mm_bs, vaddr,
+				&(pkmap_page_table_bs[nr]),
+				mk_pte_bs(page, kmap_prot_bs));
+		atomic_set(&pkmap_count_bs[nr], 2);
+		__set_page_address_bs(pas, page, (void *)vaddr);
+		nr = LAST_PKMAP_BS;
+	}
+	spin_unlock_irqrestore(&pas->lock, flags);
+
+	if (!vaddr) {
+		nr = pkmap_get_slot_bs();
+		goto again;
+	}
+	/* Somebody else mapped the page while we were getting a slot */
+	if (nr < LAST_PKMAP_BS)
+		pkmap_put_slot_bs(nr);
 	return (void *)vaddr;
 }
 EXPORT_SYMBOL_GPL(kmap_high_bs);
@@ -272,9 +374,7 @@ void fastcall_bs kunmap_high_bs(struct page_bs *page)
 {
 	unsigned long vaddr;
 	unsigned long nr;
-	int need_wakeup;
 
-	spin_lock(&kmap_lock_bs);
 	vaddr = (unsigned long)page_address_bs(page);
 	if (!vaddr)
 		BUG_BS();
@@ -284,28 +384,20 @@ void fastcall_bs kunmap_high_bs(struct page_bs *page)
 	 * A count must never go down to zero
 	 * without a TLB flush!
 	 */
-	need_wakeup = 0;
-	switch (--pkmap_count_bs[nr]) {
+	switch (atomic_dec_return(&pkmap_count_bs[nr])) {
 	case 0:
 		BUG_BS();
 	case 1:
 		/*
 		 * Avoid an unnecessary wake_up() function call.
 		 * The common case is pkmap_count[] == 1, but
-		 * no waiters.
-		 * The tasks queued in the wait-queue are guarded
-		 * by both the lock in the wait-queue-head and by
-		 * the kmap_lock.  As the kmap_lock is held here,
-		 * no need for the wait-queue-head's lock.  Simply
-		 * test if the queue is empty.
+		 * no waiters. atomic_dec_return() implies a full
+		 * barrier, which pairs with set_current_state()
+		 * in pkmap_refill_slots().
 		 */
-		need_wakeup = waitqueue_active(&pkmap_map_wait_bs);
+		if (waitqueue_active(&pkmap_map_wait_bs))
+			wake_up(&pkmap_map_wait_bs);
 	}
-	spin_unlock(&kmap_lock_bs);
-
-	/* do wake-up, if needed, race-free outside of the spin lock */
-	if (need_wakeup)
-		wake_up(&pkmap_map_wait_bs);
 }
 EXPORT_SYMBOL_GPL(kunmap_high_bs);
 
@@ -381,6 +473,115 @@ void kunmap_atomic_bs(void *kvaddr, enum km_type_bs type)
 }
 EXPORT_SYMBOL_GPL(kunmap_atomic_bs);
 
+/*
+ * kmap_local is a stack of fixmap slots per CPU: there is no type to
+ * pick and no shared state, a mapping simply takes the next free slot
+ * of the local CPU. Mappings nest and must be released in reverse
+ * order. Preemption stays disabled while a mapping is held, so as with
+ * kmap_atomic the holder must not sleep.
+ */
+static DEFINE_PER_CPU_BS(int, kmap_local_idx_bs);
+
+void *kmap_local_page_bs(struct page_bs *page)
+{
+	enum fixed_addresses_bs idx;
+	unsigned long vaddr;
+	int *depth;
+
+	if (!PageHighMem_bs(page))
+		return page_address_bs(page);
+
+	preempt_disable();
+	depth = &__get_cpu_var_bs(kmap_local_idx_bs);
+	BUG_ON_BS(*depth >= KM_LOCAL_MAX_BS);
+	idx = FIX_KMAP_LOCAL_BEGIN_BS +
+		KM_LOCAL_MAX_BS * smp_processor_id() + (*depth)++;
+	vaddr = __fix_to_virt_bs(idx);
+	set_pte_bs(kmap_pte_bs - (idx - FIX_KMAP_BEGIN_BS),
+				mk_pte_bs(page, kmap_prot_bs));
+	__flush_tlb_one_bs(vaddr);
+
+	return (void *)vaddr;
+}
+EXPORT_SYMBOL_GPL(kmap_local_page_bs);
+
+void kunmap_local_bs(void *kvaddr)
+{
+	unsigned long vaddr = (unsigned long)kvaddr & PAGE_MASK_BS;
+	enum fixed_addresses_bs idx;
+	int *depth;
+
+	/* lowmem pages are not mapped through the fixmap */
+	if (vaddr < FIXADDR_START_BS)
+		return;
+
+	depth = &__get_cpu_var_bs(kmap_local_idx_bs);
+	BUG_ON_BS(*depth <= 0);
+	idx = FIX_KMAP_LOCAL_BEGIN_BS +
+		KM_LOCAL_MAX_BS * smp_processor_id() + --(*depth);
+	/* unbalanced or out of order unmap */
+	if (vaddr != __fix_to_virt_bs(idx))
+		BUG_BS();
+#ifdef CONFIG_DEBUG_HIGHMEM
+	/*
+	 * force other mappings to Oops if they'll try to access
+	 * this pte without first remap it
+	 */
+	pte_clear_bs(&init_mm_bs, vaddr, kmap_pte_bs - (idx - FIX_KMAP_BEGIN_BS));
+	__flush_tlb_one_bs(vaddr);
+#endif
+	preempt_enable();
+}
+EXPORT_SYMBOL_GPL(kunmap_local_bs);
+
+/*
+ * clear_highpage/copy_highpage map their pages through two dedicated
+ * per-CPU fixmap windows, so page clearing and copying never competes
+ * for km_type or kmap_local slots. Lowmem pages are used in place.
+ * The windows are shared by task and interrupt context, so interrupts
+ * stay off while one is in use.
+ */
+static void *kmap_scratch_bs(struct page_bs *page, int window)
+{
+	enum fixed_addresses_bs idx;
+	unsigned long vaddr;
+
+	if (!PageHighMem_bs(page))
+		return page_address_bs(page);
+
+	idx = FIX_SCRATCH_BEGIN_BS + window +
+			KM_SCRATCH_NR_BS * smp_processor_id();
+	vaddr = __fix_to_virt_bs(idx);
+	set_pte_bs(kmap_pte_bs - (idx - FIX_KMAP_BEGIN_BS),
+				mk_pte_bs(page, kmap_prot_bs));
+	__flush_tlb_one_bs(vaddr);
+
+	return (void *)vaddr;
+}
+
+void clear_highpage_bs(struct page_bs *page)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	clear_page_bs(kmap_scratch_bs(page, KM_SCRATCH_DST_BS));
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(clear_highpage_bs);
+
+void copy_highpage_bs(struct page_bs *to, struct page_bs *from)
+{
+	void *vto, *vfrom;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	vfrom = kmap_scratch_bs(from, KM_SCRATCH_SRC_BS);
+	vto = kmap_scratch_bs(to, KM_SCRATCH_DST_BS);
+	copy_page_bs(vto, vfrom);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(copy_highpage_bs);
+
 struct page_bs *kmap_atomic_to_page_bs(void *ptr)
 {
 	unsigned long idx, vaddr = (unsigned long)ptr;
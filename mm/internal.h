@@ -11,3 +11,21 @@
 
 /* page_alloc.c */
 extern void set_page_refs_bs(struct page_bs *page, int order);
+extern unsigned long isolate_free_block_bs(struct zone_bs *zone,
+				struct page_bs *page, int max_order);
+extern void drain_local_pages_bs(void);
+extern void drain_all_pages_bs(void);
+extern void start_isolate_page_range_bs(struct zone_bs *zone,
+			unsigned long start_pfn, unsigned long end_pfn);
+extern void undo_isolate_page_range_bs(struct zone_bs *zone,
+			unsigned long start_pfn, unsigned long end_pfn,
+			int migratetype);
+extern void init_reserved_page_bs(unsigned long pfn);
+extern void __free_pages_bootmem_bs(struct page_bs *page, unsigned int order);
+
+/* bootmem.c */
+extern unsigned long free_bootmem_range_bs(pg_data_t_bs *pgdat,
+			unsigned long start_pfn, unsigned long end_pfn);
+
+/* compaction.c */
+extern int alloc_contig_range_bs(unsigned long start, unsigned long end);
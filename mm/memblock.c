@@ -0,0 +1,384 @@
+/*
+ * linux/mm/memblock.c
+ *
+ * Early physical memory allocator.
+ *
+ * Memory and reserved ranges are kept as sorted arrays of regions.
+ * Adding a range merges it with its neighbours, removing one splits
+ * the regions it cuts through, and an allocation is a walk over the
+ * gaps between reserved regions, so nothing depends on how much RAM
+ * the machine has.
+ */
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/init.h"
+#include "biscuitos/mm.h"
+#include "biscuitos/memblock.h"
+
+static struct memblock_region_bs
+		memblock_memory_init_regions_bs[INIT_MEMBLOCK_REGIONS_BS];
+static struct memblock_region_bs
+		memblock_reserved_init_regions_bs[INIT_MEMBLOCK_REGIONS_BS];
+
+struct memblock_bs memblock_bs = {
+	.memory.regions		= memblock_memory_init_regions_bs,
+	.memory.max		= INIT_MEMBLOCK_REGIONS_BS,
+	.memory.name		= "memory",
+
+	.reserved.regions	= memblock_reserved_init_regions_bs,
+	.reserved.max		= INIT_MEMBLOCK_REGIONS_BS,
+	.reserved.name		= "reserved",
+
+	.bottom_up		= 1,
+	.current_limit		= MEMBLOCK_ALLOC_ANYWHERE_BS,
+};
+
+/* adjust *size so that (*base + *size) doesn't overflow */
+static inline unsigned long memblock_cap_size_bs(unsigned long base,
+						unsigned long *size)
+{
+	return *size = min(*size, ~0UL - base);
+}
+
+static void memblock_insert_region_bs(struct memblock_type_bs *type,
+			int idx, unsigned long base, unsigned long size)
+{
+	struct memblock_region_bs *rgn = &type->regions[idx];
+
+	memmove(rgn + 1, rgn, (type->cnt - idx) * sizeof(*rgn));
+	rgn->base = base;
+	rgn->size = size;
+	type->cnt++;
+	type->total_size += size;
+}
+
+static void memblock_remove_region_bs(struct memblock_type_bs *type,
+						unsigned long r)
+{
+	type->total_size -= type->regions[r].size;
+	memmove(&type->regions[r], &type->regions[r + 1],
+		(type->cnt - (r + 1)) * sizeof(type->regions[r]));
+	type->cnt--;
+}
+
+/* merge neighbouring regions that touch */
+static void memblock_merge_regions_bs(struct memblock_type_bs *type)
+{
+	int i = 0;
+
+	while (i < (int)type->cnt - 1) {
+		struct memblock_region_bs *this = &type->regions[i];
+		struct memblock_region_bs *next = &type->regions[i + 1];
+
+		if (this->base + this->size != next->base) {
+			i++;
+			continue;
+		}
+		this->size += next->size;
+		memmove(next, next + 1, (type->cnt - (i + 2)) * sizeof(*next));
+		type->cnt--;
+	}
+}
+
+/*
+ * Add [base, base + size) to type.  Parts already covered are left
+ * alone, the gaps between them are inserted and everything that touches
+ * is merged.  Each insert needs a free slot, so the worst case is
+ * checked up front: one new region per existing one it crosses, plus one.
+ */
+static int memblock_add_range_bs(struct memblock_type_bs *type,
+				unsigned long base, unsigned long size)
+{
+	unsigned long end = base + memblock_cap_size_bs(base, &size);
+	int idx, nr_new = 0;
+
+	if (!size)
+		return 0;
+
+	for (idx = 0; idx < type->cnt; idx++) {
+		struct memblock_region_bs *rgn = &type->regions[idx];
+
+		if (rgn->base >= end)
+			break;
+		if (rgn->base + rgn->size > base)
+			nr_new++;
+	}
+	if (type->cnt + nr_new + 1 > type->max) {
+		printk(KERN_ERR "memblock: %s array is full, dropping "
+				"[%#lx-%#lx]\n", type->name, base, end - 1);
+		return -ENOMEM;
+	}
+
+	for (idx = 0; idx < type->cnt; idx++) {
+		struct memblock_region_bs *rgn = &type->regions[idx];
+		unsigned long rbase = rgn->base;
+		unsigned long rend = rbase + rgn->size;
+
+		if (rbase >= end)
+			break;
+		if (rend <= base)
+			continue;
+		/* the part below this region is new */
+		if (rbase > base)
+			memblock_insert_region_bs(type, idx++, base,
+							rbase - base);
+		/* area below @rend is dealt with, forget about it */
+		base = min(rend, end);
+	}
+
+	/* insert the remaining portion */
+	if (base < end)
+		memblock_insert_region_bs(type, idx, base, end - base);
+
+	memblock_merge_regions_bs(type);
+	return 0;
+}
+
+/*
+ * Split the regions of type at base and base + size so that the range
+ * is made of whole regions, and return them as [*start_rgn, *end_rgn).
+ */
+static int memblock_isolate_range_bs(struct memblock_type_bs *type,
+			unsigned long base, unsigned long size,
+			int *start_rgn, int *end_rgn)
+{
+	unsigned long end = base + memblock_cap_size_bs(base, &size);
+	int idx;
+
+	*start_rgn = *end_rgn = 0;
+
+	if (!size)
+		return 0;
+
+	/* at most two splits */
+	if (type->cnt + 2 > type->max) {
+		printk(KERN_ERR "memblock: %s array is full\n", type->name);
+		return -ENOMEM;
+	}
+
+	for (idx = 0; idx < type->cnt; idx++) {
+		struct memblock_region_bs *rgn = &type->regions[idx];
+		unsigned long rbase = rgn->base;
+		unsigned long rend = rbase + rgn->size;
+
+		if (rbase >= end)
+			break;
+		if (rend <= base)
+			continue;
+
+		if (rbase < base) {
+			/*
+			 * rgn intersects from below.  Split and continue
+			 * to process the next region - the new top half.
+			 */
+			rgn->base = base;
+			rgn->size -= base - rbase;
+			type->total_size -= base - rbase;
+			memblock_insert_region_bs(type, idx, rbase,
+							base - rbase);
+		} else if (rend > end) {
+			/*
+			 * rgn intersects from above.  Split and redo the
+			 * current region - the new bottom half.
+			 */
+			rgn->base = end;
+			rgn->size -= end - rbase;
+			type->total_size -= end - rbase;
+			memblock_insert_region_bs(type, idx--, rbase,
+							end - rbase);
+		} else {
+			/* rgn is fully contained, record it */
+			if (!*end_rgn)
+				*start_rgn = idx;
+			*end_rgn = idx + 1;
+		}
+	}
+	return 0;
+}
+
+static int memblock_remove_range_bs(struct memblock_type_bs *type,
+				unsigned long base, unsigned long size)
+{
+	int start_rgn, end_rgn;
+	int i, ret;
+
+	ret = memblock_isolate_range_bs(type, base, size,
+						&start_rgn, &end_rgn);
+	if (ret)
+		return ret;
+
+	for (i = end_rgn - 1; i >= start_rgn; i--)
+		memblock_remove_region_bs(type, i);
+	return 0;
+}
+
+int __init memblock_add_bs(unsigned long base, unsigned long size)
+{
+	return memblock_add_range_bs(&memblock_bs.memory, base, size);
+}
+
+int __init memblock_remove_bs(unsigned long base, unsigned long size)
+{
+	return memblock_remove_range_bs(&memblock_bs.memory, base, size);
+}
+
+int __init memblock_reserve_bs(unsigned long base, unsigned long size)
+{
+	return memblock_add_range_bs(&memblock_bs.reserved, base, size);
+}
+
+int __init memblock_free_bs(unsigned long base, unsigned long size)
+{
+	return memblock_remove_range_bs(&memblock_bs.reserved, base, size);
+}
+
+/*
+ * Step to the next range that is memory but not reserved.  *idx packs
+ * the memory index in the low half and the reserved index in the high
+ * half; the reserved side walks the gaps between reserved regions.
+ */
+void __next_free_mem_range_bs(u64 *idx, unsigned long *out_start,
+						unsigned long *out_end)
+{
+	struct memblock_type_bs *type_a = &memblock_bs.memory;
+	struct memblock_type_bs *type_b = &memblock_bs.reserved;
+	int idx_a = *idx & 0xffffffff;
+	int idx_b = *idx >> 32;
+
+	for (; idx_a < type_a->cnt; idx_a++) {
+		struct memblock_region_bs *m = &type_a->regions[idx_a];
+		unsigned long m_start = m->base;
+		unsigned long m_end = m->base + m->size;
+
+		for (; idx_b < type_b->cnt + 1; idx_b++) {
+			struct memblock_region_bs *r = &type_b->regions[idx_b];
+			unsigned long r_start, r_end;
+
+			r_start = idx_b ? r[-1].base + r[-1].size : 0;
+			r_end = idx_b < type_b->cnt ? r->base : ~0UL;
+
+			/* gap is past this memory region, try the next one */
+			if (r_start >= m_end)
+				break;
+			if (m_start < r_end) {
+				*out_start = max(m_start, r_start);
+				*out_end = min(m_end, r_end);
+				/* advance whichever ends first */
+				if (m_end <= r_end)
+					idx_a++;
+				else
+					idx_b++;
+				*idx = (u32)idx_a | (u64)idx_b << 32;
+				return;
+			}
+		}
+	}
+
+	/* signal end of iteration */
+	*idx = ULLONG_MAX;
+}
+
+/*
+ * Find size bytes aligned to align inside [start, end) that are free.
+ * Bottom-up returns the lowest fit, top-down the highest.  Address 0 is
+ * never handed out, so 0 means failure.
+ */
+unsigned long __init memblock_find_in_range_bs(unsigned long start,
+		unsigned long end, unsigned long size, unsigned long align)
+{
+	unsigned long this_start, this_end, cand, found = 0;
+	u64 i;
+
+	BUG_ON_BS(align & (align - 1));
+	if (!align)
+		align = 1;
+	if (end > memblock_bs.current_limit)
+		end = memblock_bs.current_limit;
+	start = max(start, (unsigned long)PAGE_SIZE_BS);
+	if (start >= end || size > end - start)
+		return 0;
+
+	for_each_free_mem_range_bs(i, &this_start, &this_end) {
+		this_start = max(this_start, start);
+		this_end = min(this_end, end);
+		if (this_start >= this_end || size > this_end - this_start)
+			continue;
+
+		if (memblock_bs.bottom_up) {
+			cand = ALIGN(this_start, align);
+			if (cand >= this_start && cand <= this_end - size)
+				return cand;
+		} else {
+			cand = (this_end - size) & ~(align - 1);
+			if (cand >= this_start)
+				found = cand;
+		}
+	}
+	return found;
+}
+
+unsigned long __init memblock_alloc_range_bs(unsigned long size,
+		unsigned long align, unsigned long start, unsigned long end)
+{
+	unsigned long found;
+
+	found = memblock_find_in_range_bs(start, end, size, align);
+	if (found && !memblock_reserve_bs(found, size))
+		return found;
+	return 0;
+}
+
+static int memblock_search_bs(struct memblock_type_bs *type,
+						unsigned long addr)
+{
+	unsigned int left = 0, right = type->cnt;
+
+	do {
+		unsigned int mid = (right + left) / 2;
+
+		if (addr < type->regions[mid].base)
+			right = mid;
+		else if (addr >= (type->regions[mid].base +
+				  type->regions[mid].size))
+			left = mid + 1;
+		else
+			return mid;
+	} while (left < right);
+	return -1;
+}
+
+int memblock_is_memory_bs(unsigned long addr)
+{
+	return memblock_bs.memory.cnt &&
+		memblock_search_bs(&memblock_bs.memory, addr) != -1;
+}
+
+int memblock_is_reserved_bs(unsigned long addr)
+{
+	return memblock_bs.reserved.cnt &&
+		memblock_search_bs(&memblock_bs.reserved, addr) != -1;
+}
+
+static void memblock_dump_bs(struct memblock_type_bs *type)
+{
+	unsigned long i;
+
+	printk(" %s.cnt  = %#lx, total %#lx\n", type->name, type->cnt,
+							type->total_size);
+	for (i = 0; i < type->cnt; i++) {
+		struct memblock_region_bs *rgn = &type->regions[i];
+
+		printk(" %s[%#lx]\t[%#08lx-%#08lx], %#lx bytes\n",
+			type->name, i, rgn->base,
+			rgn->base + rgn->size - 1, rgn->size);
+	}
+}
+
+void memblock_dump_all_bs(void)
+{
+	printk("MEMBLOCK configuration:\n");
+	memblock_dump_bs(&memblock_bs.memory);
+	memblock_dump_bs(&memblock_bs.reserved);
+}
@@ -9,14 +9,60 @@
  */
 #include <linux/kernel.h>
 #include <linux/sched.h>
+#include <linux/smp.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
 #include "biscuitos/kernel.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/slab.h"
+#include "biscuitos/gfp.h"
+#include "biscuitos/highmem.h"
 #include "biscuitos/mempool.h"
 
+/*
+ * Page pools refill the reserve with blocks of up to
+ * 2^MEMPOOL_PAGE_BULK_ORDER elements per buddy allocation.
+ */
+#define MEMPOOL_PAGE_BULK_ORDER_BS	3
+
+/*
+ * All pools created by mempool_create(), for /proc/mempoolinfo_bs.
+ */
+static LIST_HEAD(mempool_chain_bs);
+static DEFINE_MUTEX(mempool_chain_mutex_bs);
+
+#define mempool_stat_inc_bs(pool, member)	\
+	__mod_mempool_stat_bs(pool, offsetof(struct mempool_stats_bs, member), 1UL)
+#define mempool_stat_add_bs(pool, member, delta)	\
+	__mod_mempool_stat_bs(pool, offsetof(struct mempool_stats_bs, member), \
+								(delta))
+
+static void __mod_mempool_stat_bs(mempool_t_bs *pool, unsigned offset,
+						unsigned long delta)
+{
+	unsigned long flags;
+	void *ptr;
+
+	local_irq_save(flags);
+	ptr = &pool->stats[smp_processor_id()];
+	*(unsigned long *)(ptr + offset) += delta;
+	local_irq_restore(flags);
+}
+
+/*
+ * Number of elements the reserve may hold: min_nr, plus the high-water
+ * mark of reserve-first pools.
+ */
+static inline int mempool_capacity_bs(mempool_t_bs *pool)
+{
+	return pool->min_nr + pool->high_nr;
+}
+
 static void add_element_bs(mempool_t_bs *pool, void *element)
 {
-	BUG_ON_BS(pool->curr_nr >= pool->min_nr);
+	BUG_ON_BS(pool->curr_nr >= mempool_capacity_bs(pool));
 	pool->elements[pool->curr_nr++] = element;
 }
 
@@ -26,51 +72,271 @@ static void *remove_element_bs(mempool_t_bs *pool)
 	return pool->elements[--pool->curr_nr];
 }
 
+/*
+ * pool->reserved counts the elements held by the pool, in the per-CPU
+ * stashes and in *elements. An element only enters the reserve by
+ * bumping it below mempool_capacity(), so however the elements are
+ * spread, the pool never holds more than that.
+ *
+ * Per-CPU stashes are only touched by the owning CPU, with interrupts
+ * off and without pool->lock.
+ */
+static void *mempool_take_reserve_bs(mempool_t_bs *pool)
+{
+	void *element = NULL;
+	unsigned long flags;
+
+	if (pool->stash) {
+		struct mempool_stash_bs *stash;
+
+		local_irq_save(flags);
+		stash = &pool->stash[smp_processor_id()];
+		if (stash->nr)
+			element = stash->elements[--stash->nr];
+		local_irq_restore(flags);
+	}
+
+	if (!element) {
+		spin_lock_irqsave(&pool->lock, flags);
+		if (likely(pool->curr_nr))
+			element = remove_element_bs(pool);
+		spin_unlock_irqrestore(&pool->lock, flags);
+	}
+
+	if (element) {
+		int reserved = atomic_dec_return(&pool->reserved);
+
+		/* racy, but it is only a statistic */
+		if (reserved < pool->low_nr)
+			pool->low_nr = reserved;
+
+		if ((pool->flags & MEMPOOL_ZERO_BS) &&
+		    ((struct page_bs *)element)->private ==
+						MEMPOOL_PAGE_DIRTY_BS) {
+			((struct page_bs *)element)->private = 0;
+			mempool_zero_pages_bs(pool, element);
+		}
+	}
+	return element;
+}
+
+/*
+ * Returns 0 if the reserve is already full and @element has to go back
+ * to the allocator.
+ */
+static int mempool_add_reserve_bs(mempool_t_bs *pool, void *element)
+{
+	unsigned long flags;
+
+	if (!atomic_add_unless(&pool->reserved, 1, mempool_capacity_bs(pool)))
+		return 0;
+
+	/* Waiters sleep on *elements, so hand it over there */
+	if (pool->stash && !waitqueue_active(&pool->wait)) {
+		struct mempool_stash_bs *stash;
+
+		local_irq_save(flags);
+		stash = &pool->stash[smp_processor_id()];
+		if (stash->nr < MEMPOOL_STASH_BS) {
+			stash->elements[stash->nr++] = element;
+			local_irq_restore(flags);
+			return 1;
+		}
+		local_irq_restore(flags);
+	}
+
+	spin_lock_irqsave(&pool->lock, flags);
+	add_element_bs(pool, element);
+	spin_unlock_irqrestore(&pool->lock, flags);
+	wake_up(&pool->wait);
+	return 1;
+}
+
+static void mempool_drain_stash_bs(void *arg)
+{
+	mempool_t_bs *pool = (mempool_t_bs *)arg;
+	struct mempool_stash_bs *stash = &pool->stash[smp_processor_id()];
+
+	spin_lock(&pool->lock);
+	while (stash->nr && pool->curr_nr < mempool_capacity_bs(pool))
+		add_element_bs(pool, stash->elements[--stash->nr]);
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Move every stashed element to *elements, so that the reserve is
+ * reachable from any CPU. Must be called with interrupts enabled.
+ */
+static void mempool_drain_stashes_bs(mempool_t_bs *pool)
+{
+	on_each_cpu(mempool_drain_stash_bs, pool, 1);
+}
+
+/*
+ * Zeroing page pools ask the buddy allocator for zeroed pages, so
+ * every element the refill brings in is already clear. The buddy
+ * allocator can't zero highmem pages for an allocation that may not
+ * sleep, so zeroing pools stick to lowmem.
+ */
+static inline unsigned int mempool_gfp_bs(mempool_t_bs *pool,
+					unsigned int __nocast gfp_mask)
+{
+	if (pool->flags & MEMPOOL_ZERO_BS) {
+		gfp_mask |= __GFP_ZERO_BS;
+		gfp_mask &= ~__GFP_HIGHMEM_BS;
+	}
+	return gfp_mask;
+}
+
+/*
+ * Elements that mempool_free() put back into the reserve of a zeroing
+ * pool are marked in page->private and cleared when handed out again.
+ */
+#define MEMPOOL_PAGE_DIRTY_BS	1UL
+
+static void mempool_zero_pages_bs(mempool_t_bs *pool, struct page_bs *page)
+{
+	int i, order = (long)pool->pool_data;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage_bs(page + i);
+}
+
+/*
+ * Refill a page pool with one higher order buddy allocation cut into
+ * elements. Returns the number of elements that went into the reserve,
+ * 0 if the buddy allocator had no such block or the reserve is full.
+ */
+static int mempool_refill_pages_bs(mempool_t_bs *pool)
+{
+	int order = (long)pool->pool_data;
+	int want = mempool_capacity_bs(pool) - atomic_read(&pool->reserved);
+	struct page_bs *page;
+	int bulk = 0, added = 0, i;
+
+	if (want <= 1)
+		return 0;
+	while (bulk < MEMPOOL_PAGE_BULK_ORDER_BS && (2 << bulk) <= want &&
+					order + bulk + 1 < MAX_ORDER_BS)
+		bulk++;
+
+	page = alloc_pages_bs(mempool_gfp_bs(pool, GFP_KERNEL_BS |
+			__GFP_NORETRY_BS | __GFP_NOWARN_BS), order + bulk);
+	if (!page)
+		return 0;
+
+	/*
+	 * Only the head page of a block carries a reference, give each
+	 * element its own so they can be freed one by one.
+	 */
+	for (i = 0; i < (1 << bulk); i++) {
+		struct page_bs *element = page + (i << order);
+
+		if (i)
+			set_page_count_bs(element, 1);
+		if (mempool_add_reserve_bs(pool, element))
+			added++;
+		else
+			__free_pages_bs(element, order);
+	}
+	return added;
+}
+
+/*
+ * Background refill of reserve-first pools: allocations that hit the
+ * reserve never call pool->alloc, this does it for them.
+ */
+static void mempool_refill_bs(struct work_struct *work)
+{
+	mempool_t_bs *pool = container_of(work, mempool_t_bs, refill_work);
+	void *element;
+
+	if (pool->flags & MEMPOOL_PAGES_BS)
+		while (mempool_refill_pages_bs(pool))
+			;
+
+	while (atomic_read(&pool->reserved) < mempool_capacity_bs(pool)) {
+		element = pool->alloc(mempool_gfp_bs(pool, GFP_KERNEL_BS),
+							pool->pool_data);
+		if (!element)
+			break;
+		if (!mempool_add_reserve_bs(pool, element)) {
+			pool->free(element, pool->pool_data); /* Raced */
+			break;
+		}
+	}
+}
+
+static inline void mempool_kick_refill_bs(mempool_t_bs *pool)
+{
+	if ((pool->flags & MEMPOOL_RESERVE_FIRST_BS) &&
+	    atomic_read(&pool->reserved) < mempool_capacity_bs(pool))
+		schedule_work(&pool->refill_work);
+}
+
 static void free_pool_bs(mempool_t_bs *pool)
 {
+	int cpu;
+
 	while (pool->curr_nr) {
 		void *element = remove_element_bs(pool);
 
 		pool->free(element, pool->pool_data);
 	}
+	if (pool->stash) {
+		for (cpu = 0; cpu < NR_CPUS_BS; cpu++) {
+			struct mempool_stash_bs *stash = &pool->stash[cpu];
+
+			while (stash->nr)
+				pool->free(stash->elements[--stash->nr],
+							pool->pool_data);
+		}
+		kfree_bs(pool->stash);
+	}
 	kfree_bs(pool->elements);
 	kfree_bs(pool);
 }
 
-/**
- * mempool_create - create a memory pool
- * @min_nr:    the minimum number of elements guaranteed to be
- *             allocated for this pool.
- * @alloc_fn:  user-defined element-allocation function.
- * @free_fn:   user-defined element-freeing function.
- * @pool_data: optional private data available to the user-defined functions.
- *
- * this function creates and allocates a guaranteed size, preallocated
- * memory pool. The pool can be used from the mempool_alloc and mempool_free
- * functions. This function might sleep. Both the alloc_fn() and the free_fn()
- * functions might sleep - as long as the mempool_alloc function is not called
- * from IRQ contexts.
- */
-mempool_t_bs *mempool_create_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
-		mempool_free_t_bs *free_fn, void *pool_data)
+static mempool_t_bs *__mempool_create_bs(int min_nr, int high_nr,
+		mempool_alloc_t_bs *alloc_fn, mempool_free_t_bs *free_fn,
+		void *pool_data, unsigned int flags, void *caller)
 {
 	mempool_t_bs *pool;
 
+	BUG_ON_BS(high_nr < 0);
+	BUG_ON_BS((flags & MEMPOOL_ZERO_BS) && !(flags & MEMPOOL_PAGES_BS));
+	if (high_nr)
+		flags |= MEMPOOL_RESERVE_FIRST_BS;
+
 	pool = kmalloc_bs(sizeof(*pool), GFP_KERNEL_BS);
 	if (!pool)
 		return NULL;
 	memset(pool, 0, sizeof(*pool));
-	pool->elements = kmalloc_bs(min_nr * sizeof(void *), GFP_KERNEL_BS);
+	pool->elements = kmalloc_bs((min_nr + high_nr) * sizeof(void *),
+							GFP_KERNEL_BS);
 	if (!pool->elements) {
 		kfree_bs(pool);
 		return NULL;
 	}
 	spin_lock_init(&pool->lock);
 	pool->min_nr = min_nr;
+	pool->high_nr = high_nr;
 	pool->pool_data = pool_data;
 	init_waitqueue_head(&pool->wait);
 	pool->alloc = alloc_fn;
 	pool->free = free_fn;
+	pool->flags = flags;
+	INIT_WORK(&pool->refill_work, mempool_refill_bs);
+
+	if (flags & MEMPOOL_PERCPU_BS) {
+		pool->stash = kmalloc_bs(NR_CPUS_BS * sizeof(*pool->stash),
+							GFP_KERNEL_BS);
+		if (!pool->stash) {
+			free_pool_bs(pool);
+			return NULL;
+		}
+		memset(pool->stash, 0, NR_CPUS_BS * sizeof(*pool->stash));
+	}
 
 	/*
 	 * First pre-allocate the guaranteed number of buffers.
@@ -78,16 +344,94 @@ mempool_t_bs *mempool_create_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
 	while (pool->curr_nr < pool->min_nr) {
 		void *element;
 
-		element = pool->alloc(GFP_KERNEL_BS, pool->pool_data);
+		element = pool->alloc(mempool_gfp_bs(pool, GFP_KERNEL_BS),
+							pool->pool_data);
 		if (unlikely(!element)) {
 			free_pool_bs(pool);
 			return NULL;
 		}
 		add_element_bs(pool, element);
 	}
+	atomic_set(&pool->reserved, pool->curr_nr);
+	pool->low_nr = pool->curr_nr;
+	pool->caller = caller;
+
+	mutex_lock(&mempool_chain_mutex_bs);
+	list_add_tail(&pool->list, &mempool_chain_bs);
+	mutex_unlock(&mempool_chain_mutex_bs);
+
+	mempool_kick_refill_bs(pool);
 	return pool;
 }
+
+/**
+ * mempool_create - create a memory pool
+ * @min_nr:    the minimum number of elements guaranteed to be
+ *             allocated for this pool.
+ * @alloc_fn:  user-defined element-allocation function.
+ * @free_fn:   user-defined element-freeing function.
+ * @pool_data: optional private data available to the user-defined functions.
+ *
+ * this function creates and allocates a guaranteed size, preallocated
+ * memory pool. The pool can be used from the mempool_alloc and mempool_free
+ * functions. This function might sleep. Both the alloc_fn() and the free_fn()
+ * functions might sleep - as long as the mempool_alloc function is not called
+ * from IRQ contexts.
+ */
+mempool_t_bs *mempool_create_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
+		mempool_free_t_bs *free_fn, void *pool_data)
+{
+	return __mempool_create_bs(min_nr, 0, alloc_fn, free_fn, pool_data,
+				0, __builtin_return_address(0));
+}
 EXPORT_SYMBOL_GPL(mempool_create_bs);
+
+/**
+ * mempool_create_flags - create a memory pool with optional features
+ * @min_nr:    the minimum number of elements guaranteed to be
+ *             allocated for this pool.
+ * @alloc_fn:  user-defined element-allocation function.
+ * @free_fn:   user-defined element-freeing function.
+ * @pool_data: optional private data available to the user-defined functions.
+ * @flags:     MEMPOOL_PERCPU: keep part of the reserve in per-CPU stashes,
+ *             so reserve hits and refills don't take pool->lock.
+ *             MEMPOOL_RESERVE_FIRST: see mempool_create_reserve().
+ *
+ * Same as mempool_create() otherwise.
+ */
+mempool_t_bs *mempool_create_flags_bs(int min_nr, mempool_alloc_t_bs *alloc_fn,
+		mempool_free_t_bs *free_fn, void *pool_data, unsigned int flags)
+{
+	return __mempool_create_bs(min_nr, 0, alloc_fn, free_fn, pool_data,
+				flags, __builtin_return_address(0));
+}
+EXPORT_SYMBOL_GPL(mempool_create_flags_bs);
+
+/**
+ * mempool_create_reserve - create a reserve-first memory pool
+ * @min_nr:    the minimum number of elements guaranteed to be
+ *             allocated for this pool.
+ * @high_nr:   number of elements kept on top of @min_nr.
+ * @alloc_fn:  user-defined element-allocation function.
+ * @free_fn:   user-defined element-freeing function.
+ * @pool_data: optional private data available to the user-defined functions.
+ * @flags:     MEMPOOL_* flags, MEMPOOL_RESERVE_FIRST is implied if
+ *             @high_nr is not zero.
+ *
+ * mempool_alloc() on a reserve-first pool hands out preallocated elements
+ * before it calls @alloc_fn, and a worker refills the reserve up to
+ * @min_nr + @high_nr off the allocation path. @min_nr elements are
+ * allocated here, the rest in the background.
+ */
+mempool_t_bs *mempool_create_reserve_bs(int min_nr, int high_nr,
+		mempool_alloc_t_bs *alloc_fn, mempool_free_t_bs *free_fn,
+		void *pool_data, unsigned int flags)
+{
+	return __mempool_create_bs(min_nr, high_nr, alloc_fn, free_fn,
+			pool_data, flags, __builtin_return_address(0));
+}
+EXPORT_SYMBOL_GPL(mempool_create_reserve_bs);
+
 /**
  * mempool_resize - resize an existing memory pool
  * @pool:       pointer to the memory pool which was allocated via
@@ -99,6 +443,8 @@ EXPORT_SYMBOL_GPL(mempool_create_bs);
  * This function shrinks/grows the pool. In the case of growing,
  * it cannot be guaranteed that the pool will be grown to the new
  * size immediately, but new mempool_free() calls will refill it.
+ * The high-water mark of a reserve-first pool stays @pool->high_nr
+ * elements above @new_min_nr.
  *
  * Note, the caller must guarantee that no mempool_destroy is called
  * while this function is running. mempool_alloc() & mempool_free()
@@ -107,33 +453,63 @@ EXPORT_SYMBOL_GPL(mempool_create_bs);
 int mempool_resize_bs(mempool_t_bs *pool, int new_min_nr,
 				unsigned int __nocast gfp_mask)
 {
+	return mempool_resize_marks_bs(pool, new_min_nr, pool->high_nr,
+								gfp_mask);
+}
+EXPORT_SYMBOL_GPL(mempool_resize_bs);
+
+/**
+ * mempool_resize_marks - change both marks of an existing memory pool
+ * @pool:        pointer to the memory pool which was allocated via
+ *               mempool_create().
+ * @new_min_nr:  the new minimum number of elements guaranteed to be
+ *               allocated for this pool.
+ * @new_high_nr: the new number of elements kept on top of @new_min_nr.
+ * @gfp_mask:    the usual allocation bitmask.
+ *
+ * Like mempool_resize(). The pool is synchronously filled up to
+ * @new_min_nr only, the refill worker of a reserve-first pool takes care
+ * of the rest.
+ */
+int mempool_resize_marks_bs(mempool_t_bs *pool, int new_min_nr,
+		int new_high_nr, unsigned int __nocast gfp_mask)
+{
+	int new_max_nr = new_min_nr + new_high_nr;
 	void *element;
 	void **new_elements;
 	unsigned long flags;
 
-	BUG_ON_BS(new_min_nr <= 0);
+	BUG_ON_BS(new_min_nr <= 0 || new_high_nr < 0);
+	if (new_high_nr)
+		pool->flags |= MEMPOOL_RESERVE_FIRST_BS;
+
+	if (pool->stash)
+		mempool_drain_stashes_bs(pool);
 
 	spin_lock_irqsave(&pool->lock, flags);
-	if (new_min_nr <= pool->min_nr) {
-		while (new_min_nr < pool->curr_nr) {
+	if (new_max_nr <= mempool_capacity_bs(pool)) {
+		pool->min_nr = new_min_nr;
+		pool->high_nr = new_high_nr;
+		while (new_max_nr < atomic_read(&pool->reserved) &&
+							pool->curr_nr) {
 			element = remove_element_bs(pool);
+			atomic_dec(&pool->reserved);
 			spin_unlock_irqrestore(&pool->lock, flags);
 			pool->free(element, pool->pool_data);
 			spin_lock_irqsave(&pool->lock, flags);
 		}
-		pool->min_nr = new_min_nr;
-		goto out_unlock;
+		goto fill;
 	}
 	spin_unlock_irqrestore(&pool->lock, flags);
 
 	/* Grow the pool */
-	new_elements = kmalloc_bs(new_min_nr * sizeof(*new_elements), 
+	new_elements = kmalloc_bs(new_max_nr * sizeof(*new_elements), 
 								gfp_mask);
 	if (!new_elements)
 		return -ENOMEM;
 
 	spin_lock_irqsave(&pool->lock, flags);
-	if (unlikely(new_min_nr <= pool->min_nr)) {
+	if (unlikely(new_max_nr <= mempool_capacity_bs(pool))) {
 		/* Raced, other resize will do our work */
 		spin_unlock_irqrestore(&pool->lock, flags);
 		kfree_bs(new_elements);
@@ -144,27 +520,27 @@ int mempool_resize_bs(mempool_t_bs *pool, int new_min_nr,
 	kfree_bs(pool->elements);
 	pool->elements = new_elements;
 	pool->min_nr = new_min_nr;
+	pool->high_nr = new_high_nr;
 
-	while (pool->curr_nr < pool->min_nr) {
+fill:
+	while (atomic_read(&pool->reserved) < pool->min_nr) {
 		spin_unlock_irqrestore(&pool->lock, flags);
-		element = pool->alloc(gfp_mask, pool->pool_data);
+		element = pool->alloc(mempool_gfp_bs(pool, gfp_mask),
+							pool->pool_data);
 		if (!element)
 			goto out;
-		spin_lock_irqsave(&pool->lock, flags);
-		if (pool->curr_nr < pool->min_nr) {
-			add_element_bs(pool, element);
-		} else {
-			spin_unlock_irqrestore(&pool->lock, flags);
+		if (!mempool_add_reserve_bs(pool, element)) {
 			pool->free(element, pool->pool_data); /* Raced */
 			goto out;
 		}
+		spin_lock_irqsave(&pool->lock, flags);
 	}
-out_unlock:
 	spin_unlock_irqrestore(&pool->lock, flags);
 out:
+	mempool_kick_refill_bs(pool);
 	return 0;
 }
-EXPORT_SYMBOL_GPL(mempool_resize_bs);
+EXPORT_SYMBOL_GPL(mempool_resize_marks_bs);
 
 /**
  * mempool_destroy - deallocate a memory pool
@@ -177,7 +553,14 @@ EXPORT_SYMBOL_GPL(mempool_resize_bs);
  */
 void mempool_destroy_bs(mempool_t_bs *pool)
 {
-	if (pool->curr_nr != pool->min_nr)
+	mutex_lock(&mempool_chain_mutex_bs);
+	list_del(&pool->list);
+	mutex_unlock(&mempool_chain_mutex_bs);
+
+	cancel_work_sync(&pool->refill_work);
+	if (pool->stash)
+		mempool_drain_stashes_bs(pool);
+	if (atomic_read(&pool->reserved) < pool->min_nr)
 		BUG_BS();	/* There were outstanding elements */
 	free_pool_bs(pool);
 }
@@ -197,31 +580,46 @@ EXPORT_SYMBOL_GPL(mempool_destroy_bs);
 void *mempool_alloc_bs(mempool_t_bs *pool, unsigned int __nocast gfp_mask)
 {
 	void *element;
-	unsigned long flags;
 	DEFINE_WAIT(wait);
 	int gfp_temp;
+	int drained = 0;
+	u64 start, delta;
 
 	might_sleep_if(gfp_mask & __GFP_WAIT_BS);
 
+	/* Reserve-first: the preallocated elements are the fast path */
+	if (pool->flags & MEMPOOL_RESERVE_FIRST_BS) {
+		element = mempool_take_reserve_bs(pool);
+		if (likely(element != NULL)) {
+			mempool_stat_inc_bs(pool, reserve_hit);
+			mempool_kick_refill_bs(pool);
+			return element;
+		}
+	}
+
 	gfp_mask |= __GFP_NOMEMALLOC_BS; /* don't allocate emergency reserves */
 	gfp_mask |= __GFP_NORETRY_BS; /* don't loop in __alloc_pages */
 	gfp_mask |= __GFP_NOWARN_BS; /* failures are OK */
 
+	gfp_mask = mempool_gfp_bs(pool, gfp_mask);
+
 	gfp_temp = gfp_mask & ~(__GFP_WAIT_BS | __GFP_IO_BS);
 
 repeat_alloc:
 
 	element = pool->alloc(gfp_temp, pool->pool_data);
-	if (likely(element != NULL))
+	if (likely(element != NULL)) {
+		mempool_stat_inc_bs(pool, alloc_hit);
 		return element;
+	}
 
-	spin_lock_irqsave(&pool->lock, flags);
-	if (likely(pool->curr_nr)) {
-		element = remove_element_bs(pool);
-		spin_unlock_irqrestore(&pool->lock, flags);
+	element = mempool_take_reserve_bs(pool);
+	if (likely(element != NULL)) {
+		mempool_stat_inc_bs(pool, reserve_hit);
+		mempool_kick_refill_bs(pool);
 		return element;
 	}
-	spin_unlock_irqrestore(&pool->lock, flags);
+	mempool_stat_inc_bs(pool, reserve_miss);
 
 	/* We must not sleep in the GFP_ATOMIC case */
 	if (!(gfp_mask & __GFP_WAIT_BS))
@@ -229,11 +627,33 @@ repeat_alloc:
 
 	/* Now start performing page reclaim */
 	gfp_temp = gfp_mask;
+
+	/*
+	 * The rest of the reserve may be sitting in other CPUs' stashes.
+	 * Drain them once, if that didn't get us an element wait for one.
+	 */
+	if (pool->stash && !drained && atomic_read(&pool->reserved)) {
+		mempool_drain_stashes_bs(pool);
+		drained = 1;
+		goto repeat_alloc;
+	}
+
 	prepare_to_wait(&pool->wait, &wait, TASK_UNINTERRUPTIBLE);
 	smp_mb();
-	if (!pool->curr_nr)
+	if (!pool->curr_nr) {
+		start = ktime_get_ns();
 		io_schedule();
+		delta = ktime_get_ns() - start;
+
+		delta = div_u64(delta, NSEC_PER_USEC);
+
+		mempool_stat_inc_bs(pool, wait);
+		mempool_stat_add_bs(pool, wait_us, (unsigned long)delta);
+		if (delta > pool->max_wait_us)
+			pool->max_wait_us = delta;
+	}
 	finish_wait(&pool->wait, &wait);
+	drained = 0;
 
 	goto repeat_alloc;
 }
@@ -249,20 +669,23 @@ EXPORT_SYMBOL_GPL(mempool_alloc_bs);
  */
 void mempool_free_bs(void *element, mempool_t_bs *pool)
 {
-	unsigned long flags;
-
-	smp_mb();
-	if (pool->curr_nr < pool->min_nr) {
-		spin_lock_irqsave(&pool->lock, flags);
-		if (pool->curr_nr < pool->min_nr) {
-			add_element_bs(pool, element);
-			spin_unlock_irqrestore(&pool->lock, flags);
-			wake_up(&pool->wait);
+	/*
+	 * A zeroing pool only keeps a returned page when the reserve is
+	 * below min_nr, and then clears it when it is taken again.
+	 * Otherwise the page goes back to buddy and the refill worker
+	 * brings in zeroed ones.
+	 */
+	if (pool->flags & MEMPOOL_ZERO_BS) {
+		if (atomic_read(&pool->reserved) >= pool->min_nr) {
+			pool->free(element, pool->pool_data);
+			mempool_kick_refill_bs(pool);
 			return;
 		}
-		spin_unlock_irqrestore(&pool->lock, flags);
+		((struct page_bs *)element)->private = MEMPOOL_PAGE_DIRTY_BS;
 	}
-	pool->free(element, pool->pool_data);
+
+	if (!mempool_add_reserve_bs(pool, element))
+		pool->free(element, pool->pool_data);
 }
 EXPORT_SYMBOL_GPL(mempool_free_bs);
 
@@ -282,3 +705,123 @@ void mempool_free_slab_bs(void *element, void *pool_data)
 	kmem_cache_free_bs(mem, element);
 }
 EXPORT_SYMBOL_GPL(mempool_free_slab_bs);
+
+void *mempool_alloc_pages_bs(unsigned int __nocast gfp_mask, void *pool_data)
+{
+	int order = (long)pool_data;
+	return alloc_pages_bs(gfp_mask, order);
+}
+EXPORT_SYMBOL_GPL(mempool_alloc_pages_bs);
+
+void mempool_free_pages_bs(void *element, void *pool_data)
+{
+	int order = (long)pool_data;
+
+	((struct page_bs *)element)->private = 0;
+	__free_pages_bs(element, order);
+}
+EXPORT_SYMBOL_GPL(mempool_free_pages_bs);
+
+/**
+ * mempool_create_page_pool - create a pool of buddy pages
+ * @min_nr:    the minimum number of elements guaranteed to be
+ *             allocated for this pool.
+ * @order:     order of each element, mempool_alloc() returns the
+ *             struct page of a 2^order block.
+ * @high_nr:   reserve-first high-water mark, see mempool_create_reserve().
+ * @flags:     MEMPOOL_* flags. With MEMPOOL_ZERO every element handed
+ *             out is zeroed; the reserve is cleared when it is refilled,
+ *             so a reserve hit only clears memory inline for a page
+ *             that mempool_free() put back. Zeroing pools never hand
+ *             out highmem pages.
+ *
+ * The background refill of a reserve-first page pool takes several
+ * elements at once from a single higher order buddy allocation.
+ */
+mempool_t_bs *mempool_create_page_pool_bs(int min_nr, int order, int high_nr,
+						unsigned int flags)
+{
+	BUG_ON_BS(order < 0 || order >= MAX_ORDER_BS);
+	return __mempool_create_bs(min_nr, high_nr,
+			mempool_alloc_pages_bs, mempool_free_pages_bs,
+			(void *)(long)order, flags | MEMPOOL_PAGES_BS,
+			__builtin_return_address(0));
+}
+EXPORT_SYMBOL_GPL(mempool_create_page_pool_bs);
+
+static void *mempool_start_bs(struct seq_file *m, loff_t *pos)
+{
+	loff_t n = *pos;
+	struct list_head *p;
+
+	mutex_lock(&mempool_chain_mutex_bs);
+	if (!n) {
+		/*
+		 * Output format version, so at least we can change it
+		 * without _too_ many complaints.
+		 */
+		seq_puts(m, "mempoolinfo - version: 1.0\n");
+		seq_puts(m, "# pool       creator                          "
+			    "<min> <high> <reserved> <low>");
+		seq_puts(m, " : stats <alloc_hit> <reserve_hit> "
+			    "<reserve_miss> <wait> <wait_us> <max_wait_us>");
+		seq_putc(m, '\n');
+	}
+	p = mempool_chain_bs.next;
+	while (n-- && p != &mempool_chain_bs)
+		p = p->next;
+	/* no pools, or past the last one */
+	if (p == &mempool_chain_bs)
+		return NULL;
+	return list_entry(p, mempool_t_bs, list);
+}
+
+static void *mempool_next_bs(struct seq_file *m, void *p, loff_t *pos)
+{
+	mempool_t_bs *pool = p;
+
+	++*pos;
+	return pool->list.next == &mempool_chain_bs ? NULL :
+		list_entry(pool->list.next, mempool_t_bs, list);
+}
+
+static void mempool_stop_bs(struct seq_file *m, void *p)
+{
+	mutex_unlock(&mempool_chain_mutex_bs);
+}
+
+static int mempool_show_bs(struct seq_file *m, void *p)
+{
+	mempool_t_bs *pool = p;
+	struct mempool_stats_bs sum;
+	int cpu;
+
+	memset(&sum, 0, sizeof(sum));
+	for (cpu = 0; cpu < NR_CPUS_BS; cpu++) {
+		struct mempool_stats_bs *st = &pool->stats[cpu];
+
+		sum.alloc_hit    += st->alloc_hit;
+		sum.reserve_hit  += st->reserve_hit;
+		sum.reserve_miss += st->reserve_miss;
+		sum.wait         += st->wait;
+		sum.wait_us      += st->wait_us;
+	}
+
+	seq_printf(m, "%p %-32ps %5d %6d %10d %5d",
+			pool, pool->caller, pool->min_nr, pool->high_nr,
+			atomic_read(&pool->reserved), pool->low_nr);
+	seq_printf(m, " : stats %11lu %13lu %14lu %6lu %9lu %13lu\n",
+			sum.alloc_hit, sum.reserve_hit, sum.reserve_miss,
+			sum.wait, sum.wait_us, pool->max_wait_us);
+	return 0;
+}
+
+/*
+ * mempoolinfo_op - iterator that generates /proc/mempoolinfo_bs
+ */
+struct seq_operations mempoolinfo_op_bs = {
+	.start	= mempool_start_bs,
+	.next	= mempool_next_bs,
+	.stop	= mempool_stop_bs,
+	.show	= mempool_show_bs,
+};
@@ -11,6 +11,9 @@
 #include <linux/sched.h>
 #include <linux/smp.h>
 #include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "biscuitos/kernel.h"
 #include "biscuitos/nodemask.h"
 #include "biscuitos/mmzone.h"
@@ -26,6 +29,8 @@
 #include "biscuitos/highmem.h"
 #include "biscuitos/swap.h"
 #include "biscuitos/pagevec.h"
+#include "biscuitos/compaction.h"
+#include "biscuitos/memblock.h"
 #include "asm-generated/percpu.h"
 
 nodemask_t_bs node_online_map_bs = { { [0] = 1UL } };
@@ -68,6 +73,11 @@ unsigned long totalhigh_pages_bs;
 
 static char *zone_names_bs[MAX_NR_ZONES_BS] = { "DMA", "Normal", "HighMem" };
 int min_free_kbytes_bs = 1024;
+/*
+ * Cap on zone->watermark_boost, in units of 1/10000th of pages_high.
+ * Zero disables boosting.
+ */
+int watermark_boost_factor_bs = 15000;
 
 static void __init calculate_zone_totalpages_bs(struct pglist_data_bs *pgdat,
 	unsigned long *zones_size, unsigned long *zholes_size)
@@ -90,14 +100,18 @@ static void __init calculate_zone_totalpages_bs(struct pglist_data_bs *pgdat,
 
 static void __init alloc_node_mem_map_bs(struct pglist_data_bs *pgdat)
 {
-	unsigned long size;
+	BUILD_BUG_ON(sizeof(struct page_bs) >
+			STRUCT_PAGE_MAX_WORDS_BS * sizeof(unsigned long));
 
 	/* Skip empty nodes */
 	if (!pgdat->node_spanned_pages)
 		return;
 
+#ifndef CONFIG_SPARSEMEM_BS
 	/* ia64 gets its own node_mem_map, before this, without bootmem */
 	if (!pgdat->node_mem_map) {
+		unsigned long size;
+
 		size = (pgdat->node_spanned_pages + 1) * sizeof(struct page_bs);
 		pgdat->node_mem_map = alloc_bootmem_node_bs(pgdat, size);
 	}
@@ -108,6 +122,7 @@ static void __init alloc_node_mem_map_bs(struct pglist_data_bs *pgdat)
 	if (pgdat == NODE_DATA_BS(0))
 		mem_map_bs = NODE_DATA_BS(0)->node_mem_map;
 #endif
+#endif /* !CONFIG_SPARSEMEM_BS: sparse_init() maps each section */
 }
 
 #ifdef CONFIG_NUMA
@@ -142,8 +157,8 @@ void __get_zone_counts_bs(unsigned long *active, unsigned long *inactive,
 	*free = 0;
 
 	for (i = 0; i < MAX_NR_ZONES_BS; i++) {
-		*active += zones[i].nr_active;
-		*inactive += zones[i].nr_inactive;
+		*active += zone_nr_active_bs(&zones[i]);
+		*inactive += zone_nr_inactive_bs(&zones[i]);
 		*free += zones[i].free_pages;
 	}
 }
@@ -215,10 +230,10 @@ void show_free_areas_bs(void)
 			pageset = zone->pageset + cpu;
 
 			for (temperature = 0; temperature < 2; temperature++)
-				printk("cpu %d %s: low %d, high %d, batch %d\n",
+				printk("cpu %d %s: count %d, high %d, batch %d\n",
 					cpu,
 					temperature ? "cold" : "hot",
-					pageset->pcp[temperature].low,
+					pageset->pcp[temperature].count,
 					pageset->pcp[temperature].high,
 					pageset->pcp[temperature].batch);
 		}
@@ -251,6 +266,7 @@ void show_free_areas_bs(void)
 			" min:%lukB"
 			" low:%lukB"
 			" high:%lukB"
+			" boost:%lukB"
 			" active:%lukB"
 			" inactive:%lukB"
 			" present:%lukB"
@@ -262,10 +278,11 @@ void show_free_areas_bs(void)
 			K_BS(zone->pages_min),
 			K_BS(zone->pages_low),
 			K_BS(zone->pages_high),
-			K_BS(zone->nr_active),
-			K_BS(zone->nr_inactive),
+			K_BS(zone->watermark_boost),
+			K_BS(zone_nr_active_bs(zone)),
+			K_BS(zone_nr_inactive_bs(zone)),
 			K_BS(zone->present_pages),
-			zone->pages_scanned,
+			(unsigned long)atomic_long_read(&zone->pages_scanned),
 			(zone->all_unreclaimable ? "yes" : "no")
 			);
 		printk("lomem_reserve[]:");
@@ -337,33 +354,194 @@ static inline unsigned long wait_table_bits_bs(unsigned long size)
 	return ffz(~size);
 }
 
+static void __init_single_page_bs(struct page_bs *page, unsigned long pfn,
+					unsigned long zone, int nid)
+{
+	set_page_links_bs(page, zone, nid, pfn);
+	set_page_count_bs(page, 0);
+	reset_page_mapcount_bs(page);
+	SetPageReserved_bs(page);
+	INIT_LIST_HEAD(&page->lru);
+#ifdef WAIT_PAGE_VIRTUAL
+	/* This shift won't overflow because ZONE_NORMAL is below 4G. */
+	if (!is_highmem_idx_bs(zone))
+		set_page_address_bs(page, __va_bs(pfn << PAGE_SHIFT_BS));
+#endif
+}
+
 /*
  * Initially all pages are reserved - free ones are freed
  * up by free_all_bootmem() once the early boot process is
  * done. Non-atomic initialization, single-pass.
+ *
+ * With CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS we stop at the node's
+ * first_deferred_pfn, the rest is left to deferred_init_memmap().
  */
 void __init memmap_init_zone_bs(unsigned long size, int nid, 
 			unsigned long zone, unsigned long start_pfn)
 {
-	struct page_bs *start = pfn_to_page_bs(start_pfn);
-	struct page_bs *page;
+	unsigned long end_pfn = start_pfn + size;
+	unsigned long pfn;
 
-	for (page = start; page < (start + size); page++) {
-		set_page_zone_bs(page, NODEZONE_BS(nid, zone));
-		set_page_count_bs(page, 0);
-		reset_page_mapcount_bs(page);
-		SetPageReserved_bs(page);
-		INIT_LIST_HEAD(&page->lru);
-#ifdef WAIT_PAGE_VIRTUAL
-		/* This shift won't overflow because ZONE_NORMAL is below 4G. */
-		if (!is_highmem_idx_bs(zone))
-			set_page_address_bs(page, 
-					__va_bs(start << PAGE_SHIFT_BS));
+	end_pfn = min(end_pfn,
+			pgdat_first_deferred_pfn_bs(NODE_DATA_BS(nid)));
+	for (pfn = start_pfn; pfn < end_pfn; pfn++) {
+		/* Sections in a hole between banks have no mem_map */
+		if (!early_pfn_valid_bs(pfn))
+			continue;
+		__init_single_page_bs(pfn_to_page_bs(pfn), pfn, zone, nid);
+	}
+}
+
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+/*
+ * Boot only has to get as far as the slab caches and the first user of
+ * each allocator, so ZONE_DMA and this much of ZONE_NORMAL is set up
+ * before mem_init().  Everything above is handed out in chunks of
+ * DEFERRED_CHUNK_PAGES_BS, one work item each.
+ */
+#define DEFERRED_INIT_MIN_PAGES_BS	(32UL << (20 - PAGE_SHIFT_BS))
+#ifdef CONFIG_SPARSEMEM_BS
+#define DEFERRED_CHUNK_PAGES_BS		PAGES_PER_SECTION_BS
+#else
+#define DEFERRED_CHUNK_PAGES_BS		(1UL << (26 - PAGE_SHIFT_BS))
 #endif
-		start_pfn++;
+#define DEFERRED_MAX_CHUNKS_BS		(1UL << (32 - 26))
+
+struct deferred_chunk_bs {
+	struct work_struct work;
+	pg_data_t_bs *pgdat;
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	unsigned long nr_free;
+};
+
+static struct deferred_chunk_bs deferred_chunks_bs[DEFERRED_MAX_CHUNKS_BS];
+static unsigned int nr_deferred_chunks_bs;
+static u64 deferred_start_ns_bs;
+
+static unsigned long __init
+deferred_first_pfn_bs(pg_data_t_bs *pgdat, unsigned long normal_start_pfn)
+{
+	unsigned long offset;
+
+	offset = normal_start_pfn + DEFERRED_INIT_MIN_PAGES_BS -
+						pgdat->node_start_pfn;
+	return pgdat->node_start_pfn + ALIGN(offset, DEFERRED_CHUNK_PAGES_BS);
+}
+
+static int pfn_to_zone_idx_bs(pg_data_t_bs *pgdat, unsigned long pfn)
+{
+	int j;
+
+	for (j = 0; j < MAX_NR_ZONES_BS; j++) {
+		struct zone_bs *zone = pgdat->node_zones + j;
+
+		if (pfn >= zone->zone_start_pfn &&
+		    pfn < zone->zone_start_pfn + zone->spanned_pages)
+			return j;
+	}
+	return -1;
+}
+
+/*
+ * free_all_bootmem() calls this for every page above first_deferred_pfn
+ * that bootmem still holds, so whoever owns it (the CMA areas, a mem_map
+ * section, a boot-time table) finds a valid, reserved struct page.
+ */
+void __init init_reserved_page_bs(unsigned long pfn)
+{
+	pg_data_t_bs *pgdat = NODE_DATA_BS(0);
+	int zone = pfn_to_zone_idx_bs(pgdat, pfn);
+
+	if (zone < 0 || !early_pfn_valid_bs(pfn))
+		return;
+	__init_single_page_bs(pfn_to_page_bs(pfn), pfn, zone,
+							pgdat->node_id);
+}
+
+/*
+ * Set up the struct pages of one chunk, then release those bootmem left
+ * free the same way free_all_bootmem() does.  Chunks never share a
+ * page, so only the buddy free path locks.
+ */
+static void deferred_init_chunk_bs(struct work_struct *work)
+{
+	struct deferred_chunk_bs *dc =
+			container_of(work, struct deferred_chunk_bs, work);
+	pg_data_t_bs *pgdat = dc->pgdat;
+	unsigned long start, end, pfn;
+	u64 i;
+
+	/* Reserved pages were already set up by init_reserved_page() */
+	for_each_free_mem_range_bs(i, &start, &end) {
+		unsigned long epfn = min(end >> PAGE_SHIFT_BS, dc->end_pfn);
+
+		pfn = max((start + PAGE_SIZE_BS - 1) >> PAGE_SHIFT_BS,
+							dc->start_pfn);
+		for (; pfn < epfn; pfn++) {
+			int zone = pfn_to_zone_idx_bs(pgdat, pfn);
+
+			if (zone < 0 || !early_pfn_valid_bs(pfn))
+				continue;
+			__init_single_page_bs(pfn_to_page_bs(pfn), pfn, zone,
+							pgdat->node_id);
+		}
+	}
+	dc->nr_free = free_bootmem_range_bs(pgdat, dc->start_pfn, dc->end_pfn);
+}
+
+/*
+ * Queue the deferred part of every node, mem_init() calls this right
+ * after free_all_bootmem() has released the part boot runs on.
+ */
+void __init deferred_init_memmap_bs(void)
+{
+	pg_data_t_bs *pgdat;
+
+	deferred_start_ns_bs = ktime_get_ns();
+	for_each_pgdat_bs(pgdat) {
+		unsigned long pfn = pgdat->first_deferred_pfn;
+		unsigned long end_pfn = pgdat->node_start_pfn +
+					pgdat->node_spanned_pages;
+
+		for (; pfn < end_pfn; pfn += DEFERRED_CHUNK_PAGES_BS) {
+			struct deferred_chunk_bs *dc;
+
+			if (nr_deferred_chunks_bs == DEFERRED_MAX_CHUNKS_BS)
+				BUG_BS();
+			dc = &deferred_chunks_bs[nr_deferred_chunks_bs++];
+			dc->pgdat = pgdat;
+			dc->start_pfn = pfn;
+			dc->end_pfn = min(pfn + DEFERRED_CHUNK_PAGES_BS, end_pfn);
+			dc->nr_free = 0;
+			INIT_WORK(&dc->work, deferred_init_chunk_bs);
+			queue_work(system_unbound_wq, &dc->work);
+		}
 	}
 }
 
+/*
+ * Wait for the deferred chunks.  Runs once the rest of start_kernel()
+ * is done.
+ */
+void __init page_alloc_init_late_bs(void)
+{
+	unsigned long nr_free = 0;
+	unsigned int i;
+
+	for (i = 0; i < nr_deferred_chunks_bs; i++) {
+		flush_work(&deferred_chunks_bs[i].work);
+		nr_free += deferred_chunks_bs[i].nr_free;
+	}
+	totalram_pages_bs += nr_free;
+
+	printk(KERN_INFO "Deferred init: %u chunks, %luKB in %lluus\n",
+		nr_deferred_chunks_bs, nr_free << (PAGE_SHIFT_BS - 10),
+		div_u64(ktime_get_ns() - deferred_start_ns_bs, 1000));
+}
+#endif /* CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS */
+
 #ifndef __HAVE_ARCH_MEMMAP_INIT
 #define memmap_init_bs(size, nid, zone, start_pfn) \
 	memmap_init_zone_bs((size), (nid), (zone), (start_pfn))
@@ -372,10 +550,11 @@ void __init memmap_init_zone_bs(unsigned long size, int nid,
 void zone_init_free_lists_bs(struct pglist_data_bs *pgdat, 
 			struct zone_bs *zone, unsigned long size)
 {
-	int order;
+	int order, t;
 
 	for (order = 0; order < MAX_ORDER_BS; order++) {
-		INIT_LIST_HEAD(&zone->free_area[order].free_list);
+		for (t = 0; t < MIGRATE_TYPES_BS; t++)
+			INIT_LIST_HEAD(&zone->free_area[order].free_list[t]);
 		zone->free_area[order].nr_free = 0;
 	}
 }
@@ -397,6 +576,9 @@ static void __init free_area_init_core_bs(struct pglist_data_bs *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+	pgdat->first_deferred_pfn = ~0UL;
+#endif
 
 	for (j = 0; j < MAX_NR_ZONES_BS; j++) {
 		struct zone_bs *zone = pgdat->node_zones + j;
@@ -416,7 +598,6 @@ static void __init free_area_init_core_bs(struct pglist_data_bs *pgdat,
 		zone->present_pages = realsize;
 		zone->name = zone_names_bs[j];
 		spin_lock_init(&zone->lock);
-		spin_lock_init(&zone->lru_lock);
 		zone->zone_pgdat = pgdat;
 		zone->free_pages = 0;
 
@@ -453,25 +634,41 @@ static void __init free_area_init_core_bs(struct pglist_data_bs *pgdat,
 
 			pcp = &zone->pageset[cpu].pcp[0];	/* hot */
 			pcp->count = 0;
-			pcp->low = 2 * batch;
 			pcp->high = 6 * batch;
 			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
+			for (i = 0; i < MIGRATE_PCPTYPES_BS; i++)
+				INIT_LIST_HEAD(&pcp->lists[i]);
 
 			pcp = &zone->pageset[cpu].pcp[1];	/* cold */
 			pcp->count = 0;
-			pcp->low = 0;
 			pcp->high = 2 * batch;
 			pcp->batch = 1 * batch;
-			INIT_LIST_HEAD(&pcp->list);
+			for (i = 0; i < MIGRATE_PCPTYPES_BS; i++)
+				INIT_LIST_HEAD(&pcp->lists[i]);
 		}
 		printk(KERN_DEBUG "  %s zone: %lu pages, LIFO batch:%lu\n",
 				zone_names_bs[j], realsize, batch);
-		INIT_LIST_HEAD(&zone->active_list);
-		INIT_LIST_HEAD(&zone->inactive_list);
+		for (i = 0; i < NR_LRU_SUBLISTS_BS; i++) {
+			struct lru_sublist_bs *lru = &zone->lru[i];
+
+			spin_lock_init(&lru->lock);
+			INIT_LIST_HEAD(&lru->active_list);
+			INIT_LIST_HEAD(&lru->inactive_list);
+			lru->nr_active = 0;
+			lru->nr_inactive = 0;
+#ifdef CONFIG_LRU_GEN_BS
+			lru_gen_init_sublist_bs(lru);
+#endif
+		}
 		zone->nr_scan_active = 0;
 		zone->nr_scan_inactive = 0;
-		zone->nr_inactive = 0;
+		zone->watermark_boost = 0;
+		zone->compact_stall = 0;
+		zone->compact_success = 0;
+		zone->compact_migrated = 0;
+		zone->compact_considered = 0;
+		zone->compact_defer_shift = 0;
+		zone->compact_order_failed = 0;
 		if (!size)
 			continue;
 
@@ -489,6 +686,15 @@ static void __init free_area_init_core_bs(struct pglist_data_bs *pgdat,
 		for (i = 0; i < zone->wait_table_size; ++i)
 			init_waitqueue_head(zone->wait_table + i);
 
+		/*
+		 * Every pageblock starts out movable, it is only handed
+		 * to another type when that type runs out of free pages.
+		 */
+		i = (size + pageblock_nr_pages_bs - 1) >> pageblock_order_bs;
+		zone->pageblock_migratetype = (unsigned char *)
+			alloc_bootmem_node_bs(pgdat, i);
+		memset(zone->pageblock_migratetype, MIGRATE_MOVABLE_BS, i);
+
 		pgdat->nr_zones = j+1;
 
 		zone->zone_mem_map = pfn_to_page_bs(zone_start_pfn);
@@ -497,6 +703,11 @@ static void __init free_area_init_core_bs(struct pglist_data_bs *pgdat,
 		if ((zone_start_pfn) & (zone_required_alignment-1))
 			printk(KERN_CRIT "BUG: wrong zone alignment, it will "
 					"crash\n");
+#ifdef CONFIG_DEFERRED_STRUCT_PAGE_INIT_BS
+		if (j == ZONE_NORMAL_BS)
+			pgdat->first_deferred_pfn =
+				deferred_first_pfn_bs(pgdat, zone_start_pfn);
+#endif
 		memmap_init_bs(size, nid, j, zone_start_pfn);
 
 		zone_start_pfn += size;
@@ -618,6 +829,21 @@ void set_page_refs_bs(struct page_bs *page, int order)
 #endif
 }
 
+/*
+ * Hand a naturally aligned block from bootmem to the buddy allocator.
+ * It goes in at its own order and only merges if its buddy is already
+ * free.
+ */
+void __free_pages_bootmem_bs(struct page_bs *page, unsigned int order)
+{
+	unsigned long i;
+
+	for (i = 0; i < (1UL << order); i++)
+		__ClearPageReserved_bs(page + i);
+	set_page_refs_bs(page, order);
+	__free_pages_bs(page, order);
+}
+
 /*
  * Temporary debugging check for pages not lying within a given zone.
  */
@@ -815,6 +1041,7 @@ static inline void __free_pages_bulk_bs(struct page_bs *page,
 {
 	unsigned long page_idx;
 	int order_size = 1 << order;
+	int migratetype = get_pageblock_migratetype_bs(page);
 
 	if (unlikely(order))
 		destroy_compound_page_bs(page, order);
@@ -846,10 +1073,40 @@ static inline void __free_pages_bulk_bs(struct page_bs *page,
 		order++;
 	}
 	set_page_order_bs(page, order);
-	list_add(&page->lru, &zone->free_area[order].free_list);
+	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
 	zone->free_area[order].nr_free++;
 }
 
+/*
+ * Take the free block headed by @page out of the buddy allocator and
+ * split it into order-0 pages holding one reference each, for compaction
+ * to migrate into.  Blocks of @max_order and up are left alone: breaking
+ * them would undo the work.  Returns the number of pages taken, 0 if
+ * @page does not head a suitable free block.
+ *
+ * Call me with the zone->lock already held.
+ */
+unsigned long isolate_free_block_bs(struct zone_bs *zone,
+				struct page_bs *page, int max_order)
+{
+	unsigned long order, i;
+
+	if (!PagePrivate_bs(page))
+		return 0;
+	order = page_order_bs(page);
+	if (order >= max_order || !page_is_buddy_bs(page, order))
+		return 0;
+
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order_bs(page);
+	zone->free_pages -= 1UL << order;
+
+	for (i = 0; i < (1UL << order); i++)
+		set_page_count_bs(page + i, 1);
+	return 1UL << order;
+}
+
 /*
  * Frees a list of pages. 
  * Assumes all pages on list are in same zone, and of same order.
@@ -871,7 +1128,7 @@ free_pages_bulk_bs(struct zone_bs *zone, int count,
 
 	spin_lock_irqsave(&zone->lock, flags);
 	zone->all_unreclaimable = 0;
-	zone->pages_scanned = 0; 
+	atomic_long_set(&zone->pages_scanned, 0);
 	while (!list_empty(list) && count--) {
 		page = list_entry(list->prev, struct page_bs, lru);
 		/* have to delete it as _free_pages_bulk_bs list manipulates */
@@ -883,6 +1140,33 @@ free_pages_bulk_bs(struct zone_bs *zone, int count,
 	return ret;
 }
 
+/*
+ * Free up to @count pages from the per-cpu lists, taking one page from
+ * each migrate type in turn so that no type is drained before the rest.
+ */
+static int free_pcppages_bulk_bs(struct zone_bs *zone, int count,
+					struct per_cpu_pages_bs *pcp)
+{
+	LIST_HEAD(list);
+	int migratetype = 0, empty = 0, nr = 0;
+
+	while (nr < count && empty < MIGRATE_PCPTYPES_BS) {
+		struct list_head *l = &pcp->lists[migratetype];
+
+		if (++migratetype == MIGRATE_PCPTYPES_BS)
+			migratetype = 0;
+		if (list_empty(l)) {
+			empty++;
+			continue;
+		}
+		empty = 0;
+		/* The tail is the coldest page */
+		list_move(l->prev, &list);
+		nr++;
+	}
+	return free_pages_bulk_bs(zone, nr, &list, 0);
+}
+
 void __free_pages_ok_bs(struct page_bs *page, unsigned int order)
 {
 	LIST_HEAD(list);
@@ -916,12 +1200,26 @@ static void fastcall_bs free_hot_cold_page_bs(struct page_bs *page, int cold)
 	if (PageAnon_bs(page))
 		page->mapping = NULL;
 	free_pages_check_bs(__FUNCTION__, page);
+	/*
+	 * Remember which lists the page may be handed out to again.  CMA
+	 * pages serve movable requests.
+	 */
+	page->private = get_pageblock_migratetype_bs(page);
+	if (page->private == MIGRATE_CMA_BS)
+		page->private = MIGRATE_MOVABLE_BS;
+	/* An isolated block is being taken: hand the page straight back */
+	if (unlikely(page->private >= MIGRATE_PCPTYPES_BS)) {
+		LIST_HEAD(list);
+
+		list_add(&page->lru, &list);
+		free_pages_bulk_bs(zone, 1, &list, 0);
+		return;
+	}
 	pcp = &zone->pageset[get_cpu()].pcp[cold];
 	local_irq_save(flags);
 	if (pcp->count >= pcp->high)
-		pcp->count -= free_pages_bulk_bs(zone, pcp->batch, 
-							&pcp->list, 0);
-	list_add(&page->lru, &pcp->list);
+		pcp->count -= free_pcppages_bulk_bs(zone, pcp->batch, pcp);
+	list_add(&page->lru, &pcp->lists[page->private]);
 	pcp->count++;
 	local_irq_restore(flags);
 	put_cpu();
@@ -932,6 +1230,44 @@ void fastcall_bs free_hot_page_bs(struct page_bs *page)
 	free_hot_cold_page_bs(page, 0);
 }
 
+/*
+ * Spill the calling CPU's per-cpu pages back into the buddy lists, where
+ * they can merge with their buddies again.
+ */
+void drain_local_pages_bs(void)
+{
+	struct zone_bs *zone;
+	unsigned long flags;
+	int cpu, i;
+
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	for_each_zone_bs(zone) {
+		struct per_cpu_pageset_bs *pset = &zone->pageset[cpu];
+
+		for (i = 0; i < ARRAY_SIZE(pset->pcp); i++) {
+			struct per_cpu_pages_bs *pcp = &pset->pcp[i];
+
+			pcp->count -= free_pcppages_bulk_bs(zone, pcp->count,
+									pcp);
+		}
+	}
+	local_irq_restore(flags);
+}
+
+static void drain_local_pages_ipi_bs(void *arg)
+{
+	drain_local_pages_bs();
+}
+
+/*
+ * Spill the per-cpu pages of every CPU back into the buddy lists.
+ */
+void drain_all_pages_bs(void)
+{
+	on_each_cpu(drain_local_pages_ipi_bs, NULL, 1);
+}
+
 void __free_pages_bs(struct page_bs *page, unsigned int order)
 {
 	if (!PageReserved_bs(page) && put_page_testzero_bs(page)) {
@@ -991,6 +1327,26 @@ int zone_watermark_ok_bs(struct zone_bs *z, int order, unsigned long mark,
 }
 EXPORT_SYMBOL_GPL(zone_watermark_ok_bs);
 
+/*
+ * An allocation against this zone had to go to direct reclaim, or failed
+ * to find a free block of the order it wanted although enough pages were
+ * free.  Raise kswapd's target for the zone by the size of the request,
+ * at least a reclaim batch, so that repeated events push kswapd further
+ * ahead of the allocators.  The update is racy but only ever a hint.
+ */
+void boost_watermark_bs(struct zone_bs *zone, int order)
+{
+	unsigned long max_boost, boost;
+
+	if (!watermark_boost_factor_bs || zone->present_pages == 0)
+		return;
+
+	max_boost = (zone->pages_high * watermark_boost_factor_bs) / 10000;
+	boost = zone->watermark_boost +
+			max(1UL << order, (unsigned long)SWAP_CLUSTER_MAX_BS);
+	zone->watermark_boost = min(boost, max_boost);
+}
+
 /*
  * The order of subdivision here is critical for the IO subsystem.
  * Please do not alter this order without good reasons and regression
@@ -1007,7 +1363,7 @@ EXPORT_SYMBOL_GPL(zone_watermark_ok_bs);
  */
 static inline struct page_bs *
 expand_bs(struct zone_bs *zone, struct page_bs *page,
-		int low, int high, struct free_area_bs *area)
+		int low, int high, struct free_area_bs *area, int migratetype)
 {
 	unsigned long size = 1 << high;
 
@@ -1016,18 +1372,19 @@ expand_bs(struct zone_bs *zone, struct page_bs *page,
 		high--;
 		size >>= 1;
 		BUG_ON_BS(bad_range_bs(zone, &page[size]));
-		list_add(&page[size].lru, &area->free_list);
+		list_add(&page[size].lru, &area->free_list[migratetype]);
 		area->nr_free++;
 		set_page_order_bs(&page[size], high);
 	}
 	return page;
 }
 
-/* 
- * Do the hard work of removing an element from the buddy allocator.
- * Call me with the zone->lock already held.
+/*
+ * Take the smallest free block of at least @order from the lists of
+ * @migratetype.
  */
-static struct page_bs *__rmqueue_bs(struct zone_bs *zone, unsigned int order)
+static struct page_bs *__rmqueue_smallest_bs(struct zone_bs *zone,
+				unsigned int order, int migratetype)
 {
 	struct free_area_bs *area;
 	unsigned int current_order;
@@ -1036,26 +1393,186 @@ static struct page_bs *__rmqueue_bs(struct zone_bs *zone, unsigned int order)
 	for (current_order = order; current_order < MAX_ORDER_BS; 
 							++current_order) {
 		area = zone->free_area + current_order;
-		if (list_empty(&area->free_list))
+		if (list_empty(&area->free_list[migratetype]))
 			continue;
 
-		page = list_entry(area->free_list.next, struct page_bs, lru);
+		page = list_entry(area->free_list[migratetype].next,
+							struct page_bs, lru);
 		list_del(&page->lru);
 		rmv_page_order_bs(page);
 		area->nr_free--;
 		zone->free_pages -= 1UL << order;
-		return expand_bs(zone, page, order, current_order, area);
+		return expand_bs(zone, page, order, current_order, area,
+							migratetype);
 	}
 	return NULL;
 }
 
+/*
+ * The lists to fall back on, in order, when a migrate type has run dry.
+ * CMA and isolated pageblocks are never stolen.
+ */
+static const int fallbacks_bs[MIGRATE_TYPES_BS][3] = {
+	[MIGRATE_UNMOVABLE_BS]   = { MIGRATE_RECLAIMABLE_BS, MIGRATE_MOVABLE_BS,
+							MIGRATE_TYPES_BS },
+	[MIGRATE_RECLAIMABLE_BS] = { MIGRATE_UNMOVABLE_BS, MIGRATE_MOVABLE_BS,
+							MIGRATE_TYPES_BS },
+	[MIGRATE_MOVABLE_BS]     = { MIGRATE_RECLAIMABLE_BS, MIGRATE_UNMOVABLE_BS,
+							MIGRATE_TYPES_BS },
+	[MIGRATE_CMA_BS]         = { MIGRATE_TYPES_BS },
+	[MIGRATE_ISOLATE_BS]     = { MIGRATE_TYPES_BS },
+};
+
+/*
+ * Move the free blocks of the pageblock holding @page over to the lists
+ * of @migratetype.  Returns the number of pages moved.
+ *
+ * Call me with the zone->lock already held.
+ */
+static unsigned long move_freepages_block_bs(struct zone_bs *zone,
+				struct page_bs *page, int migratetype)
+{
+	unsigned long pfn, end_pfn, moved = 0;
+
+	pfn = page_to_pfn_bs(page) & ~(pageblock_nr_pages_bs - 1);
+	end_pfn = min(pfn + pageblock_nr_pages_bs,
+			zone->zone_start_pfn + zone->spanned_pages);
+	/* The block may start in the zone below */
+	pfn = max(pfn, zone->zone_start_pfn);
+
+	while (pfn < end_pfn) {
+		struct page_bs *p = pfn_to_page_bs(pfn);
+		unsigned long order;
+
+		if (!PagePrivate_bs(p) || !page_is_buddy_bs(p,
+						page_order_bs(p))) {
+			pfn++;
+			continue;
+		}
+		order = page_order_bs(p);
+		list_move(&p->lru,
+			&zone->free_area[order].free_list[migratetype]);
+		pfn += 1UL << order;
+		moved += 1UL << order;
+	}
+	return moved;
+}
+
+/*
+ * Borrow a block from another migrate type.  The largest block is taken
+ * so that the foreign pages are clustered in as few pageblocks as
+ * possible, and when the block is big enough the rest of its pageblock
+ * comes along too, so that later allocations of this type are served
+ * from the same place.  The pageblock changes owner once most of it is
+ * ours.
+ *
+ * Call me with the zone->lock already held.
+ */
+static struct page_bs *__rmqueue_fallback_bs(struct zone_bs *zone,
+				int order, int start_migratetype)
+{
+	struct free_area_bs *area;
+	struct page_bs *page;
+	int current_order, migratetype, i;
+
+	for (current_order = MAX_ORDER_BS - 1; current_order >= order;
+							--current_order) {
+		area = zone->free_area + current_order;
+		for (i = 0; (migratetype = fallbacks_bs[start_migratetype][i])
+						!= MIGRATE_TYPES_BS; i++) {
+			if (list_empty(&area->free_list[migratetype]))
+				continue;
+
+			page = list_entry(area->free_list[migratetype].next,
+							struct page_bs, lru);
+			if (current_order >= pageblock_order_bs / 2 ||
+			    start_migratetype == MIGRATE_RECLAIMABLE_BS) {
+				unsigned long moved;
+
+				moved = move_freepages_block_bs(zone, page,
+							start_migratetype);
+				if (moved >= pageblock_nr_pages_bs / 2)
+					set_pageblock_migratetype_bs(page,
+							start_migratetype);
+			}
+			list_del(&page->lru);
+			rmv_page_order_bs(page);
+			area->nr_free--;
+			zone->free_pages -= 1UL << order;
+			return expand_bs(zone, page, order, current_order,
+						area, start_migratetype);
+		}
+	}
+	return NULL;
+}
+
+/* 
+ * Do the hard work of removing an element from the buddy allocator.
+ * Call me with the zone->lock already held.
+ */
+static struct page_bs *__rmqueue_bs(struct zone_bs *zone, unsigned int order,
+						int migratetype)
+{
+	struct page_bs *page;
+
+	page = __rmqueue_smallest_bs(zone, order, migratetype);
+	/* Movable pages borrow from CMA before anyone else */
+	if (unlikely(!page) && migratetype == MIGRATE_MOVABLE_BS)
+		page = __rmqueue_smallest_bs(zone, order, MIGRATE_CMA_BS);
+	if (unlikely(!page))
+		page = __rmqueue_fallback_bs(zone, order, migratetype);
+	return page;
+}
+
+/*
+ * Stop the allocator from handing out the pageblocks spanning
+ * [start_pfn, end_pfn): their free pages go to the isolate lists, and
+ * so do pages freed into them from now on.  Both pfns must be pageblock
+ * aligned.
+ */
+void start_isolate_page_range_bs(struct zone_bs *zone,
+			unsigned long start_pfn, unsigned long end_pfn)
+{
+	unsigned long pfn, flags;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	for (pfn = start_pfn; pfn < end_pfn; pfn += pageblock_nr_pages_bs) {
+		struct page_bs *page = pfn_to_page_bs(pfn);
+
+		set_pageblock_migratetype_bs(page, MIGRATE_ISOLATE_BS);
+		move_freepages_block_bs(zone, page, MIGRATE_ISOLATE_BS);
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+}
+
+/*
+ * Give the pageblocks isolated by start_isolate_page_range() back to
+ * @migratetype, along with whatever free pages they still hold.
+ */
+void undo_isolate_page_range_bs(struct zone_bs *zone, unsigned long start_pfn,
+			unsigned long end_pfn, int migratetype)
+{
+	unsigned long pfn, flags;
+
+	spin_lock_irqsave(&zone->lock, flags);
+	for (pfn = start_pfn; pfn < end_pfn; pfn += pageblock_nr_pages_bs) {
+		struct page_bs *page = pfn_to_page_bs(pfn);
+
+		set_pageblock_migratetype_bs(page, migratetype);
+		move_freepages_block_bs(zone, page, migratetype);
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+}
+
 /* 
  * Obtain a specified number of elements from the buddy allocator, all under
  * a single hold of the lock, for efficiency.  Add them to the supplied list.
- * Returns the number of new pages which were placed at *list.
+ * Returns the number of new pages which were placed at *list.  Each page
+ * records @migratetype in ->private so the per-cpu lists can tell them
+ * apart.
  */
 static int rmqueue_bulk_bs(struct zone_bs *zone, unsigned int order,
-		unsigned long count, struct list_head *list)
+		unsigned long count, struct list_head *list, int migratetype)
 {
 	unsigned long flags;
 	int i;
@@ -1064,9 +1581,10 @@ static int rmqueue_bulk_bs(struct zone_bs *zone, unsigned int order,
 
 	spin_lock_irqsave(&zone->lock, flags);
 	for (i = 0; i < count; ++i) {
-		page = __rmqueue_bs(zone, order);
+		page = __rmqueue_bs(zone, order, migratetype);
 		if (page == NULL)
 			break;
+		page->private = migratetype;
 		allocated++;
 		list_add_tail(&page->lru, list);
 	}
@@ -1110,6 +1628,32 @@ static inline void prep_zero_page_bs(struct page_bs *page, int order,
 		clear_highpage_bs(page + i);
 }
 
+/*
+ * Take the first page off the per-cpu list of @migratetype, refilling
+ * an empty list with at most a batch and never past pcp->high.
+ */
+static struct page_bs *pcp_take_page_bs(struct zone_bs *zone,
+			struct per_cpu_pages_bs *pcp, int migratetype)
+{
+	struct list_head *list = &pcp->lists[migratetype];
+	struct page_bs *page;
+
+	if (list_empty(list)) {
+		int room = min(pcp->batch, pcp->high - pcp->count);
+
+		if (room <= 0)
+			return NULL;
+		pcp->count += rmqueue_bulk_bs(zone, 0, room, list,
+							migratetype);
+		if (list_empty(list))
+			return NULL;
+	}
+	page = list_entry(list->next, struct page_bs, lru);
+	list_del(&page->lru);
+	pcp->count--;
+	return page;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1122,27 +1666,21 @@ buffered_rmqueue_bs(struct zone_bs *zone, int order,
 	unsigned long flags;
 	struct page_bs *page = NULL;
 	int cold = !!(gfp_flags & __GFP_COLD_BS);
+	int migratetype = gfpflags_to_migratetype_bs(gfp_flags);
 
 	if (order == 0) {
 		struct per_cpu_pages_bs *pcp;
 
 		pcp = &zone->pageset[get_cpu()].pcp[cold];
 		local_irq_save(flags);
-		if (pcp->count >= pcp->low)
-			pcp->count += rmqueue_bulk_bs(zone, 0,
-				pcp->batch, &pcp->list);
-		if (pcp->count) {
-			page = list_entry(pcp->list.next, struct page_bs, lru);
-			list_del(&page->lru);
-			pcp->count--;
-		}
+		page = pcp_take_page_bs(zone, pcp, migratetype);
 		local_irq_restore(flags);
 		put_cpu();
 	}
 
 	if (page == NULL) {
 		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue_bs(zone, order);
+		page = __rmqueue_bs(zone, order, migratetype);
 		spin_unlock_irqrestore(&zone->lock, flags);
 	}
 
@@ -1205,8 +1743,16 @@ restart:
 	/* Go through the zonelist once, looking for a zone with enough free */
 	for (i = 0; (z = zones[i]) != NULL; i++) {
 		if (!zone_watermark_ok_bs(z, order, z->pages_low,
+					classzone_idx, 0, 0)) {
+			/*
+			 * Enough free pages but no block big enough:
+			 * the zone is fragmented, make kswapd work harder.
+			 */
+			if (order && zone_watermark_ok_bs(z, 0, z->pages_low,
 					classzone_idx, 0, 0))
+				boost_watermark_bs(z, order);
 			continue;
+		}
 
 		if (wait && !cpuset_zone_allowed_bs(z))
 			continue;
@@ -1261,10 +1807,41 @@ restart:
 		goto nopage;
 	}
 
+	/*
+	 * kswapd did not keep up.  Boost it so that the next allocations
+	 * find the watermarks met and stay off the direct reclaim path.
+	 */
+	for (i = 0; (z = zones[i]) != NULL; i++) {
+		boost_watermark_bs(z, order);
+		wakeup_kswapd_bs(z, order);
+	}
+
 	/* Atomic allocations - we can't balance anything */
 	if (!wait)
 		goto nopage;
 
+	/*
+	 * A high-order request may be short of contiguity rather than of
+	 * free memory.  Try to assemble the block by migration before
+	 * reclaiming anything.
+	 */
+	if (order && try_to_compact_pages_bs(zones, order, gfp_mask) ==
+						COMPACT_PARTIAL_BS) {
+		for (i = 0; (z = zones[i]) != NULL; i++) {
+			if (!zone_watermark_ok_bs(z, order, z->pages_min,
+					classzone_idx, can_try_harder,
+					gfp_mask & __GFP_HIGH_BS))
+				continue;
+
+			if (!cpuset_zone_allowed_bs(z))
+				continue;
+
+			page = buffered_rmqueue_bs(z, order, gfp_mask);
+			if (page)
+				goto got_pg;
+		}
+	}
+
 rebalance:
 	cond_resched();
 
@@ -1475,6 +2052,9 @@ static int frag_show_bs(struct seq_file *m, void *arg)
 		for (order = 0; order < MAX_ORDER_BS; ++order)
 			seq_printf(m, "%6lu ", zone->free_area[order].nr_free);
 		spin_unlock_irqrestore(&zone->lock, flags);
+		seq_printf(m, " compact %lu/%lu migrated %lu",
+				zone->compact_success, zone->compact_stall,
+				zone->compact_migrated);
 		seq_putc(m, '\n');
 	}
 	return 0;
@@ -1601,7 +2181,7 @@ static void setup_per_zone_pages_min_bs(void)
 	}
 
 	for_each_zone_bs(zone) {
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(&zone->lock, flags);
 		if (is_highmem_bs(zone)) {
 			/*
 			 * Often, highmem doesn't need to reserve any pages.
@@ -1631,7 +2211,7 @@ static void setup_per_zone_pages_min_bs(void)
 		 */
 		zone->pages_low = (zone->pages_min * 5) / 4;
 		zone->pages_high = (zone->pages_min * 6) / 4;
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(&zone->lock, flags);
 	}
 }
 
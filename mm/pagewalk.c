@@ -0,0 +1,159 @@
+/*
+ * mm/pagewalk.c
+ *
+ * Generic page table walker.  The pgd/pud/pmd levels are stepped one
+ * entry at a time and an empty entry is skipped as a whole; the pte
+ * level is handed to the caller a table at a time, so vmap, vunmap and
+ * rmap no longer re-walk the upper levels for every page.
+ *
+ * The caller holds whatever lock protects the tables it walks, usually
+ * mm->page_table_lock.  pte_alloc_kernel() may drop and retake it.
+ */
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/mm.h"
+#include "asm-generated/pgtable.h"
+
+static int walk_pte_range_bs(pmd_t_bs *pmd, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	pte_t_bs *pte;
+	int err;
+
+	if (walk->flags & MM_WALK_ALLOC_BS) {
+		pte = pte_alloc_kernel_bs(walk->mm, pmd, addr);
+		if (!pte)
+			return -ENOMEM;
+	} else
+		pte = pte_offset_map_bs(pmd, addr);
+
+	err = walk->pte_entry(pte, addr, end, walk);
+	pte_unmap_bs(pte);
+	return err;
+}
+
+static int walk_pmd_range_bs(pud_t_bs *pud, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	pmd_t_bs *pmd;
+	unsigned long next;
+	int err = 0;
+
+	if (walk->flags & MM_WALK_ALLOC_BS) {
+		pmd = pmd_alloc_bs(walk->mm, pud, addr);
+		if (!pmd)
+			return -ENOMEM;
+	} else
+		pmd = pmd_offset_bs(pud, addr);
+
+	do {
+		next = pmd_addr_end_bs(addr, end);
+		/*
+		 * A section mapping looks "bad" to pmd_bad(), it just has
+		 * no PTE table below it, so treat it as a hole rather than
+		 * clearing it.
+		 */
+		if (!(walk->flags & MM_WALK_ALLOC_BS) &&
+				(pmd_none_bs(*pmd) || pmd_bad_bs(*pmd))) {
+			if (walk->pte_hole)
+				err = walk->pte_hole(addr, next, walk);
+			if (err)
+				break;
+			continue;
+		}
+		if (walk->pmd_entry) {
+			err = walk->pmd_entry(pmd, addr, next, walk);
+			if (err)
+				break;
+		}
+		if (walk->pte_entry) {
+			err = walk_pte_range_bs(pmd, addr, next, walk);
+			if (err)
+				break;
+		}
+	} while (pmd++, addr = next, addr != end);
+	return err;
+}
+
+static int walk_pud_range_bs(pgd_t_bs *pgd, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	pud_t_bs *pud;
+	unsigned long next;
+	int err = 0;
+
+	if (walk->flags & MM_WALK_ALLOC_BS) {
+		pud = pud_alloc_bs(walk->mm, pgd, addr);
+		if (!pud)
+			return -ENOMEM;
+	} else
+		pud = pud_offset_bs(pgd, addr);
+
+	do {
+		next = pud_addr_end_bs(addr, end);
+		if (!(walk->flags & MM_WALK_ALLOC_BS) &&
+					pud_none_or_clear_bad_bs(pud)) {
+			if (walk->pte_hole)
+				err = walk->pte_hole(addr, next, walk);
+			if (err)
+				break;
+			continue;
+		}
+		if (walk->pud_entry) {
+			err = walk->pud_entry(pud, addr, next, walk);
+			if (err)
+				break;
+		}
+		if (walk->pmd_entry || walk->pte_entry) {
+			err = walk_pmd_range_bs(pud, addr, next, walk);
+			if (err)
+				break;
+		}
+	} while (pud++, addr = next, addr != end);
+	return err;
+}
+
+/**
+ * walk_page_range_bs - walk the page tables of walk->mm over [addr, end)
+ * @addr: start address, page aligned
+ * @end: end address, page aligned, 0 for the top of the address space
+ * @walk: callbacks, flags and private data
+ *
+ * Returns 0 once the whole range has been walked, or the first non-zero
+ * value a callback returned.
+ */
+int walk_page_range_bs(unsigned long addr, unsigned long end,
+				struct mm_walk_bs *walk)
+{
+	pgd_t_bs *pgd;
+	unsigned long next;
+	int err = 0;
+
+	if (end - 1 < addr)
+		return -EINVAL;
+
+	pgd = pgd_offset_bs(walk->mm, addr);
+	do {
+		next = pgd_addr_end_bs(addr, end);
+		if (!(walk->flags & MM_WALK_ALLOC_BS) &&
+					pgd_none_or_clear_bad_bs(pgd)) {
+			if (walk->pte_hole)
+				err = walk->pte_hole(addr, next, walk);
+			if (err)
+				break;
+			continue;
+		}
+		if (walk->pgd_entry) {
+			err = walk->pgd_entry(pgd, addr, next, walk);
+			if (err)
+				break;
+		}
+		if (walk->pud_entry || walk->pmd_entry || walk->pte_entry) {
+			err = walk_pud_range_bs(pgd, addr, next, walk);
+			if (err)
+				break;
+		}
+	} while (pgd++, addr = next, addr != end);
+	return err;
+}
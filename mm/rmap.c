@@ -33,7 +33,7 @@
  *     mapping->i_mmap_lock
  *       anon_vma->lock
  *         mm->page_table_lock
- *           zone->lru_lock (in mark_page_accessed)
+ *           lru sublist lock (in mark_page_accessed)
  *           swap_list_lock (in swap_free etc's swap_info_get)
  *             mmlist_lock (in mmput, drain_mmlist and others)
  *             swap_device_lock (in swap_duplicate, swap_info_get)
@@ -53,6 +53,8 @@
 #include "biscuitos/swap.h"
 #include "biscuitos/rmap.h"
 #include "biscuitos/pagemap.h"
+#include "biscuitos/highmem.h"
+#include "biscuitos/pagevec.h"
 #include "asm-generated/pgtable.h"
 #include "asm-generated/tlbflush.h"
 
@@ -97,16 +99,47 @@ vma_address_bs(struct page_bs *page, struct vm_area_struct *vma)
 	return address;
 }
 
+/*
+ * The page tables behind a vma live in a struct mm_struct_bs; vm_mm only
+ * borrows the host's pointer type.
+ */
+static inline struct mm_struct_bs *vma_mm_bs(struct vm_area_struct *vma)
+{
+	return (struct mm_struct_bs *)vma->vm_mm;
+}
+
+static int mm_find_pmd_entry_bs(pmd_t_bs *pmd, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk)
+{
+	walk->private = pmd;
+	return 1;
+}
+
+/*
+ * The pmd covering @address in @mm, or NULL if there is no PTE table.
+ * Caller holds mm->page_table_lock.
+ */
+static pmd_t_bs *mm_find_pmd_bs(struct mm_struct_bs *mm,
+						unsigned long address)
+{
+	struct mm_walk_bs walk = {
+		.pmd_entry	= mm_find_pmd_entry_bs,
+		.mm		= mm,
+	};
+
+	address &= PAGE_MASK_BS;
+	walk_page_range_bs(address, address + PAGE_SIZE_BS, &walk);
+	return walk.private;
+}
+
 /*
  * Check that @page is mapped at @address into @mm.
  *
  * On success returns with mapped pte and locked mm->page_table_lock.
  */
 static pte_t_bs *page_check_address_bs(struct page_bs *page, 
-			struct mm_struct *mm, unsigned long address)
+			struct mm_struct_bs *mm, unsigned long address)
 {
-	pgd_t_bs *pgd;
-	pud_t_bs *pud;
 	pmd_t_bs *pmd;
 	pte_t_bs *pte;
 
@@ -115,25 +148,64 @@ static pte_t_bs *page_check_address_bs(struct page_bs *page,
 	 * munmap, fork, etc...
 	 */
 	spin_lock(&mm->page_table_lock);
-	pgd = pgd_offset_bs((struct mm_struct_bs *)mm, address);
-	if (likely(pgd_present_bs(*pgd))) {
-		pud = pud_offset_bs(pgd, address);
-		if (likely(pud_present_bs(*pud))) {
-			pmd = pmd_offset_bs(pud, address);
-			if (likely(pmd_present_bs(*pmd))) {
-				pte = pte_offset_map_bs(pmd, address);
-				if (likely(pte_present_bs(*pte) &&
-					page_to_pfn_bs(page) == 
-							pte_pfn_bs(*pte)))
-					return pte;
-				pte_unmap_bs(pte);
-			}
-		}
+	pmd = mm_find_pmd_bs(mm, address);
+	if (likely(pmd)) {
+		pte = pte_offset_map_bs(pmd, address);
+		if (likely(pte_present_bs(*pte) &&
+				page_to_pfn_bs(page) == pte_pfn_bs(*pte)))
+			return pte;
+		pte_unmap_bs(pte);
 	}
 	spin_unlock(&mm->page_table_lock);
 	return ERR_PTR(-ENOENT);
 }
 
+/**
+ * page_add_anon_rmap - add pte mapping to an anonymous page
+ * @page:	the page to add the mapping to
+ * @vma:	the vm area in which the mapping is added
+ * @address:	the user virtual address mapped
+ *
+ * The caller needs to hold the mm->page_table_lock.
+ */
+void page_add_anon_rmap_bs(struct page_bs *page,
+		struct vm_area_struct *vma, unsigned long address)
+{
+	struct anon_vma_bs *anon_vma = (struct anon_vma_bs *)vma->anon_vma;
+	pgoff_t index;
+
+	BUG_ON_BS(PageReserved_bs(page));
+	BUG_ON_BS(!anon_vma);
+
+	anon_vma = (void *) anon_vma + PAGE_MAPPING_ANON_BS;
+	index = (address - vma->vm_start) >> PAGE_SHIFT_BS;
+	index += vma->vm_pgoff;
+	index >>= PAGE_CACHE_SHIFT_BS - PAGE_SHIFT_BS;
+
+	if (atomic_inc_and_test(&page->_mapcount)) {
+		page->index = index;
+		page->mapping = (struct address_space *) anon_vma;
+		inc_page_state_bs(nr_mapped);
+	}
+	/* else checking page index and mapping is racy */
+}
+
+/**
+ * page_remove_rmap - take down pte mapping from a page
+ * @page: page to remove mapping from
+ *
+ * Caller needs to hold the mm->page_table_lock.
+ */
+void page_remove_rmap_bs(struct page_bs *page)
+{
+	BUG_ON_BS(PageReserved_bs(page));
+
+	if (atomic_add_negative(-1, &page->_mapcount)) {
+		BUG_ON_BS(page_mapcount_bs(page) < 0);
+		dec_page_state_bs(nr_mapped);
+	}
+}
+
 /*
  * Subfunctions of page_referenced: page_referenced_one called
  * repeatedly from either page_referenced_anon or page_referenced_file.
@@ -142,7 +214,7 @@ static int page_referenced_one_bs(struct page_bs *page,
 		struct vm_area_struct *vma, unsigned int *mapcount,
 		int ignore_token)
 {
-	struct mm_struct *mm = vma->vm_mm;
+	struct mm_struct_bs *mm = vma_mm_bs(vma);
 	unsigned long address;
 	pte_t_bs *pte;
 	int referenced = 0;
@@ -159,8 +231,8 @@ static int page_referenced_one_bs(struct page_bs *page,
 		if (ptep_clear_flush_young_bs(vma, address, pte))
 			referenced++;
 
-		if (mm != current->mm && !ignore_token &&
-						has_swap_token_bs(mm))
+		if (vma->vm_mm != current->mm && !ignore_token &&
+					has_swap_token_bs(vma->vm_mm))
 			referenced++;
 
 		(*mapcount)--;
@@ -248,27 +320,306 @@ int page_referenced_bs(struct page_bs *page, int is_locked, int ignore_token)
 	return referenced;
 }
 
+struct referenced_walk_bs {
+	struct vm_area_struct *vma;
+	struct pagevec_bs *pvec;
+	int *idx;
+	unsigned int *mapcount;
+	int *referenced;
+	int ignore_token;
+	unsigned long addr[PAGEVEC_SIZE_BS];
+	int slot[PAGEVEC_SIZE_BS];
+	int nr, cur;
+};
+
+/* no PTE table here: none of the pages in [addr, next) is mapped */
+static int referenced_hole_bs(unsigned long addr, unsigned long next,
+					struct mm_walk_bs *walk)
+{
+	struct referenced_walk_bs *rw = walk->private;
 
+	while (rw->cur < rw->nr && rw->addr[rw->cur] < next)
+		rw->cur++;
+	return 0;
+}
 
+static int referenced_pmd_entry_bs(pmd_t_bs *pmd, unsigned long addr,
+				unsigned long next, struct mm_walk_bs *walk)
+{
+	struct referenced_walk_bs *rw = walk->private;
+	struct mm_struct *mm = rw->vma->vm_mm;
+	pte_t_bs *ptes;
+
+	if (rw->cur == rw->nr || rw->addr[rw->cur] >= next)
+		return 0;
+
+	ptes = pte_offset_map_bs(pmd, addr & PMD_MASK_BS);
+	for (; rw->cur < rw->nr && rw->addr[rw->cur] < next; rw->cur++) {
+		unsigned long address = rw->addr[rw->cur];
+		int k = rw->slot[rw->cur];
+		struct page_bs *page = rw->pvec->pages[rw->idx[k]];
+		pte_t_bs *pte = ptes + __pte_index_bs(address);
+
+		if (!pte_present_bs(*pte) ||
+				page_to_pfn_bs(page) != pte_pfn_bs(*pte))
+			continue;
+
+		if (ptep_clear_flush_young_bs(rw->vma, address, pte))
+			rw->referenced[rw->idx[k]]++;
+		if (mm != current->mm && !rw->ignore_token &&
+						has_swap_token_bs(mm))
+			rw->referenced[rw->idx[k]]++;
+		rw->mapcount[k]--;
+	}
+	pte_unmap_bs(ptes);
+	return 0;
+}
 
+/*
+ * One vma of an anon_vma group: the pages it maps are sorted by
+ * address and walked one PTE table at a time, so pgd/pud/pmd are
+ * looked up once per table that holds a page, not once per page, and
+ * the tables in between are never visited.  @idx maps group slots to
+ * pagevec slots.
+ */
+static void page_referenced_vma_batch_bs(struct vm_area_struct *vma,
+		struct pagevec_bs *pvec, int *idx, unsigned int *mapcount,
+		int n, int *referenced, int ignore_token)
+{
+	struct mm_struct_bs *mm = vma_mm_bs(vma);
+	struct referenced_walk_bs rw = {
+		.vma		= vma,
+		.pvec		= pvec,
+		.idx		= idx,
+		.mapcount	= mapcount,
+		.referenced	= referenced,
+		.ignore_token	= ignore_token,
+	};
+	struct mm_walk_bs walk = {
+		.pmd_entry	= referenced_pmd_entry_bs,
+		.pte_hole	= referenced_hole_bs,
+		.mm		= mm,
+		.private	= &rw,
+	};
+	int k, m;
+
+	for (k = 0; k < n; k++) {
+		unsigned long address;
+
+		if (!mapcount[k])
+			continue;
+		address = vma_address_bs(pvec->pages[idx[k]], vma);
+		if (address == -EFAULT)
+			continue;
+		for (m = rw.nr; m > 0 && rw.addr[m - 1] > address; m--) {
+			rw.addr[m] = rw.addr[m - 1];
+			rw.slot[m] = rw.slot[m - 1];
+		}
+		rw.addr[m] = address;
+		rw.slot[m] = k;
+		rw.nr++;
+	}
+	if (!rw.nr)
+		return;
 
+	spin_lock(&mm->page_table_lock);
+	while (rw.cur < rw.nr) {
+		unsigned long table = rw.addr[rw.cur] & PMD_MASK_BS;
+		int last = rw.cur;
+
+		while (last + 1 < rw.nr &&
+			(rw.addr[last + 1] & PMD_MASK_BS) == table)
+			last++;
+		/* the callbacks move rw.cur past @last */
+		walk_page_range_bs(rw.addr[rw.cur],
+				rw.addr[last] + PAGE_SIZE_BS, &walk);
+	}
+	spin_unlock(&mm->page_table_lock);
+}
 
+/**
+ * page_referenced_batch - page_referenced for a pagevec
+ * @pvec: isolated pages to test
+ * @referenced: gets page_referenced() of each page of @pvec
+ * @is_locked: caller holds the locks on the pages
+ *
+ * Anon pages are grouped by anon_vma and each group takes anon_vma->lock
+ * and walks its vma list once.  Other pages go through page_referenced().
+ */
+void page_referenced_batch_bs(struct pagevec_bs *pvec, int *referenced,
+					int is_locked, int ignore_token)
+{
+	unsigned int mapcount[PAGEVEC_SIZE_BS];
+	int idx[PAGEVEC_SIZE_BS];
+	int nr = pagevec_count_bs(pvec);
+	unsigned long done = 0;
+	int i, j, k, n;
 
+	if (!swap_token_default_timeout_bs)
+		ignore_token = 1;
 
+	for (i = 0; i < nr; i++) {
+		struct page_bs *page = pvec->pages[i];
 
+		if (!PageAnon_bs(page) || !page_mapped_bs(page)) {
+			referenced[i] = page_referenced_bs(page, is_locked,
+								ignore_token);
+			done |= 1UL << i;
+			continue;
+		}
+		referenced[i] = 0;
+		if (page_test_and_clear_young_bs(page))
+			referenced[i]++;
+		if (TestClearPageReferenced_bs(page))
+			referenced[i]++;
+	}
 
+	for (i = 0; i < nr; i++) {
+		struct anon_vma_bs *anon_vma;
+		struct vm_area_struct *vma;
 
+		if (done & (1UL << i))
+			continue;
+		anon_vma = page_lock_anon_vma_bs(pvec->pages[i]);
+		if (!anon_vma) {
+			done |= 1UL << i;
+			continue;
+		}
 
+		/* The rest of the batch under the same anon_vma */
+		for (n = 0, j = i; j < nr; j++) {
+			struct page_bs *page = pvec->pages[j];
+
+			if ((done & (1UL << j)) ||
+			    page->mapping != pvec->pages[i]->mapping)
+				continue;
+			done |= 1UL << j;
+			if (!page_mapped_bs(page))
+				continue;
+			idx[n] = j;
+			mapcount[n++] = page_mapcount_bs(page);
+		}
 
+		list_for_each_entry(vma, &anon_vma->head, anon_vma_chain) {
+			page_referenced_vma_batch_bs(vma, pvec, idx, mapcount,
+						n, referenced, ignore_token);
+			for (k = 0; k < n && !mapcount[k]; k++)
+				;
+			if (k == n)
+				break;
+		}
+		spin_unlock(&anon_vma->lock);
+	}
+}
 
+/*
+ * Subfunctions of page_migrate_anon: write-protect one mapping of @page,
+ * or point it at @newpage instead.  With @newpage == @page the mapping
+ * only gets its write permission back.
+ */
+static void page_wrprotect_one_bs(struct page_bs *page,
+					struct vm_area_struct *vma)
+{
+	struct mm_struct_bs *mm = vma_mm_bs(vma);
+	unsigned long address;
+	pte_t_bs *pte;
 
+	address = vma_address_bs(page, vma);
+	if (address == -EFAULT)
+		return;
 
+	pte = page_check_address_bs(page, mm, address);
+	if (IS_ERR(pte))
+		return;
+	if (pte_write_bs(*pte)) {
+		set_pte_at_bs(mm, address, pte,
+			__pte_bs(pte_val_bs(*pte) & ~L_PTE_WRITE_BS));
+		flush_tlb_page_bs(vma, address);
+	}
+	pte_unmap_bs(pte);
+	spin_unlock(&mm->page_table_lock);
+}
 
+static void page_remap_one_bs(struct page_bs *page, struct page_bs *newpage,
+		struct vm_area_struct *vma, int exclusive)
+{
+	struct mm_struct_bs *mm = vma_mm_bs(vma);
+	unsigned long address;
+	pte_t_bs *pte, entry;
 
+	address = vma_address_bs(page, vma);
+	if (address == -EFAULT)
+		return;
 
+	pte = page_check_address_bs(page, mm, address);
+	if (IS_ERR(pte))
+		return;
+	entry = __pte_bs((page_to_pfn_bs(newpage) << PAGE_SHIFT_BS) |
+				(pte_val_bs(*pte) & ~PAGE_MASK_BS));
+	/*
+	 * A dirty pte of the only mapping in a writable vma was writable
+	 * before we protected it.  Anything else waits for the write fault,
+	 * which keeps COW sharing after fork intact.
+	 */
+	if (exclusive && (vma->vm_flags & VM_WRITE) && pte_dirty_bs(entry))
+		entry = __pte_bs(pte_val_bs(entry) | L_PTE_WRITE_BS);
+	set_pte_at_bs(mm, address, pte, entry);
+	flush_tlb_page_bs(vma, address);
+
+	if (newpage != page) {
+		get_page_bs(newpage);
+		atomic_inc(&newpage->_mapcount);
+		atomic_dec(&page->_mapcount);
+		__put_page_bs(page);
+	}
+	pte_unmap_bs(pte);
+	spin_unlock(&mm->page_table_lock);
+}
 
+/**
+ * page_migrate_anon - move the mappings of an anonymous page
+ * @page: the locked, isolated page being migrated
+ * @newpage: the page taking its place
+ *
+ * Copies @page into @newpage and points every pte that maps @page at
+ * @newpage, moving a reference and a mapcount for each.  The mappings
+ * are write-protected around the copy so that no store is lost.
+ * Returns 0, or -EAGAIN with every pte back on @page if @page was
+ * unmapped under us or a pte that maps it could not be found.
+ */
+int page_migrate_anon_bs(struct page_bs *page, struct page_bs *newpage)
+{
+	struct anon_vma_bs *anon_vma;
+	struct vm_area_struct *vma;
+	int exclusive, ret = 0;
 
+	anon_vma = page_lock_anon_vma_bs(page);
+	if (!anon_vma)
+		return -EAGAIN;
 
+	exclusive = page_mapcount_bs(page) == 1;
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_chain)
+		page_wrprotect_one_bs(page, vma);
 
+	copy_highpage_bs(newpage, page);
+	newpage->mapping = page->mapping;
+	newpage->index = page->index;
 
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_chain) {
+		page_remap_one_bs(page, newpage, vma, exclusive);
+		if (!page_mapped_bs(page))
+			break;
+	}
 
+	if (page_mapped_bs(page)) {
+		/* A pte was missed: @page must stay, take the rest back */
+		list_for_each_entry(vma, &anon_vma->head, anon_vma_chain)
+			page_remap_one_bs(newpage, page, vma, exclusive);
+		list_for_each_entry(vma, &anon_vma->head, anon_vma_chain)
+			page_remap_one_bs(page, page, vma, exclusive);
+		newpage->mapping = NULL;
+		ret = -EAGAIN;
+	}
+	spin_unlock(&anon_vma->lock);
+	return ret;
+}
@@ -92,6 +92,7 @@
 #include "asm-generated/page.h"
 #include "biscuitos/slab.h"
 #include "biscuitos/mm.h"
+#include "biscuitos/swap.h"
 #include "biscuitos/init.h"
 #include "biscuitos/cpu.h"
 #include "asm-generated/arch.h"
@@ -449,10 +450,10 @@ static int slab_break_gfp_order_bs = BREAK_GFP_ORDER_LO_BS;
  * global 'mem_map'. These are used to find the slab an obj belongs to.
  * With kfree(), these are used to find the cache which an obj belongs to.
  */
-#define SET_PAGE_CACHE_BS(pg,x)	((pg)->lru.next = (struct list_head *)(x))
-#define GET_PAGE_CACHE_BS(pg)	((kmem_cache_t_bs *)(pg)->lru.next)
-#define SET_PAGE_SLAB_BS(pg,x)	((pg)->lru.prev = (struct list_head *)(x))
-#define GET_PAGE_SLAB_BS(pg)	((struct slab_bs *)(pg)->lru.prev)
+#define SET_PAGE_CACHE_BS(pg,x)	((pg)->slab_cache = (x))
+#define GET_PAGE_CACHE_BS(pg)	((pg)->slab_cache)
+#define SET_PAGE_SLAB_BS(pg,x)	((pg)->slab_page = (x))
+#define GET_PAGE_SLAB_BS(pg)	((pg)->slab_page)
 
 static struct arraycache_init_bs initarray_cache_bs __initdata = {
 	{ 0, BOOT_CPUCACHE_ENTRIES_BS, 1, 0} 
@@ -815,10 +816,9 @@ static void kmem_freepages_bs(kmem_cache_t_bs *cachep, void *addr)
 		page++;
 	}
 	sub_page_state_bs(nr_slab, nr_freed);
-#if 0
 	if (current->reclaim_state)
-		current->reclaim_state->reclaimed_slab += nr_freed;
-#endif
+		((struct reclaim_state_bs *)current->reclaim_state)->
+						reclaimed_slab += nr_freed;
 	free_pages_bs((unsigned long)addr, cachep->gfporder);
 	if (cachep->flags & SLAB_RECLAIM_ACCOUNT_BS)
 		atomic_sub(1 << cachep->gfporder, &slab_reclaim_pages_bs);
@@ -2091,6 +2091,8 @@ next:
 	cachep->gfpflags = 0;
 	if (flags & SLAB_CACHE_DMA_BS)
 		cachep->gfpflags |= GFP_DMA_BS;
+	if (flags & SLAB_RECLAIM_ACCOUNT_BS)
+		cachep->gfpflags |= __GFP_RECLAIMABLE_BS;
 	spin_lock_init(&cachep->spinlock);
 	cachep->objsize = size;
 	/* NUMA */
@@ -2424,17 +2426,18 @@ static void drain_cpu_caches_bs(kmem_cache_t_bs *cachep)
 }
 
 /* NUMA shrink all list3s */
-static int __cache_shrink_bs(kmem_cache_t_bs *cachep)
+/*
+ * Destroy completely free slabs until at least nr_objs objects are gone.
+ * Returns the number of objects freed.  Called with cachep->spinlock held,
+ * which is dropped around each slab_destroy().
+ */
+static unsigned long
+drain_free_slabs_bs(kmem_cache_t_bs *cachep, unsigned long nr_objs)
 {
 	struct slab_bs *slabp;
-	int ret;
-
-	drain_cpu_caches_bs(cachep);
-
-	check_irq_on_bs();
-	spin_lock_irq(&cachep->spinlock);
+	unsigned long freed = 0;
 
-	for (;;) {
+	while (freed < nr_objs) {
 		struct list_head *p;
 
 		p = cachep->lists.slabs_free.prev;
@@ -2450,16 +2453,77 @@ static int __cache_shrink_bs(kmem_cache_t_bs *cachep)
 		list_del(&slabp->list);
 
 		cachep->lists.free_objects -= cachep->num;
+		freed += cachep->num;
 		spin_unlock_irq(&cachep->spinlock);
 		slab_destroy_bs(cachep, slabp);
 		spin_lock_irq(&cachep->spinlock);
 	}
+	return freed;
+}
+
+static int __cache_shrink_bs(kmem_cache_t_bs *cachep)
+{
+	int ret;
+
+	drain_cpu_caches_bs(cachep);
+
+	check_irq_on_bs();
+	spin_lock_irq(&cachep->spinlock);
+	drain_free_slabs_bs(cachep, ~0UL);
 	ret = !list_empty(&cachep->lists.slabs_full) ||
 		!list_empty(&cachep->lists.slabs_partial);
 	spin_unlock_irq(&cachep->spinlock);
 	return ret;
 }
 
+/*
+ * Completely free slabs are pure cache: cache_reap() hands them back
+ * slowly from the timer, this shrinker lets page reclaim take them at
+ * the rate memory pressure asks for.  Objects sitting in the per-CPU
+ * arrays are left alone; draining those needs an IPI per cache.
+ */
+static unsigned long
+slab_shrink_count_bs(struct shrinker_bs *shrinker,
+			struct shrink_control_bs *sc)
+{
+	kmem_cache_t_bs *cachep;
+	unsigned long count = 0;
+
+	if (down_trylock(&cache_chain_sem_bs))
+		return 0;
+	list_for_each_entry(cachep, &cache_chain_bs, next)
+		count += cachep->lists.free_objects;
+	up(&cache_chain_sem_bs);
+	return count;
+}
+
+static unsigned long
+slab_shrink_scan_bs(struct shrinker_bs *shrinker,
+			struct shrink_control_bs *sc)
+{
+	kmem_cache_t_bs *cachep;
+	unsigned long freed = 0;
+
+	if (down_trylock(&cache_chain_sem_bs))
+		return SHRINK_STOP_BS;
+	list_for_each_entry(cachep, &cache_chain_bs, next) {
+		check_irq_on_bs();
+		spin_lock_irq(&cachep->spinlock);
+		freed += drain_free_slabs_bs(cachep, sc->nr_to_scan - freed);
+		spin_unlock_irq(&cachep->spinlock);
+		if (freed >= sc->nr_to_scan)
+			break;
+	}
+	up(&cache_chain_sem_bs);
+	return freed;
+}
+
+static struct shrinker_bs slab_shrinker_bs = {
+	.count_objects	= slab_shrink_count_bs,
+	.scan_objects	= slab_shrink_scan_bs,
+	.seeks		= DEFAULT_SEEKS_BS,
+};
+
 /**
  * kmem_cache_destroy - delete a cache
  * @cachep: the cache to destroy
@@ -2703,6 +2767,7 @@ static int __init __unused cpucache_init_bs(void)
 		if (cpu_online(cpu))
 			start_cpu_timer_bs(cpu);
 	}
+	register_shrinker_bs(&slab_shrinker_bs);
 
 	return 0;
 }
@@ -0,0 +1,81 @@
+/*
+ * linux/mm/sparse.c
+ *
+ * Sparse memory model.
+ *
+ * Physical memory is carved into fixed size sections.  Instead of one
+ * mem_map spanning the whole node, holes included, each section that
+ * holds RAM gets its own piece of mem_map, so the cost of a hole
+ * between two banks is one mem_section word per missing section.
+ */
+#include <linux/kernel.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/init.h"
+#include "biscuitos/mmzone.h"
+#include "biscuitos/mm.h"
+#include "biscuitos/bootmem.h"
+
+#ifdef CONFIG_SPARSEMEM_BS
+
+#if SECTION_SIZE_BITS_BS < (MAX_ORDER_BS - 1 + PAGE_SHIFT_BS)
+#error "A mem_section must hold at least one MAX_ORDER block"
+#endif
+
+struct mem_section_bs mem_section_bs[NR_MEM_SECTIONS_BS];
+EXPORT_SYMBOL_GPL(mem_section_bs);
+
+/*
+ * Record that the pfns [start, end) on node nid hold memory, so that
+ * sparse_init() gives their sections a mem_map.
+ */
+void __init memory_present_bs(int nid, unsigned long start, unsigned long end)
+{
+	unsigned long pfn;
+
+	/* sections count from PHYS_PFN_OFFSET, round down the same way */
+	start = section_nr_to_pfn_bs(pfn_to_section_nr_bs(start));
+	for (pfn = start; pfn < end; pfn += PAGES_PER_SECTION_BS) {
+		unsigned long section = pfn_to_section_nr_bs(pfn);
+
+		if (section >= NR_MEM_SECTIONS_BS) {
+			printk(KERN_ERR "SPARSEMEM: pfn %#lx beyond the last "
+					"section, ignored\n", pfn);
+			break;
+		}
+		mem_section_bs[section].section_mem_map |=
+						SECTION_MARKED_PRESENT_BS;
+	}
+}
+
+/*
+ * Allocate the mem_map of every present section.  The stored pointer is
+ * biased by the section's first pfn so pfn_to_page() needs no subtraction.
+ */
+void __init sparse_init_bs(void)
+{
+	unsigned long pnum;
+
+	for (pnum = 0; pnum < NR_MEM_SECTIONS_BS; pnum++) {
+		struct mem_section_bs *ms = __nr_to_section_bs(pnum);
+		struct page_bs *map;
+
+		if (!(ms->section_mem_map & SECTION_MARKED_PRESENT_BS))
+			continue;
+
+		map = alloc_bootmem_node_bs(NODE_DATA_BS(0),
+				PAGES_PER_SECTION_BS * sizeof(struct page_bs));
+		if (!map) {
+			printk(KERN_ERR "SPARSEMEM: no mem_map for section "
+					"%lu\n", pnum);
+			ms->section_mem_map = 0;
+			continue;
+		}
+		ms->section_mem_map = ((unsigned long)(map -
+					section_nr_to_pfn_bs(pnum)) &
+					SECTION_MAP_MASK_BS) |
+					SECTION_MARKED_PRESENT_BS |
+					SECTION_HAS_MEM_MAP_BS;
+	}
+}
+
+#endif /* CONFIG_SPARSEMEM_BS */
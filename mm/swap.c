@@ -15,30 +15,185 @@
 #include <linux/kernel.h>
 #include <linux/cpu.h>
 #include <linux/notifier.h>
+#include <linux/workqueue.h>
 #include "biscuitos/kernel.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/percpu.h"
 #include "biscuitos/pagevec.h"
 #include "biscuitos/mm_inline.h"
+#include "biscuitos/swap.h"
 #include "asm-generated/percpu.h"
 
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster_bs;
 
+static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_add_pvecs_bs) = { 0, };
+static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_add_active_pvecs_bs) = { 0, };
+static DEFINE_PER_CPU_BS(struct pagevec_bs, activate_page_pvecs_bs) = { 0, };
+static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_deactivate_pvecs_bs) = { 0, };
+static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_rotate_pvecs_bs) = { 0, };
+
+/*
+ * Apply move_fn to every page in the pagevec under the lock of the LRU
+ * sublist the page lives on.  A lock is kept across a run of pages that
+ * share it.  The references the pagevec held are dropped afterwards.
+ */
+static void pagevec_lru_move_fn_bs(struct pagevec_bs *pvec,
+	void (*move_fn)(struct lru_sublist_bs *lru, struct page_bs *page))
+{
+	int i;
+	struct lru_sublist_bs *lru = NULL;
+	unsigned long flags = 0;
+
+	for (i = 0; i < pagevec_count_bs(pvec); i++) {
+		struct page_bs *page = pvec->pages[i];
+		struct lru_sublist_bs *pagelru = page_lru_sublist_bs(page);
+
+		if (pagelru != lru) {
+			if (lru)
+				spin_unlock_irqrestore(&lru->lock, flags);
+			lru = pagelru;
+			spin_lock_irqsave(&lru->lock, flags);
+		}
+		move_fn(lru, page);
+	}
+	if (lru)
+		spin_unlock_irqrestore(&lru->lock, flags);
+	release_pages_bs(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_reinit_bs(pvec);
+}
+
+static void __activate_page_bs(struct lru_sublist_bs *lru,
+						struct page_bs *page)
+{
+	if (PageLRU_bs(page) && !page_lru_active_bs(lru, page)) {
+		del_page_from_lru_bs(lru, page);
+		SetPageActive_bs(page);
+		add_page_to_active_list_bs(lru, page);
+		inc_page_state_bs(pgactivate);
+	}
+}
+
+static void __deactivate_page_bs(struct lru_sublist_bs *lru,
+						struct page_bs *page)
+{
+	if (PageLRU_bs(page) && page_lru_active_bs(lru, page)) {
+		del_page_from_lru_bs(lru, page);
+		ClearPageReferenced_bs(page);
+		add_page_to_inactive_list_bs(lru, page);
+		inc_page_state_bs(pgdeactivate);
+	}
+}
+
+static void __rotate_page_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	if (PageLRU_bs(page) && !page_lru_active_bs(lru, page)) {
+		del_page_from_lru_bs(lru, page);
+		add_page_to_inactive_list_tail_bs(lru, page);
+		inc_page_state_bs(pgrotated);
+	}
+}
+
+/*
+ * Activation is batched per CPU, the page moves at the next drain.
+ */
+void activate_page_bs(struct page_bs *page)
+{
+	struct pagevec_bs *pvec = &get_cpu_var_bs(activate_page_pvecs_bs);
+
+	get_page_bs(page);
+	if (!pagevec_add_bs(pvec, page))
+		pagevec_lru_move_fn_bs(pvec, __activate_page_bs);
+	put_cpu_var_bs(activate_page_pvecs_bs);
+}
+
+/**
+ * deactivate_page - move an active page to the inactive list
+ * @page: page to deactivate
+ *
+ * Used when the caller knows the page will not be needed again soon.
+ */
+void deactivate_page_bs(struct page_bs *page)
+{
+	struct pagevec_bs *pvec = &get_cpu_var_bs(lru_deactivate_pvecs_bs);
+
+	get_page_bs(page);
+	if (!pagevec_add_bs(pvec, page))
+		pagevec_lru_move_fn_bs(pvec, __deactivate_page_bs);
+	put_cpu_var_bs(lru_deactivate_pvecs_bs);
+}
+
+/*
+ * Writeback is about to end against a page which has been marked for
+ * immediate reclaim.  If it still appears to be reclaimable, move it to
+ * the tail of the inactive list.  May be called from interrupt context.
+ */
+void rotate_reclaimable_page_bs(struct page_bs *page)
+{
+	struct pagevec_bs *pvec;
+	unsigned long flags;
+
+	if (!PageLRU_bs(page) || PageActive_bs(page))
+		return;
+
+	get_page_bs(page);
+	local_irq_save(flags);
+	pvec = &__get_cpu_var_bs(lru_rotate_pvecs_bs);
+	if (!pagevec_add_bs(pvec, page))
+		pagevec_lru_move_fn_bs(pvec, __rotate_page_bs);
+	local_irq_restore(flags);
+}
+
+/*
+ * Mark a page as having seen activity.
+ *
+ * inactive,unreferenced	->	inactive,referenced
+ * inactive,referenced		->	active,unreferenced
+ * active,unreferenced		->	active,referenced
+ */
+void mark_page_accessed_bs(struct page_bs *page)
+{
+	if (!PageActive_bs(page) && PageReferenced_bs(page) &&
+							PageLRU_bs(page)) {
+		activate_page_bs(page);
+		ClearPageReferenced_bs(page);
+	} else if (!PageReferenced_bs(page)) {
+		SetPageReferenced_bs(page);
+	}
+}
+EXPORT_SYMBOL_GPL(mark_page_accessed_bs);
+
 /**
  * lru_cache_add: add a page to the page lists
  * @page: the page to add
  */
-static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_add_pvecs_bs) = { 0, };
-static DEFINE_PER_CPU_BS(struct pagevec_bs, lru_add_active_pvecs_bs) = { 0, };
+void lru_cache_add_bs(struct page_bs *page)
+{
+	struct pagevec_bs *pvec = &get_cpu_var_bs(lru_add_pvecs_bs);
+
+	get_page_bs(page);
+	if (!pagevec_add_bs(pvec, page))
+		__pagevec_lru_add_bs(pvec);
+	put_cpu_var_bs(lru_add_pvecs_bs);
+}
+
+void lru_cache_add_active_bs(struct page_bs *page)
+{
+	struct pagevec_bs *pvec = &get_cpu_var_bs(lru_add_active_pvecs_bs);
+
+	get_page_bs(page);
+	if (!pagevec_add_bs(pvec, page))
+		__pagevec_lru_add_active_bs(pvec);
+	put_cpu_var_bs(lru_add_active_pvecs_bs);
+}
 
 /*
  * Batched page_cache_release().  Decrement the reference count on all the
  * passed pages.  If it fell to zero then remove the page from the LRU and
  * free it.
  *
- * Avoid taking zone->lru_lock if possible, but if it is taken, retain it
- * for the remainder of the operation.
+ * Avoid taking an LRU sublist lock if possible, but if it is taken, retain
+ * it for as long as the following pages hash to the same sublist.
  *
  * The locking in this function is against shrink_cache(): we recheck the
  * page count inside the lock to see whether shrink_cache grabbed the page
@@ -48,109 +203,155 @@ void release_pages_bs(struct page_bs **pages, int nr, int cold)
 {
 	int i;
 	struct pagevec_bs pages_to_free;
-	struct zone_bs *zone = NULL;
+	struct lru_sublist_bs *lru = NULL;
+	unsigned long flags = 0;
 
 	pagevec_init_bs(&pages_to_free, cold);
 	for (i = 0; i < nr; i++) {
 		struct page_bs *page = pages[i];
-		struct zone_bs *pagezone;
+		struct lru_sublist_bs *pagelru;
 
 		if (PageReserved_bs(page) || !put_page_testzero_bs(page))
 			continue;
 
-		pagezone = page_zone_bs(page);
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
+		pagelru = page_lru_sublist_bs(page);
+		if (pagelru != lru) {
+			if (lru)
+				spin_unlock_irqrestore(&lru->lock, flags);
+			lru = pagelru;
+			spin_lock_irqsave(&lru->lock, flags);
 		}
 		if (TestClearPageLRU_bs(page))
-			del_page_from_lru_bs(zone, page);
+			del_page_from_lru_bs(lru, page);
 		if (page_count_bs(page) == 0) {
 			if (!pagevec_add_bs(&pages_to_free, page)) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irqrestore(&lru->lock, flags);
 				__pagevec_free_bs(&pages_to_free);
 				pagevec_reinit_bs(&pages_to_free);
-				zone = NULL;	/* No lock is held */
+				lru = NULL;	/* No lock is held */
 			}
 		}
 	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+	if (lru)
+		spin_unlock_irqrestore(&lru->lock, flags);
 
 	pagevec_free_bs(&pages_to_free);
 }
 
-void __pagevec_lru_add_active_bs(struct pagevec_bs *pvec)
+/*
+ * The pages which we're about to release may be in the deferred lru-addition
+ * queues.  That would prevent them from really being freed right now.  That's
+ * OK from a correctness point of view but is inefficient - those pages may be
+ * cache-warm and we want to give them back to the page allocator ASAP.
+ *
+ * So __pagevec_release() will drain those queues here.  __pagevec_lru_add()
+ * and __pagevec_lru_add_active() call release_pages() directly to avoid
+ * mutual recursion.
+ */
+void __pagevec_release_bs(struct pagevec_bs *pvec)
+{
+	lru_add_drain_bs();
+	release_pages_bs(pvec->pages, pagevec_count_bs(pvec), pvec->cold);
+	pagevec_reinit_bs(pvec);
+}
+
+/*
+ * pagevec_release() for pages which are known to not be on the LRU
+ *
+ * This function reinitialises the caller's pagevec.
+ */
+void __pagevec_release_nonlru_bs(struct pagevec_bs *pvec)
 {
 	int i;
-	struct zone_bs *zone = NULL;
+	struct pagevec_bs pages_to_free;
 
+	pagevec_init_bs(&pages_to_free, pvec->cold);
 	for (i = 0; i < pagevec_count_bs(pvec); i++) {
 		struct page_bs *page = pvec->pages[i];
-		struct zone_bs *pagezone = page_zone_bs(page);
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		if (TestSetPageLRU_bs(page))
-			BUG_BS();
-		if (TestSetPageActive_bs(page))
-			BUG_BS();
-		add_page_to_active_list_bs(zone, page);
+		BUG_ON_BS(PageLRU_bs(page));
+		if (put_page_testzero_bs(page))
+			pagevec_add_bs(&pages_to_free, page);
 	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
-	release_pages_bs(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_free_bs(&pages_to_free);
 	pagevec_reinit_bs(pvec);
 }
 
+static void __lru_add_active_bs(struct lru_sublist_bs *lru,
+						struct page_bs *page)
+{
+	if (TestSetPageLRU_bs(page))
+		BUG_BS();
+	if (TestSetPageActive_bs(page))
+		BUG_BS();
+	add_page_to_active_list_bs(lru, page);
+}
+
+static void __lru_add_bs(struct lru_sublist_bs *lru, struct page_bs *page)
+{
+	if (TestSetPageLRU_bs(page))
+		BUG_BS();
+	add_page_to_inactive_list_bs(lru, page);
+}
+
+void __pagevec_lru_add_active_bs(struct pagevec_bs *pvec)
+{
+	pagevec_lru_move_fn_bs(pvec, __lru_add_active_bs);
+}
+
 /*
  * Add the passed pages to the LRU, then drop the caller's refcount
  * on them.  Reinitialises the caller's pagevec.
  */
 void __pagevec_lru_add_bs(struct pagevec_bs *pvec)
 {
-	int i;
-	struct zone_bs *zone = NULL;
-
-	for (i = 0; i < pagevec_count_bs(pvec); i++) {
-		struct page_bs *page = pvec->pages[i];
-		struct zone_bs *pagezone = page_zone_bs(page);
-
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		if (TestSetPageLRU_bs(page))
-			BUG_BS();
-		add_page_to_inactive_list_bs(zone, page);
-	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
-	release_pages_bs(pvec->pages, pvec->nr, pvec->cold);
-	pagevec_reinit_bs(pvec);
+	pagevec_lru_move_fn_bs(pvec, __lru_add_bs);
 }
 EXPORT_SYMBOL_GPL(__pagevec_lru_add_bs);
 
+/*
+ * Flush every per-CPU LRU batch of this CPU.
+ */
 void lru_add_drain_bs(void)
 {
 	struct pagevec_bs *pvec = &get_cpu_var_bs(lru_add_pvecs_bs);
+	unsigned long flags;
 
 	if (pagevec_count_bs(pvec))
-		BS_DUP();
+		__pagevec_lru_add_bs(pvec);
 	pvec = &__get_cpu_var_bs(lru_add_active_pvecs_bs);
 	if (pagevec_count_bs(pvec))
-		BS_DUP();
+		__pagevec_lru_add_active_bs(pvec);
+	pvec = &__get_cpu_var_bs(activate_page_pvecs_bs);
+	if (pagevec_count_bs(pvec))
+		pagevec_lru_move_fn_bs(pvec, __activate_page_bs);
+	pvec = &__get_cpu_var_bs(lru_deactivate_pvecs_bs);
+	if (pagevec_count_bs(pvec))
+		pagevec_lru_move_fn_bs(pvec, __deactivate_page_bs);
+
+	/* The rotation batch is also filled from interrupt context */
+	local_irq_save(flags);
+	pvec = &__get_cpu_var_bs(lru_rotate_pvecs_bs);
+	if (pagevec_count_bs(pvec))
+		pagevec_lru_move_fn_bs(pvec, __rotate_page_bs);
+	local_irq_restore(flags);
 	put_cpu_var_bs(lru_add_pvecs_bs);
 }
 
+static void lru_add_drain_per_cpu_bs(struct work_struct *dummy)
+{
+	lru_add_drain_bs();
+}
+
+/*
+ * Flush the LRU batches of every CPU, for callers that need every page
+ * they might isolate to be on the LRU.  Sleeps.
+ */
+int lru_add_drain_all_bs(void)
+{
+	return schedule_on_each_cpu(lru_add_drain_per_cpu_bs);
+}
+
 /* Drop the CPU's cached committed space back into the central pool */
 static int __unused cpu_swap_callback_bs(struct notifier_block *nfb,
 			unsigned long action, void *hcpu)
@@ -10,11 +10,13 @@
 #include <linux/kernel.h>
 #include <linux/string.h>
 #include <linux/errno.h>
+#include <linux/seq_file.h>
 #include "biscuitos/gfp.h"
 #include "biscuitos/vmalloc.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/slab.h"
 #include "biscuitos/kernel.h"
+#include "biscuitos/highmem.h"
 #include "asm-generated/pgtable.h"
 #include "asm-generated/cacheflush.h"
 #include "asm-generated/tlbflush.h"
@@ -22,137 +24,75 @@
 DEFINE_RWLOCK(vmlist_lock_bs);
 struct vm_struct_bs *vmlist_bs;
 
-static void 
-vunmap_pte_range_bs(pmd_t_bs *pmd, unsigned long addr, unsigned long end)
+static int vunmap_pte_range_bs(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
 {
-	pte_t_bs *pte;
-
-	pte = pte_offset_kernel_bs(pmd, addr);
 	do {
 		pte_t ptent = ptep_get_and_clear_bs(&init_mm_bs, addr, pte);
 		WARN_ON_BS(!pte_none_bs(ptent) && !pte_present_bs(ptent));
 	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
-}
-
-static inline void vunmap_pmd_range_bs(pud_t_bs *pud, unsigned long addr,
-							unsigned long end)
-{
-	pmd_t_bs *pmd;
-	unsigned long next;
-
-	pmd = pmd_offset_bs(pud, addr);
-	do {
-		next = pmd_addr_end_bs(addr, end);
-		vunmap_pte_range_bs(pmd, addr, next);
-	} while (pmd++, addr = next, addr != end);
-}
-
-static inline void vunmap_pud_range_bs(pgd_t_bs *pgd,
-			unsigned long addr, unsigned long end)
-{
-	pud_t_bs *pud;
-	unsigned long next;
-
-	pud = pud_offset_bs(pgd, addr);
-	do {
-		next = pud_addr_end_bs(addr, end);
-		if (pud_none_or_clear_bad_bs(pud))
-			continue;
-		vunmap_pmd_range_bs(pud, addr, next);
-	} while (pud++, addr = next, addr != end);
+	return 0;
 }
 
 void unmap_vm_area_bs(struct vm_struct_bs *area)
 {
-	pgd_t_bs *pgd;
-	unsigned long next;
 	unsigned long addr = (unsigned long)area->addr;
 	unsigned long end = addr + area->size;
+	struct mm_walk_bs walk = {
+		.pte_entry	= vunmap_pte_range_bs,
+		.mm		= &init_mm_bs,
+	};
 
 	BUG_ON_BS(addr >= end);
-	pgd = pgd_offset_k_bs(addr);
 	flush_cache_vunmap_bs(addr, end);
-	do {
-		next = pgd_addr_end_bs(addr, end);
-		if (pgd_none_or_clear_bad_bs(pgd))
-			continue;
-		vunmap_pud_range_bs(pgd, addr, next);
-	} while (pgd++, addr = next, addr != end);
+	walk_page_range_bs(addr, end, &walk);
 	flush_tlb_kernel_range_bs((unsigned long)area->addr, end);
 }
 
-static int vmap_pte_range_bs(pmd_t_bs *pmd, unsigned long addr,
-		unsigned long end, pgprot_t_bs prot, struct page_bs ***pages)
+struct vmap_walk_bs {
+	pgprot_t_bs prot;
+	struct page_bs ***pages;
+};
+
+static int vmap_pte_range_bs(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
 {
-	pte_t_bs *pte;
+	struct vmap_walk_bs *vw = walk->private;
+	struct page_bs **pages = *vw->pages;
 
-	pte = pte_alloc_kernel_bs(&init_mm_bs, pmd, addr);
-	if (!pte)
-		return -ENOMEM;
 	do {
-		struct page_bs *page = **pages;
+		struct page_bs *page = *pages;
 
 		WARN_ON_BS(!pte_none_bs(*pte));
 		if (!page)
-			return -ENOMEM;
-		set_pte_at_bs(&init_mm_bs, addr, pte, mk_pte_bs(page, prot));
-		(*pages)++;
+			break;
+		set_pte_at_bs(&init_mm_bs, addr, pte, mk_pte_bs(page, vw->prot));
+		pages++;
 	} while (pte++, addr += PAGE_SIZE, addr != end);
-	return 0;
-}
-
-static inline int vmap_pmd_range_bs(pud_t_bs *pud, unsigned long addr,
-		unsigned long end, pgprot_t_bs prot, struct page_bs ***pages)
-{
-	pmd_t_bs *pmd;
-	unsigned long next;
-
-	pmd = pmd_alloc_bs(&init_mm_bs, pud, addr);
-	if (!pmd)
-		return -ENOMEM;
-	do {
-		next = pmd_addr_end_bs(addr, end);
-		if (vmap_pte_range_bs(pmd, addr, next, prot, pages))
-			return -ENOMEM;
-	} while (pmd++, addr = next, addr != end);
-	return 0;
-}
-
-static inline int vmap_pud_range_bs(pgd_t_bs *pgd, unsigned long addr,
-		unsigned long end, pgprot_t_bs prot, struct page_bs ***pages)
-{
-	pud_t_bs *pud;
-	unsigned long next;
-
-	pud = pud_alloc_bs(&init_mm_bs, pgd, addr);
-	if (!pud)
-		return -ENOMEM;
-	do {
-		next = pud_addr_end_bs(addr, end);
-		if (vmap_pmd_range_bs(pud, addr, next, prot, pages))
-			return -ENOMEM;
-	} while (pud++, addr = next, addr != end);
-	return 0;
+	*vw->pages = pages;
+	return addr == end ? 0 : -ENOMEM;
 }
 
 int map_vm_area_bs(struct vm_struct_bs *area, pgprot_t_bs prot,
 						struct page_bs ***pages)
 {
-	pgd_t_bs *pgd;
-	unsigned long next;
 	unsigned long addr = (unsigned long)area->addr;
 	unsigned long end = addr + area->size - PAGE_SIZE_BS;
+	struct vmap_walk_bs vw = {
+		.prot		= prot,
+		.pages		= pages,
+	};
+	struct mm_walk_bs walk = {
+		.pte_entry	= vmap_pte_range_bs,
+		.mm		= &init_mm_bs,
+		.flags		= MM_WALK_ALLOC_BS,
+		.private	= &vw,
+	};
 	int err;
 
 	BUG_ON_BS(addr >= end);
-	pgd = pgd_offset_k_bs(addr);
 	spin_lock(&init_mm_bs.page_table_lock);
-	do {
-		next = pgd_addr_end_bs(addr, end);
-		err = vmap_pud_range_bs(pgd, addr, next, prot, pages);
-		if (err)
-			break;
-	} while (pgd++, addr = next, addr != end);
+	err = walk_page_range_bs(addr, end, &walk);
 	spin_unlock(&init_mm_bs.page_table_lock);
 	flush_cache_vmap_bs((unsigned long) area->addr, end);
 	return err;
@@ -160,9 +100,69 @@ int map_vm_area_bs(struct vm_struct_bs *area, pgprot_t_bs prot,
 
 #define IOREMAP_MAX_ORDER_BS	(7 + PAGE_SHIFT_BS)	/* 128 pages */
 
-struct vm_struct_bs *__get_vm_area_bs(unsigned long size, unsigned long flags,
-			unsigned long start, unsigned long end)
+/*
+ * Free gaps of the vmalloc area are bucketed by page order, the last
+ * bucket collects everything larger.
+ */
+#define VMALLOC_GAP_ORDERS_BS	16
+
+struct vmalloc_usage_bs {
+	unsigned long nr_areas;
+	unsigned long used;		/* bytes, including guard pages */
+	unsigned long free;
+	unsigned long largest_gap;
+	unsigned long gaps[VMALLOC_GAP_ORDERS_BS];
+};
+
+static void vmalloc_account_gap_bs(struct vmalloc_usage_bs *usage,
+						unsigned long size)
+{
+	int order = fls(size >> PAGE_SHIFT_BS) - 1;
+
+	if (order < 0)
+		order = 0;
+	if (order >= VMALLOC_GAP_ORDERS_BS)
+		order = VMALLOC_GAP_ORDERS_BS - 1;
+	usage->gaps[order]++;
+	usage->free += size;
+	if (size > usage->largest_gap)
+		usage->largest_gap = size;
+}
+
+/*
+ * Walk vmlist (sorted by address) and collect the used bytes and the
+ * free gaps between VMALLOC_START and VMALLOC_END.
+ *
+ * Caller must hold vmlist_lock.
+ */
+static void get_vmalloc_usage_bs(struct vmalloc_usage_bs *usage)
 {
+	unsigned long addr = VMALLOC_START_BS;
+	struct vm_struct_bs *tmp;
+
+	memset(usage, 0, sizeof(*usage));
+	for (tmp = vmlist_bs; tmp; tmp = tmp->next) {
+		unsigned long start = (unsigned long)tmp->addr;
+		unsigned long end = start + tmp->size;
+
+		if (end <= VMALLOC_START_BS || start >= VMALLOC_END_BS)
+			continue;
+		usage->nr_areas++;
+		usage->used += tmp->size;
+		if (start > addr)
+			vmalloc_account_gap_bs(usage, start - addr);
+		if (end > addr)
+			addr = end;
+	}
+	if (VMALLOC_END_BS > addr)
+		vmalloc_account_gap_bs(usage, VMALLOC_END_BS - addr);
+}
+
+static struct vm_struct_bs *__get_vm_area_caller_bs(unsigned long size,
+		unsigned long flags, unsigned long start, unsigned long end,
+		void *caller)
+{
+	struct vmalloc_usage_bs usage;
 	struct vm_struct_bs **p, *tmp, *area;
 	unsigned long align = 1;
 	unsigned long addr;
@@ -221,17 +221,29 @@ found:
 	area->pages = NULL;
 	area->nr_pages = 0;
 	area->phys_addr = 0;
+	area->caller = caller;
 	write_unlock(&vmlist_lock_bs);
 
 	return area;
 out:
+	get_vmalloc_usage_bs(&usage);
 	write_unlock(&vmlist_lock_bs);
 	kfree_bs(area);
 	printk(KERN_WARNING "allocation failed: out of vmalloc space - "
 				"use vmalloc=<size> to increase size.\n");
+	printk(KERN_WARNING "vmalloc: request %lu bytes, used %lu bytes, "
+			"free %lu bytes, largest gap %lu bytes\n",
+			size, usage.used, usage.free, usage.largest_gap);
 	return NULL;
 }
 
+struct vm_struct_bs *__get_vm_area_bs(unsigned long size, unsigned long flags,
+			unsigned long start, unsigned long end)
+{
+	return __get_vm_area_caller_bs(size, flags, start, end,
+					__builtin_return_address(0));
+}
+
 /**
  *      get_vm_area  -  reserve a contingous kernel virtual area
  *
@@ -244,7 +256,15 @@ out:
  */
 struct vm_struct_bs *get_vm_area_bs(unsigned long size, unsigned long flags)
 {
-	return __get_vm_area_bs(size, flags, VMALLOC_START_BS, VMALLOC_END_BS);
+	return __get_vm_area_caller_bs(size, flags, VMALLOC_START_BS,
+				VMALLOC_END_BS, __builtin_return_address(0));
+}
+
+static struct vm_struct_bs *get_vm_area_caller_bs(unsigned long size,
+				unsigned long flags, void *caller)
+{
+	return __get_vm_area_caller_bs(size, flags, VMALLOC_START_BS,
+					VMALLOC_END_BS, caller);
 }
 
 /* Caller must hold vmlist_lock */
@@ -407,7 +427,8 @@ void *vmap_bs(struct page_bs **pages, unsigned int count,
 	if (count > num_physpages_bs)
 		return NULL;
 
-	area = get_vm_area_bs((count << PAGE_SHIFT_BS), flags);
+	area = get_vm_area_caller_bs((count << PAGE_SHIFT_BS), flags,
+					__builtin_return_address(0));
 	if (!area)
 		return NULL;
 
@@ -448,8 +469,8 @@ EXPORT_SYMBOL_GPL(vfree_bs);
  *      allocator with @gfp_mask flags.  Map them into contiguous
  *      kernel virtual space, using a pagetable protection of @prot.
  */
-void *__vmalloc_bs(unsigned long size, unsigned int __nocast gfp_mask, 
-							pgprot_t_bs prot)
+static void *__vmalloc_caller_bs(unsigned long size,
+		unsigned int __nocast gfp_mask, pgprot_t_bs prot, void *caller)
 {
 	struct vm_struct_bs *area;
 
@@ -457,10 +478,19 @@ void *__vmalloc_bs(unsigned long size, unsigned int __nocast gfp_mask,
 	if (!size || (size >> PAGE_SHIFT_BS) > num_physpages_bs)
 		return NULL;
 
-	area = get_vm_area_bs(size, VM_ALLOC_BS);
+	area = get_vm_area_caller_bs(size, VM_ALLOC_BS, caller);
+	if (!area)
+		return NULL;
 
 	return __vmalloc_area_bs(area, gfp_mask, prot);
 }
+
+void *__vmalloc_bs(unsigned long size, unsigned int __nocast gfp_mask, 
+							pgprot_t_bs prot)
+{
+	return __vmalloc_caller_bs(size, gfp_mask, prot,
+					__builtin_return_address(0));
+}
 EXPORT_SYMBOL_GPL(__vmalloc_bs);
 
 /**     
@@ -476,8 +506,8 @@ EXPORT_SYMBOL_GPL(__vmalloc_bs);
  */ 
 void *vmalloc_bs(unsigned long size)
 {
-	return __vmalloc_bs(size, GFP_KERNEL_BS | __GFP_HIGHMEM_BS,
-					PAGE_KERNEL_BS);
+	return __vmalloc_caller_bs(size, GFP_KERNEL_BS | __GFP_HIGHMEM_BS,
+				PAGE_KERNEL_BS, __builtin_return_address(0));
 }
 EXPORT_SYMBOL_GPL(vmalloc_bs);
 
@@ -491,7 +521,8 @@ EXPORT_SYMBOL_GPL(vmalloc_bs);
  */
 void *vmalloc_32_bs(unsigned long size)
 {
-	return __vmalloc_bs(size, GFP_KERNEL_BS, PAGE_KERNEL_BS);
+	return __vmalloc_caller_bs(size, GFP_KERNEL_BS, PAGE_KERNEL_BS,
+					__builtin_return_address(0));
 }
 EXPORT_SYMBOL_GPL(vmalloc_32_bs);
 
@@ -512,8 +543,44 @@ EXPORT_SYMBOL_GPL(vmalloc_32_bs);
  */
 void *vmalloc_exec_bs(unsigned long size)
 {
-	return __vmalloc_bs(size, GFP_KERNEL_BS | __GFP_HIGHMEM_BS, 
-					PAGE_KERNEL_EXEC_BS);
+	return __vmalloc_caller_bs(size, GFP_KERNEL_BS | __GFP_HIGHMEM_BS, 
+			PAGE_KERNEL_EXEC_BS, __builtin_return_address(0));
+}
+
+/*
+ * Copy @count bytes between @buf and @addr inside @area. Pages of
+ * vmalloc()ed areas are copied a page at a time through kmap_local
+ * rather than through the vmalloc mapping, other areas are copied
+ * directly.
+ */
+static void vcopy_area_bs(struct vm_struct_bs *area, char *buf, char *addr,
+					unsigned long count, int write)
+{
+	while (count) {
+		unsigned long offset = addr - (char *)area->addr;
+		unsigned long idx = offset >> PAGE_SHIFT_BS;
+		unsigned long length;
+
+		offset &= ~PAGE_MASK_BS;
+		length = min_t(unsigned long, count, PAGE_SIZE_BS - offset);
+
+		if (area->pages && idx < area->nr_pages) {
+			if (write)
+				memcpy_to_page_bs(area->pages[idx], offset,
+							buf, length);
+			else
+				memcpy_from_page_bs(buf, area->pages[idx],
+							offset, length);
+		} else {
+			if (write)
+				memcpy(addr, buf, length);
+			else
+				memcpy(buf, addr, length);
+		}
+		buf += length;
+		addr += length;
+		count -= length;
+	}
 }
 
 long vread_bs(char *buf, char *addr, unsigned long count)
@@ -527,29 +594,25 @@ long vread_bs(char *buf, char *addr, unsigned long count)
 		count = -(unsigned long)addr;
 
 	read_lock(&vmlist_lock_bs);
-	for (tmp = vmlist_bs; tmp; tmp = tmp->next) {
+	for (tmp = vmlist_bs; count && tmp; tmp = tmp->next) {
 		vaddr = (char *)tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE_BS)
 			continue;
-		while (addr < vaddr) {
-			if (count == 0)
-				goto finished;
-			*buf = '\0';
-			buf++;
-			addr++;
-			count--;
+		if (addr < vaddr) {
+			/* holes between areas read as zero */
+			n = min_t(unsigned long, count, vaddr - addr);
+			memset(buf, 0, n);
+			buf += n;
+			addr += n;
+			count -= n;
 		}
-		n = vaddr + tmp->size - PAGE_SIZE_BS - addr;
-		do {
-			if (count == 0)
-				goto finished;
-			*buf = *addr;
-			buf++;
-			addr++;
-			count--;
-		} while (--n > 0);
+		n = min_t(unsigned long, count,
+				vaddr + tmp->size - PAGE_SIZE_BS - addr);
+		vcopy_area_bs(tmp, buf, addr, n, 0);
+		buf += n;
+		addr += n;
+		count -= n;
 	}
-finished:
 	read_unlock(&vmlist_lock_bs);
 	return buf - buf_start;
 }
@@ -565,28 +628,121 @@ long vwrite_bs(char *buf, char *addr, unsigned long count)
 		count -= (unsigned long) addr;
 
 	read_lock(&vmlist_lock_bs);
-	for (tmp = vmlist_bs; tmp; tmp = tmp->next) {
+	for (tmp = vmlist_bs; count && tmp; tmp = tmp->next) {
 		vaddr = (char *)tmp->addr;
 		if (addr >= vaddr + tmp->size - PAGE_SIZE_BS)
 			continue;
-		while (addr < vaddr) {
-			if (count == 0)
-				goto finished;
-			buf++;
-			addr++;
-			count--;
+		if (addr < vaddr) {
+			/* writes to holes between areas are dropped */
+			n = min_t(unsigned long, count, vaddr - addr);
+			buf += n;
+			addr += n;
+			count -= n;
 		}
-		n = vaddr + tmp->size - PAGE_SIZE_BS - addr;
-		do {
-			if (count == 0)
-				goto finished;
-			*addr = *buf;
-			buf++;
-			addr++;
-			count--;
-		} while (--n > 0);
+		n = min_t(unsigned long, count,
+				vaddr + tmp->size - PAGE_SIZE_BS - addr);
+		vcopy_area_bs(tmp, buf, addr, n, 1);
+		buf += n;
+		addr += n;
+		count -= n;
 	}
-finished:
 	read_unlock(&vmlist_lock_bs);
 	return buf - buf_start;
 }
+
+/*
+ * Position 0 is the summary, so it is printed even when vmlist is
+ * empty; areas start at position 1.
+ */
+static void *vmalloc_info_start_bs(struct seq_file *m, loff_t *pos)
+{
+	struct vm_struct_bs *v;
+	loff_t n = *pos;
+
+	read_lock(&vmlist_lock_bs);
+	if (!n)
+		return SEQ_START_TOKEN;
+
+	v = vmlist_bs;
+	while (--n > 0 && v)
+		v = v->next;
+	return v;
+}
+
+static void *vmalloc_info_next_bs(struct seq_file *m, void *p, loff_t *pos)
+{
+	struct vm_struct_bs *v = p;
+
+	++*pos;
+	if (p == SEQ_START_TOKEN)
+		return vmlist_bs;
+	return v->next;
+}
+
+static void vmalloc_info_stop_bs(struct seq_file *m, void *p)
+{
+	read_unlock(&vmlist_lock_bs);
+}
+
+static void vmalloc_info_summary_bs(struct seq_file *m)
+{
+	struct vmalloc_usage_bs usage;
+	int order;
+
+	get_vmalloc_usage_bs(&usage);
+	seq_printf(m, "vmalloc: 0x%08lx-0x%08lx %lu bytes\n",
+			VMALLOC_START_BS, VMALLOC_END_BS,
+			VMALLOC_END_BS - VMALLOC_START_BS);
+	seq_printf(m, "areas %lu used %lu free %lu largest_gap %lu\n",
+			usage.nr_areas, usage.used, usage.free,
+			usage.largest_gap);
+	seq_puts(m, "gaps (pages 2^n):");
+	for (order = 0; order < VMALLOC_GAP_ORDERS_BS; order++)
+		seq_printf(m, " %lu", usage.gaps[order]);
+	seq_putc(m, '\n');
+}
+
+static int vmalloc_info_show_bs(struct seq_file *m, void *p)
+{
+	struct vm_struct_bs *v = p;
+
+	if (p == SEQ_START_TOKEN) {
+		vmalloc_info_summary_bs(m);
+		return 0;
+	}
+
+	seq_printf(m, "0x%08lx-0x%08lx %8lu",
+		(unsigned long)v->addr, (unsigned long)v->addr + v->size,
+		v->size);
+
+	if (v->caller)
+		seq_printf(m, " %pS", v->caller);
+	if (v->nr_pages)
+		seq_printf(m, " pages=%u", v->nr_pages);
+	if (v->phys_addr)
+		seq_printf(m, " phys=%lx", v->phys_addr);
+	if (v->flags & VM_IOREMAP_BS)
+		seq_puts(m, " ioremap");
+	if (v->flags & VM_ALLOC_BS)
+		seq_puts(m, " vmalloc");
+	if (v->flags & VM_MAP_BS)
+		seq_puts(m, " vmap");
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/*
+ * vmallocinfo_op - iterator that generates /proc/vmallocinfo_bs
+ *
+ * Output layout:
+ * summary of the vmalloc area: used bytes, free bytes, largest free
+ * gap and a histogram of free gaps by page order, followed by one
+ * line per live vm_struct: range, size (including the guard page),
+ * allocating call site, nr_pages, phys_addr and flags.
+ */
+struct seq_operations vmallocinfo_op_bs = {
+	.start	= vmalloc_info_start_bs,
+	.next	= vmalloc_info_next_bs,
+	.stop	= vmalloc_info_stop_bs,
+	.show	= vmalloc_info_show_bs,
+};
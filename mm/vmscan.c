@@ -14,6 +14,8 @@
 #include <linux/kernel.h>
 #include <linux/sched.h>
 #include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/rwsem.h>
 #include <linux/swap.h>
 #include "biscuitos/kernel.h"
 #include "biscuitos/init.h"
@@ -25,7 +27,11 @@
 #include "biscuitos/page-flags.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/pagevec.h"
+#include "biscuitos/mm_inline.h"
 #include "biscuitos/rmap.h"
+#include "biscuitos/compaction.h"
+#include "asm-generated/pgtable.h"
+#include "asm-generated/tlbflush.h"
 
 struct scan_control_bs {
 	/* Ask refill_inactive_zone, or shrink_cache to scan this many pages */
@@ -55,6 +61,12 @@ struct scan_control_bs {
 	 * In this context, it doesn't matter that we scan the
 	 * whole list at once. */
 	int swap_cluster_max;
+
+	/*
+	 * Reclaiming for kswapd.  Taken from the reclaiming task once, so
+	 * that reclaim workers scanning on its behalf account like it.
+	 */
+	int kswapd;
 };
 
 #define lru_to_page_bs(_head)	(list_entry((_head)->prev, struct page_bs, lru))
@@ -79,8 +91,116 @@ struct scan_control_bs {
 int vm_swappiness_bs = 60;
 static long total_memory_bs;
 
+static LIST_HEAD(shrinker_list_bs);
+static DECLARE_RWSEM(shrinker_rwsem_bs);
+
+#define SHRINK_BATCH_BS	128
+
+/*
+ * Add a shrinker callback to be called from the vm
+ */
+void register_shrinker_bs(struct shrinker_bs *shrinker)
+{
+	if (!shrinker->batch)
+		shrinker->batch = SHRINK_BATCH_BS;
+	if (!shrinker->seeks)
+		shrinker->seeks = DEFAULT_SEEKS_BS;
+	shrinker->nr = 0;
+	down_write(&shrinker_rwsem_bs);
+	list_add_tail(&shrinker->list, &shrinker_list_bs);
+	up_write(&shrinker_rwsem_bs);
+}
+EXPORT_SYMBOL_GPL(register_shrinker_bs);
+
+/*
+ * Remove one
+ */
+void unregister_shrinker_bs(struct shrinker_bs *shrinker)
+{
+	down_write(&shrinker_rwsem_bs);
+	list_del(&shrinker->list);
+	up_write(&shrinker_rwsem_bs);
+}
+EXPORT_SYMBOL_GPL(unregister_shrinker_bs);
+
+/*
+ * Call the shrink functions to age shrinkable caches
+ *
+ * Here we assume it costs one seek to replace a lru page and that it also
+ * takes a seek to recreate a cache object.  With this in mind we age equal
+ * percentages of the lru and ageable caches.  This should balance the seeks
+ * generated by these structures.
+ *
+ * If the vm encounted mapped pages on the LRU it increase the pressure on
+ * slab to avoid swapping.
+ *
+ * We do weird things to avoid (scanned*seeks*entries) overflowing 32 bits.
+ *
+ * `lru_pages' represents the number of on-LRU pages in all the zones which
+ * are eligible for the caller's allocation attempt.  It is used for balancing
+ * slab reclaim versus page reclaim.
+ *
+ * Returns the number of objects the shrinkers freed.  The pages behind
+ * them show up in current->reclaim_state as they are released.
+ */
+static unsigned long shrink_slab_bs(unsigned long scanned,
+			unsigned int gfp_mask, unsigned long lru_pages)
+{
+	struct shrinker_bs *shrinker;
+	unsigned long freed = 0;
+
+	if (scanned == 0)
+		scanned = SWAP_CLUSTER_MAX_BS;
+
+	if (!down_read_trylock(&shrinker_rwsem_bs))
+		return 0;	/* Assume we'll be able to shrink next time */
+
+	list_for_each_entry(shrinker, &shrinker_list_bs, list) {
+		struct shrink_control_bs sc = { .gfp_mask = gfp_mask, };
+		unsigned long long delta;
+		unsigned long total_scan;
+		unsigned long max_pass;
+
+		max_pass = shrinker->count_objects(shrinker, &sc);
+		if (max_pass == 0)
+			continue;
+
+		delta = (4 * scanned) / shrinker->seeks;
+		delta *= max_pass;
+		do_div(delta, lru_pages + 1);
+		shrinker->nr += delta;
+		if (shrinker->nr < 0)
+			shrinker->nr = max_pass;
+		/* Never ask for more than twice what is there */
+		if (shrinker->nr > max_pass * 2)
+			shrinker->nr = max_pass * 2;
+
+		total_scan = shrinker->nr;
+		shrinker->nr = 0;
+
+		while (total_scan >= shrinker->batch) {
+			unsigned long ret;
+
+			sc.nr_to_scan = shrinker->batch;
+			ret = shrinker->scan_objects(shrinker, &sc);
+			if (ret == SHRINK_STOP_BS)
+				break;
+			freed += ret;
+			mod_page_state_bs(slabs_scanned, shrinker->batch);
+			total_scan -= shrinker->batch;
+
+			cond_resched();
+		}
+
+		shrinker->nr += total_scan;
+	}
+	up_read(&shrinker_rwsem_bs);
+	return freed;
+}
+
+#ifndef CONFIG_LRU_GEN_BS
 /*
- * zone->lru_lock is heavily contended.  Some of the functions that
+ * The LRU sublist locks are heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
@@ -104,7 +224,6 @@ static int isolate_lru_pages_bs(int nr_to_scan, struct list_head *src,
 	int scan = 0;
 
 	while (scan++ < nr_to_scan && !list_empty(src)) {
-		BS_DUP();
 		page = lru_to_page_bs(src);
 		prefetchw_prev_lru_page_bs(page, src, flags);
 
@@ -128,6 +247,535 @@ static int isolate_lru_pages_bs(int nr_to_scan, struct list_head *src,
 	*scanned = scan;
 	return nr_taken;
 }
+#endif /* !CONFIG_LRU_GEN_BS */
+
+/* Called without lock on whether page is mapped, so answer is unstable */
+static inline int page_mapping_inuse_bs(struct page_bs *page)
+{
+	struct address_space *mapping;
+
+	/* Page is in somebody's page tables. */
+	if (page_mapped_bs(page))
+		return 1;
+
+	/* Be more reluctant to reclaim swapcache than pagecache */
+	if (PageSwapCache_bs(page))
+		return 1;
+
+	mapping = page->mapping;
+	if (!mapping || PageAnon_bs(page))
+		return 0;
+
+	/* File is mmap'd by somebody? */
+	return mapping_mapped(mapping);
+}
+
+/*
+ * Detach a clean, unmapped page from whoever handed it to the LRU.
+ *
+ * There is no radix-tree page cache behind page->mapping here, so the
+ * only pages we can give back are those owned by nobody but the LRU:
+ * no file mapping and no other reference than the one the LRU owner
+ * holds plus the one isolate_lru_pages() took.  That owner reference is
+ * dropped here, exactly as remove_from_page_cache() would drop the
+ * pagecache's reference.  Returns 1 if the page may be freed.
+ */
+static int remove_mapping_bs(struct page_bs *page)
+{
+	if (page->mapping && !PageAnon_bs(page))
+		return 0;
+
+	/*
+	 * The non-racy check for busy page.  It is critical to check
+	 * PageDirty _after_ making sure that the page is freeable and
+	 * not in use by anybody.  (pagecache + us == 2)
+	 */
+	if (page_count_bs(page) != 2 || PageDirty_bs(page))
+		return 0;
+
+	page->mapping = NULL;
+	__put_page_bs(page);	/* The owner's ref */
+	return 1;
+}
+
+/*
+ * shrink_list returns the number of reclaimed pages
+ */
+static int shrink_list_bs(struct list_head *page_list,
+					struct scan_control_bs *sc)
+{
+	LIST_HEAD(ret_pages);
+	struct pagevec_bs freed_pvec;
+	int pgactivate = 0;
+	int reclaimed = 0;
+
+	cond_resched();
+
+	pagevec_init_bs(&freed_pvec, 1);
+	while (!list_empty(page_list)) {
+		struct page_bs *page;
+		int referenced;
+
+		cond_resched();
+
+		page = lru_to_page_bs(page_list);
+		list_del(&page->lru);
+
+		if (TestSetPageLocked_bs(page))
+			goto keep;
+
+		BUG_ON_BS(PageActive_bs(page));
+
+		sc->nr_scanned++;
+		/* Double the slab pressure for mapped and swapcache pages */
+		if (page_mapped_bs(page) || PageSwapCache_bs(page))
+			sc->nr_scanned++;
+
+		if (PageWriteback_bs(page))
+			goto keep_locked;
+
+#ifdef CONFIG_LRU_GEN_BS
+		/*
+		 * Aging has already harvested the accessed bits with a
+		 * page table walk; anything still this old was not used.
+		 */
+		referenced = 0;
+#else
+		/*
+		 * The rmap walk may sleep on anon_vma->lock, which is why
+		 * it runs here on the private list and not under the
+		 * LRU sublist lock.
+		 */
+		referenced = page_referenced_bs(page, 1, sc->priority <= 0);
+#endif
+		/* In active use or really unfreeable?  Activate it. */
+		if (referenced && page_mapping_inuse_bs(page))
+			goto activate_locked;
+
+		/*
+		 * Nothing here can unmap a page from user page tables or
+		 * start writeback, so mapped, dirty and buffer-backed pages
+		 * stay where they are.
+		 */
+		if (page_mapped_bs(page) || PageDirty_bs(page) ||
+							PagePrivate_bs(page))
+			goto keep_locked;
+
+		if (!remove_mapping_bs(page))
+			goto keep_locked;
+
+		ClearPageLocked_bs(page);
+		reclaimed++;
+		if (!pagevec_add_bs(&freed_pvec, page))
+			__pagevec_release_nonlru_bs(&freed_pvec);
+		continue;
+
+activate_locked:
+		SetPageActive_bs(page);
+		pgactivate++;
+keep_locked:
+		ClearPageLocked_bs(page);
+keep:
+		list_add(&page->lru, &ret_pages);
+		BUG_ON_BS(PageLRU_bs(page));
+	}
+	list_splice(&ret_pages, page_list);
+	if (pagevec_count_bs(&freed_pvec))
+		__pagevec_release_nonlru_bs(&freed_pvec);
+	mod_page_state_bs(pgactivate, pgactivate);
+	sc->nr_reclaimed += reclaimed;
+	return reclaimed;
+}
+
+#ifdef CONFIG_LRU_GEN_BS
+/*
+ * Multi-generational LRU
+ *
+ * Rather than asking rmap about every page at the tail of the inactive
+ * list, aging walks the page tables of every registered mm once and moves
+ * each page whose pte is young into the youngest generation.  Eviction
+ * then simply takes pages from the oldest generation.  Pages nobody maps
+ * carry their accessed bit in PG_referenced, which is checked as they
+ * are scanned.
+ *
+ * The walk goes through walk_page_range() and covers only the user part
+ * of each registered mm, below TASK_SIZE: on ARM an old pte has no
+ * hardware entry, so only mappings that can take a fault to set the
+ * young bit again may be aged this way, never the kernel's own.
+ */
+static LIST_HEAD(lru_gen_mm_list_bs);
+static DEFINE_SPINLOCK(lru_gen_mm_lock_bs);
+
+void lru_gen_add_mm_bs(struct mm_struct_bs *mm)
+{
+	spin_lock(&lru_gen_mm_lock_bs);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list_bs);
+	spin_unlock(&lru_gen_mm_lock_bs);
+}
+EXPORT_SYMBOL_GPL(lru_gen_add_mm_bs);
+
+void lru_gen_del_mm_bs(struct mm_struct_bs *mm)
+{
+	spin_lock(&lru_gen_mm_lock_bs);
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock_bs);
+}
+EXPORT_SYMBOL_GPL(lru_gen_del_mm_bs);
+
+void __init lru_gen_init_sublist_bs(struct lru_sublist_bs *lru)
+{
+	struct lru_gen_bs *lrugen = &lru->lrugen;
+	int gen;
+
+	for (gen = 0; gen < MAX_NR_GENS_BS; gen++) {
+		INIT_LIST_HEAD(&lrugen->lists[gen]);
+		lrugen->nr_pages[gen] = 0;
+	}
+	lrugen->min_seq = 0;
+	lrugen->max_seq = MIN_NR_GENS_BS - 1;
+}
+
+static inline int lru_gen_nr_gens_bs(struct lru_gen_bs *lrugen)
+{
+	return lrugen->max_seq - lrugen->min_seq + 1;
+}
+
+/*
+ * Move a batch of young pages into the youngest generation of their
+ * sublists.  The pages are pinned by the ptes they were found through.
+ */
+static void lru_gen_promote_bs(struct pagevec_bs *pvec)
+{
+	struct lru_sublist_bs *lru = NULL;
+	int i;
+
+	for (i = 0; i < pagevec_count_bs(pvec); i++) {
+		struct page_bs *page = pvec->pages[i];
+		struct lru_sublist_bs *pagelru = page_lru_sublist_bs(page);
+
+		if (pagelru != lru) {
+			if (lru)
+				spin_unlock_irq(&lru->lock);
+			lru = pagelru;
+			spin_lock_irq(&lru->lock);
+		}
+		/* Isolated by reclaim, or already young */
+		if (!PageLRU_bs(page) || page_lru_active_bs(lru, page))
+			continue;
+		lru_gen_del_page_bs(lru, page);
+		add_page_to_active_list_bs(lru, page);
+	}
+	if (lru)
+		spin_unlock_irq(&lru->lock);
+	pagevec_reinit_bs(pvec);
+}
+
+struct lru_gen_walk_bs {
+	struct zone_bs *zone;
+	struct pagevec_bs pvec;
+};
+
+/*
+ * pte_entry callback for the aging walk: clear the young bit of every
+ * pte that maps a page of the zone being aged and promote those pages.
+ */
+static int lru_gen_walk_pte_bs(pte_t_bs *pte, unsigned long addr,
+			unsigned long end, struct mm_walk_bs *walk)
+{
+	struct lru_gen_walk_bs *gw = walk->private;
+
+	do {
+		struct page_bs *page;
+		unsigned long pfn;
+
+		if (!pte_present_bs(*pte) || !pte_young_bs(*pte))
+			continue;
+		pfn = pte_pfn_bs(*pte);
+		if (!pfn_valid_bs(pfn))
+			continue;
+		page = pfn_to_page_bs(pfn);
+		if (page_zone_bs(page) != gw->zone)
+			continue;
+
+		set_pte_at_bs(walk->mm, addr, pte, pte_mkold_bs(*pte));
+		if (!pagevec_add_bs(&gw->pvec, page))
+			lru_gen_promote_bs(&gw->pvec);
+	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
+	return 0;
+}
+
+/*
+ * Open a new youngest generation on every sublist of the zone and fill
+ * it with every page that was touched through a page table since the
+ * last aging pass.
+ */
+static void lru_gen_age_bs(struct zone_bs *zone)
+{
+	struct lru_gen_walk_bs gw = { .zone = zone };
+	struct mm_walk_bs walk = {
+		.pte_entry	= lru_gen_walk_pte_bs,
+		.private	= &gw,
+	};
+	int i;
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++) {
+		struct lru_sublist_bs *lru = &zone->lru[i];
+
+		spin_lock_irq(&lru->lock);
+		if (lru_gen_nr_gens_bs(&lru->lrugen) < MAX_NR_GENS_BS)
+			lru->lrugen.max_seq++;
+		spin_unlock_irq(&lru->lock);
+	}
+
+	pagevec_init_bs(&gw.pvec, 0);
+	spin_lock(&lru_gen_mm_lock_bs);
+	list_for_each_entry(walk.mm, &lru_gen_mm_list_bs, lru_gen_list) {
+		spin_lock(&walk.mm->page_table_lock);
+		walk_page_range_bs(0, TASK_SIZE_BS, &walk);
+		/* The pvec pages are pinned by the ptes until we unlock */
+		if (pagevec_count_bs(&gw.pvec))
+			lru_gen_promote_bs(&gw.pvec);
+		spin_unlock(&walk.mm->page_table_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock_bs);
+	flush_tlb_all_bs();
+}
+
+/*
+ * Retire empty generations at the old end.  Returns the generation to
+ * evict from, or -1 if only MIN_NR_GENS remain and aging must run first.
+ * Called with the sublist lock held.
+ */
+static int lru_gen_evictable_bs(struct lru_gen_bs *lrugen)
+{
+	while (lru_gen_nr_gens_bs(lrugen) > MIN_NR_GENS_BS) {
+		int gen = lru_gen_from_seq_bs(lrugen->min_seq);
+
+		if (lrugen->nr_pages[gen])
+			return gen;
+		lrugen->min_seq++;
+	}
+	return -1;
+}
+
+/*
+ * Take up to nr_to_scan pages off the oldest generation.  Pages with
+ * PG_referenced set are promoted in place instead of being isolated.
+ */
+static int lru_gen_isolate_bs(struct lru_sublist_bs *lru, int gen,
+		int nr_to_scan, struct list_head *dst, int *scanned)
+{
+	struct list_head *src = &lru->lrugen.lists[gen];
+	struct page_bs *page;
+	int nr_taken = 0;
+	int scan = 0;
+
+	while (scan++ < nr_to_scan && !list_empty(src)) {
+		page = lru_to_page_bs(src);
+		prefetchw_prev_lru_page_bs(page, src, flags);
+
+		if (TestClearPageReferenced_bs(page)) {
+			lru_gen_del_page_bs(lru, page);
+			add_page_to_active_list_bs(lru, page);
+			continue;
+		}
+		if (get_page_testone_bs(page)) {
+			/*
+			 * It is being freed elsewhere
+			 */
+			__put_page_bs(page);
+			list_move(&page->lru, src);
+			continue;
+		}
+		if (!TestClearPageLRU_bs(page))
+			BUG_BS();
+		lru_gen_del_page_bs(lru, page);
+		list_add(&page->lru, dst);
+		nr_taken++;
+	}
+
+	*scanned = scan;
+	return nr_taken;
+}
+
+/*
+ * Find a sublist with a generation old enough to evict, starting at
+ * *cursor.  Returns with that sublist's lock held, or NULL if every
+ * sublist needs aging first.
+ */
+static struct lru_sublist_bs *
+lru_gen_next_sublist_bs(struct zone_bs *zone, unsigned int *cursor, int *gen)
+{
+	int i;
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++) {
+		struct lru_sublist_bs *lru;
+
+		lru = &zone->lru[(*cursor)++ & (NR_LRU_SUBLISTS_BS - 1)];
+		spin_lock_irq(&lru->lock);
+		*gen = lru_gen_evictable_bs(&lru->lrugen);
+		if (*gen >= 0)
+			return lru;
+		spin_unlock_irq(&lru->lock);
+	}
+	return NULL;
+}
+
+/*
+ * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
+ *
+ * The generational counterpart of shrink_cache(): evict from the oldest
+ * generation, aging when there is nothing left old enough to evict.
+ */
+static void
+shrink_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
+{
+	LIST_HEAD(page_list);
+	struct pagevec_bs pvec;
+	unsigned long nr_to_scan;
+	unsigned int cursor = raw_smp_processor_id();
+	int nr_aged = 0;
+
+	zone->nr_scan_inactive += (zone_nr_inactive_bs(zone) >>
+							sc->priority) + 1;
+	nr_to_scan = zone->nr_scan_inactive;
+	if (nr_to_scan < sc->swap_cluster_max)
+		return;
+	zone->nr_scan_inactive = 0;
+	sc->nr_to_reclaim = sc->swap_cluster_max;
+
+	pagevec_init_bs(&pvec, 1);
+	lru_add_drain_bs();
+	while (nr_to_scan > 0 && sc->nr_to_reclaim > 0) {
+		struct lru_sublist_bs *lru;
+		struct page_bs *page;
+		int gen, nr_taken, nr_scan, nr_freed;
+
+		lru = lru_gen_next_sublist_bs(zone, &cursor, &gen);
+		if (!lru) {
+			/* Everything left has been used since the last pass */
+			if (nr_aged++ >= MAX_NR_GENS_BS)
+				break;
+			lru_gen_age_bs(zone);
+			continue;
+		}
+		nr_taken = lru_gen_isolate_bs(lru, gen,
+				min(nr_to_scan, (unsigned long)sc->swap_cluster_max),
+				&page_list, &nr_scan);
+		atomic_long_add(nr_scan, &zone->pages_scanned);
+		spin_unlock_irq(&lru->lock);
+
+		nr_to_scan -= min(nr_to_scan, (unsigned long)nr_scan);
+		if (nr_taken == 0)
+			continue;
+
+		if (sc->kswapd)
+			mod_page_state_zone_bs(zone, pgscan_kswapd, nr_scan);
+		else
+			mod_page_state_zone_bs(zone, pgscan_direct, nr_scan);
+		nr_freed = shrink_list_bs(&page_list, sc);
+		if (sc->kswapd)
+			mod_page_state_bs(kswapd_steal, nr_freed);
+		mod_page_state_zone_bs(zone, pgsteal, nr_freed);
+		sc->nr_to_reclaim -= nr_freed;
+
+		/*
+		 * Put back any unfreeable pages: activated ones to the
+		 * youngest generation, the rest one generation up so that
+		 * the next pass does not trip over them straight away.
+		 */
+		spin_lock_irq(&lru->lock);
+		while (!list_empty(&page_list)) {
+			page = lru_to_page_bs(&page_list);
+			if (TestSetPageLRU_bs(page))
+				BUG_BS();
+			list_del(&page->lru);
+			if (PageActive_bs(page))
+				add_page_to_active_list_bs(lru, page);
+			else
+				lru_gen_add_page_bs(lru, page,
+				  lru_gen_from_seq_bs(lru->lrugen.min_seq + 1));
+			if (!pagevec_add_bs(&pvec, page)) {
+				spin_unlock_irq(&lru->lock);
+				__pagevec_release_bs(&pvec);
+				spin_lock_irq(&lru->lock);
+			}
+		}
+		spin_unlock_irq(&lru->lock);
+	}
+	pagevec_release_bs(&pvec);
+}
+#else /* !CONFIG_LRU_GEN_BS */
+
+/*
+ * shrink_cache() adds the number of pages reclaimed to sc->nr_reclaimed
+ *
+ * Pages are taken off the inactive list of one LRU sublist
+ * SWAP_CLUSTER_MAX at a time under the sublist lock, and shrink_list() then
+ * works on that private batch with the lock dropped.  Whatever it could not free goes back in one pass.
+ */
+static void shrink_cache_bs(struct zone_bs *zone, struct lru_sublist_bs *lru,
+						struct scan_control_bs *sc)
+{
+	LIST_HEAD(page_list);
+	struct pagevec_bs pvec;
+	int max_scan = sc->nr_to_scan;
+
+	pagevec_init_bs(&pvec, 1);
+
+	lru_add_drain_bs();
+	spin_lock_irq(&lru->lock);
+	while (max_scan > 0) {
+		struct page_bs *page;
+		int nr_taken;
+		int nr_scan;
+		int nr_freed;
+
+		nr_taken = isolate_lru_pages_bs(sc->swap_cluster_max,
+					&lru->inactive_list,
+					&page_list, &nr_scan);
+		lru->nr_inactive -= nr_taken;
+		atomic_long_add(nr_scan, &zone->pages_scanned);
+		spin_unlock_irq(&lru->lock);
+
+		if (nr_taken == 0)
+			goto done;
+
+		max_scan -= nr_scan;
+		if (sc->kswapd)
+			mod_page_state_zone_bs(zone, pgscan_kswapd, nr_scan);
+		else
+			mod_page_state_zone_bs(zone, pgscan_direct, nr_scan);
+		nr_freed = shrink_list_bs(&page_list, sc);
+		if (sc->kswapd)
+			mod_page_state_bs(kswapd_steal, nr_freed);
+		mod_page_state_zone_bs(zone, pgsteal, nr_freed);
+		sc->nr_to_reclaim -= nr_freed;
+
+		spin_lock_irq(&lru->lock);
+		/*
+		 * Put back any unfreeable pages.
+		 */
+		while (!list_empty(&page_list)) {
+			page = lru_to_page_bs(&page_list);
+			if (TestSetPageLRU_bs(page))
+				BUG_BS();
+			list_del(&page->lru);
+			if (PageActive_bs(page))
+				add_page_to_active_list_bs(lru, page);
+			else
+				add_page_to_inactive_list_bs(lru, page);
+			if (!pagevec_add_bs(&pvec, page)) {
+				spin_unlock_irq(&lru->lock);
+				__pagevec_release_bs(&pvec);
+				spin_lock_irq(&lru->lock);
+			}
+		}
+	}
+	spin_unlock_irq(&lru->lock);
+done:
+	pagevec_release_bs(&pvec);
+}
 
 /*
  * This moves pages from the active list to the inactive list.
@@ -136,9 +784,9 @@ static int isolate_lru_pages_bs(int nr_to_scan, struct list_head *src,
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone->lru_lock across the whole operation.  But if
+ * appropriate to hold the LRU lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone->lru_lock around each page.  It's impossible to balance
+ * should drop the LRU lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -147,7 +795,8 @@ static int isolate_lru_pages_bs(int nr_to_scan, struct list_head *src,
  * But we had to alter page->flags anyway.
  */
 static void
-refill_inactive_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
+refill_inactive_zone_bs(struct zone_bs *zone, struct lru_sublist_bs *lru,
+						struct scan_control_bs *sc)
 {
 	int pgmoved;
 	int pgscanned;
@@ -156,18 +805,20 @@ refill_inactive_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
 	LIST_HEAD(l_inactive);	/* Pages to go onto the inactive_list */
 	LIST_HEAD(l_active);	/* Pages to go onto the active_list */
 	struct page_bs *page;
+	struct pagevec_bs pvec;
 	int reclaim_mapped = 0;
 	long mapped_ration;
 	long distress;
 	long swap_tendency;
+	int pgdeactivate = 0;
 
 	lru_add_drain_bs();
-	spin_lock_irq(&zone->lru_lock);
-	pgmoved = isolate_lru_pages_bs(nr_pages, &zone->active_list,
+	spin_lock_irq(&lru->lock);
+	pgmoved = isolate_lru_pages_bs(nr_pages, &lru->active_list,
 				&l_hold, &pgscanned);
-	zone->pages_scanned += pgscanned;
-	zone->nr_active -= pgmoved;
-	spin_unlock_irq(&zone->lru_lock);
+	atomic_long_add(pgscanned, &zone->pages_scanned);
+	lru->nr_active -= pgmoved;
+	spin_unlock_irq(&lru->lock);
 
 	/*
 	 * `distress' is a measure of how much trouble we're having reclaiming
@@ -200,19 +851,191 @@ refill_inactive_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
 	if (swap_tendency >= 100)
 		reclaim_mapped = 1;
 
-	BS_DUP();
 	while (!list_empty(&l_hold)) {
+		int referenced[PAGEVEC_SIZE_BS];
+		int i;
+
 		cond_resched();
-		page = lru_to_page_bs(&l_hold);
-		list_del(&page->lru);
-		if (page_mapped_bs(page)) {
-			if (!reclaim_mapped ||
-			   (total_swap_pages_bs == 0 && PageAnon_bs(page)) ||
-			    page_referenced_bs(page, 0, sc->priority <= 0)) {
-				list_add(&page->lru, &l_active);
+		/*
+		 * Mapped pages are collected into a pagevec so the rmap
+		 * walk visits each PTE table once for the whole batch.
+		 */
+		pagevec_init_bs(&pvec, 0);
+		while (!list_empty(&l_hold) && pagevec_space_bs(&pvec)) {
+			page = lru_to_page_bs(&l_hold);
+			list_del(&page->lru);
+			if (page_mapped_bs(page)) {
+				if (!reclaim_mapped ||
+				   (total_swap_pages_bs == 0 &&
+						PageAnon_bs(page)))
+					list_add(&page->lru, &l_active);
+				else
+					pagevec_add_bs(&pvec, page);
 				continue;
 			}
+			list_add(&page->lru, &l_inactive);
+		}
+
+		page_referenced_batch_bs(&pvec, referenced, 0,
+						sc->priority <= 0);
+		for (i = 0; i < pagevec_count_bs(&pvec); i++)
+			list_add(&pvec.pages[i]->lru, referenced[i] ?
+						&l_active : &l_inactive);
+	}
+
+	pagevec_init_bs(&pvec, 1);
+	pgmoved = 0;
+	spin_lock_irq(&lru->lock);
+	while (!list_empty(&l_inactive)) {
+		page = lru_to_page_bs(&l_inactive);
+		prefetchw_prev_lru_page_bs(page, &l_inactive, flags);
+		if (TestSetPageLRU_bs(page))
+			BUG_BS();
+		if (!TestClearPageActive_bs(page))
+			BUG_BS();
+		list_move(&page->lru, &lru->inactive_list);
+		pgmoved++;
+		if (!pagevec_add_bs(&pvec, page)) {
+			lru->nr_inactive += pgmoved;
+			spin_unlock_irq(&lru->lock);
+			pgdeactivate += pgmoved;
+			pgmoved = 0;
+			__pagevec_release_bs(&pvec);
+			spin_lock_irq(&lru->lock);
+		}
+	}
+	lru->nr_inactive += pgmoved;
+	pgdeactivate += pgmoved;
+
+	pgmoved = 0;
+	while (!list_empty(&l_active)) {
+		page = lru_to_page_bs(&l_active);
+		prefetchw_prev_lru_page_bs(page, &l_active, flags);
+		if (TestSetPageLRU_bs(page))
+			BUG_BS();
+		BUG_ON_BS(!PageActive_bs(page));
+		list_move(&page->lru, &lru->active_list);
+		pgmoved++;
+		if (!pagevec_add_bs(&pvec, page)) {
+			lru->nr_active += pgmoved;
+			pgmoved = 0;
+			spin_unlock_irq(&lru->lock);
+			__pagevec_release_bs(&pvec);
+			spin_lock_irq(&lru->lock);
+		}
+	}
+	lru->nr_active += pgmoved;
+	spin_unlock_irq(&lru->lock);
+	pagevec_release_bs(&pvec);
+
+	mod_page_state_zone_bs(zone, pgrefill, pgscanned);
+	mod_page_state_bs(pgdeactivate, pgdeactivate);
+}
+
+/*
+ * Scan one LRU sublist: nr_active pages off its active list and
+ * nr_inactive off its inactive list, a batch at a time, until the scan
+ * target or sc->nr_to_reclaim is met.
+ */
+static void
+shrink_lru_sublist_bs(struct zone_bs *zone, struct lru_sublist_bs *lru,
+		unsigned long nr_active, unsigned long nr_inactive,
+		struct scan_control_bs *sc)
+{
+	while (nr_active || nr_inactive) {
+		if (nr_active) {
+			sc->nr_to_scan = min(nr_active,
+					(unsigned long)sc->swap_cluster_max);
+			nr_active -= sc->nr_to_scan;
+			refill_inactive_zone_bs(zone, lru, sc);
+		}
+
+		if (nr_inactive) {
+			sc->nr_to_scan = min(nr_inactive,
+					(unsigned long)sc->swap_cluster_max);
+			nr_inactive -= sc->nr_to_scan;
+			shrink_cache_bs(zone, lru, sc);
+			if (sc->nr_to_reclaim <= 0)
+				break;
+		}
+	}
+}
+
+/*
+ * Parallel reclaim.  Once a zone's scan target is big enough to give
+ * every sublist at least a full batch, shrink_zone() hands each other
+ * sublist to the reclaim workqueue as one work item with a private
+ * scan_control, scans the sublist of its own CPU meanwhile, then waits
+ * for the workers and folds their counts back into the caller's
+ * scan_control.  The zone's priorities are set by the caller before
+ * the split, so fairness between zones is unchanged.
+ */
+#define RECLAIM_PARALLEL_MIN_BS	(NR_LRU_SUBLISTS_BS * SWAP_CLUSTER_MAX_BS)
+
+static struct workqueue_struct *reclaim_wq_bs;
+
+struct reclaim_work_bs {
+	struct work_struct	work;
+	struct zone_bs		*zone;
+	struct lru_sublist_bs	*lru;
+	unsigned long		nr_active;
+	unsigned long		nr_inactive;
+	struct scan_control_bs	sc;		/* carries the requester's context */
+};
+
+static void shrink_lru_work_bs(struct work_struct *work)
+{
+	struct reclaim_work_bs *rw =
+			container_of(work, struct reclaim_work_bs, work);
+
+	/*
+	 * This runs on a shared host kworker, so its task flags are left
+	 * alone: whether we reclaim for kswapd comes with rw->sc, and the
+	 * sublist scan itself never allocates.
+	 */
+	shrink_lru_sublist_bs(rw->zone, rw->lru, rw->nr_active,
+					rw->nr_inactive, &rw->sc);
+}
+
+static void
+shrink_zone_parallel_bs(struct zone_bs *zone, unsigned long nr_active,
+		unsigned long nr_inactive, struct scan_control_bs *sc)
+{
+	struct reclaim_work_bs works[NR_LRU_SUBLISTS_BS];
+	int self = raw_smp_processor_id() & (NR_LRU_SUBLISTS_BS - 1);
+	int i;
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++) {
+		struct reclaim_work_bs *rw = &works[i];
+
+		rw->zone = zone;
+		rw->lru = &zone->lru[i];
+		rw->nr_active = DIV_ROUND_UP(nr_active, NR_LRU_SUBLISTS_BS);
+		rw->nr_inactive = DIV_ROUND_UP(nr_inactive, NR_LRU_SUBLISTS_BS);
+		rw->sc = *sc;
+		rw->sc.nr_scanned = 0;
+		rw->sc.nr_reclaimed = 0;
+		rw->sc.nr_to_reclaim = DIV_ROUND_UP(sc->nr_to_reclaim,
+							NR_LRU_SUBLISTS_BS);
+		if (i == self)
+			continue;
+		INIT_WORK_ONSTACK(&rw->work, shrink_lru_work_bs);
+		queue_work(reclaim_wq_bs, &rw->work);
+	}
+
+	shrink_lru_sublist_bs(zone, works[self].lru, works[self].nr_active,
+				works[self].nr_inactive, &works[self].sc);
+
+	for (i = 0; i < NR_LRU_SUBLISTS_BS; i++) {
+		struct reclaim_work_bs *rw = &works[i];
+
+		if (i != self) {
+			flush_work(&rw->work);
+			destroy_work_on_stack(&rw->work);
 		}
+		sc->nr_scanned += rw->sc.nr_scanned;
+		sc->nr_reclaimed += rw->sc.nr_reclaimed;
+		sc->nr_to_reclaim -= rw->sc.nr_reclaimed;
 	}
 }
 
@@ -224,19 +1047,21 @@ shrink_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
 {
 	unsigned long nr_active;
 	unsigned long nr_inactive;
+	unsigned int cursor;
 
         /*
          * Add one to `nr_to_scan' just to make sure that the kernel will
          * slowly sift through the active list.
          */
-	zone->nr_scan_active += (zone->nr_active >> sc->priority) + 1;
+	zone->nr_scan_active += (zone_nr_active_bs(zone) >> sc->priority) + 1;
 	nr_active = zone->nr_scan_active;
 	if (nr_active >= sc->swap_cluster_max)
 		zone->nr_scan_active = 0;
 	else
 		nr_active = 0;
 
-	zone->nr_scan_inactive += (zone->nr_inactive >> sc->priority) + 1;
+	zone->nr_scan_inactive += (zone_nr_inactive_bs(zone) >>
+							sc->priority) + 1;
 	nr_inactive = zone->nr_scan_inactive;
 	if (nr_inactive >= sc->swap_cluster_max)
 		zone->nr_scan_inactive = 0;
@@ -245,15 +1070,39 @@ shrink_zone_bs(struct zone_bs *zone, struct scan_control_bs *sc)
 
 	sc->nr_to_reclaim = sc->swap_cluster_max;
 
+	if (reclaim_wq_bs && nr_active + nr_inactive >= RECLAIM_PARALLEL_MIN_BS) {
+		shrink_zone_parallel_bs(zone, nr_active, nr_inactive, sc);
+		return;
+	}
+
+	/*
+	 * Work through the sublists one batch at a time.  Each reclaimer
+	 * starts on the sublist of the CPU it runs on, so that concurrent
+	 * reclaimers spread out over the sublist locks.
+	 */
+	cursor = raw_smp_processor_id();
 	while (nr_active || nr_inactive) {
+		struct lru_sublist_bs *lru;
+
+		lru = &zone->lru[cursor++ & (NR_LRU_SUBLISTS_BS - 1)];
 		if (nr_active) {
 			sc->nr_to_scan = min(nr_active,
 					(unsigned long)sc->swap_cluster_max);
 			nr_active -= sc->nr_to_scan;
-			refill_inactive_zone_bs(zone, sc);
+			refill_inactive_zone_bs(zone, lru, sc);
+		}
+
+		if (nr_inactive) {
+			sc->nr_to_scan = min(nr_inactive,
+					(unsigned long)sc->swap_cluster_max);
+			nr_inactive -= sc->nr_to_scan;
+			shrink_cache_bs(zone, lru, sc);
+			if (sc->nr_to_reclaim <= 0)
+				break;
 		}
 	}
 }
+#endif /* CONFIG_LRU_GEN_BS */
 
 /*
  * This is the direct reclaim path, for page-allocating processes.  We only
@@ -313,12 +1162,16 @@ int try_to_free_pages_bs(struct zone_bs **zones,
 		unsigned int gfp_mask, unsigned int order)
 {
 	int priority;
+	int total_scanned = 0, total_reclaimed = 0;
+	struct reclaim_state_bs *reclaim_state =
+			(struct reclaim_state_bs *)current->reclaim_state;
 	struct scan_control_bs sc;
 	unsigned long lru_pages = 0;
 	int i;
 
 	sc.gfp_mask = gfp_mask;
 	sc.may_writepage = 0;
+	sc.kswapd = 0;
 
 	inc_page_state_bs(allocstall);	
 
@@ -329,7 +1182,8 @@ int try_to_free_pages_bs(struct zone_bs **zones,
 			continue;
 
 		zone->temp_priority = DEF_PRIORITY_BS;
-		lru_pages += zone->nr_active + zone->nr_inactive;
+		lru_pages += zone_nr_active_bs(zone) +
+					zone_nr_inactive_bs(zone);
 	}
 
 	for (priority = DEF_PRIORITY_BS; priority >= 0; priority--) {
@@ -339,14 +1193,49 @@ int try_to_free_pages_bs(struct zone_bs **zones,
 		sc.priority = priority;
 		sc.swap_cluster_max = SWAP_CLUSTER_MAX_BS;
 		shrink_caches_bs(zones, &sc);
-		BS_DUP();
+		shrink_slab_bs(sc.nr_scanned, gfp_mask, lru_pages);
+		if (reclaim_state) {
+			sc.nr_reclaimed += reclaim_state->reclaimed_slab;
+			reclaim_state->reclaimed_slab = 0;
+		}
+		total_scanned += sc.nr_scanned;
+		total_reclaimed += sc.nr_reclaimed;
+		if (total_reclaimed >= sc.swap_cluster_max)
+			goto out;
+
+		/*
+		 * There is no writeback here to kick or wait on, so the
+		 * only thing a nap buys us is time for other tasks to
+		 * release pages.  Keep it short.
+		 */
+		if (sc.nr_scanned && priority < DEF_PRIORITY_BS - 2)
+			cond_resched();
 	}
-	return 0;
+out:
+	for (i = 0; zones[i] != 0; i++) {
+		struct zone_bs *zone = zones[i];
+
+		if (!cpuset_zone_allowed_bs(zone))
+			continue;
+
+		zone->prev_priority = zone->temp_priority;
+	}
+	return total_reclaimed;
+}
+
+/*
+ * The free page target kswapd works a zone up to: pages_high, plus any
+ * boost allocation failures and fragmentation have added since the last
+ * balancing run.
+ */
+static inline unsigned long zone_balance_mark_bs(struct zone_bs *zone)
+{
+	return zone->pages_high + zone->watermark_boost;
 }
 
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
- * they are all at pages_high.
+ * they are all at pages_high plus their watermark boost.
  *
  * If `nr_pages' is non-zero then it is the number of pages which are to be
  * reclaimed, regardless of the zone occupancies.  This is a software suspend
@@ -358,9 +1247,10 @@ int try_to_free_pages_bs(struct zone_bs **zones,
  * This can happen if the pages are all mlocked, or if they are all used by
  * device drivers (say, ZONE_DMA).  Or if they are all in use by hugetlb.
  * What we do is to detect the case where all pages in the zone have been
- * scanned twice and there has been zero successful reclaim.  Mark the zone as
- * dead and from now on, only perform a short scan.  Basically we're polling
- * the zone for when the problem goes away.
+ * scanned four times and there has been zero successful reclaim.  Mark the
+ * zone as dead and from now on, only perform a short scan.  Basically we're
+ * polling the zone for when the problem goes away.  A dead zone's boost is
+ * dropped as well, there is nothing to be gained by chasing it.
  *
  * kswapd scans the zones in the highmem->normal->dma direction.  It skips
  * zones which have free_pages > pages_high, but once a zone is found to have
@@ -371,16 +1261,21 @@ int try_to_free_pages_bs(struct zone_bs **zones,
  */
 static int balance_pgdat_bs(pg_data_t_bs *pgdat, int nr_pages, int order)
 {
+	int to_free = nr_pages;
 	int all_zones_ok;
 	int priority;
 	int i;
 	int total_scanned, total_reclaimed;
+	struct reclaim_state_bs *reclaim_state =
+			(struct reclaim_state_bs *)current->reclaim_state;
 	struct scan_control_bs sc;
 
+loop_again:
 	total_scanned = 0;
 	total_reclaimed = 0;
 	sc.gfp_mask = GFP_KERNEL_BS;
 	sc.may_writepage = 0;
+	sc.kswapd = !!(current->flags & PF_KSWAPD_BS);
 	sc.nr_mapped = read_page_state_bs(nr_mapped);
 
 	inc_page_state_bs(pageoutrun);
@@ -413,7 +1308,7 @@ static int balance_pgdat_bs(pg_data_t_bs *pgdat, int nr_pages, int order)
 					continue;
 
 				if (!zone_watermark_ok_bs(zone, order,
-						zone->pages_high, 0, 0, 0)) {
+					zone_balance_mark_bs(zone), 0, 0, 0)) {
 					end_zone = i;
 					goto scan;
 				}
@@ -426,7 +1321,8 @@ scan:
 		for (i = 0; i <= end_zone; i++) {
 			struct zone_bs *zone = pgdat->node_zones + i;
 
-			lru_pages += zone->nr_active + zone->nr_inactive;
+			lru_pages += zone_nr_active_bs(zone) +
+						zone_nr_inactive_bs(zone);
 		}
 
 		/*
@@ -450,7 +1346,8 @@ scan:
 
 			if (nr_pages == 0) { /* Not software suspend */
 				if (!zone_watermark_ok_bs(zone, order,
-					zone->pages_high, end_zone, 0, 0))
+						zone_balance_mark_bs(zone),
+						end_zone, 0, 0))
 					all_zones_ok = 0;
 			}
 			zone->temp_priority = priority;
@@ -462,10 +1359,59 @@ scan:
 			sc.swap_cluster_max = nr_pages ? nr_pages :
 							SWAP_CLUSTER_MAX_BS;
 			shrink_zone_bs(zone, &sc);
+			if (reclaim_state)
+				reclaim_state->reclaimed_slab = 0;
+			shrink_slab_bs(sc.nr_scanned, GFP_KERNEL_BS, lru_pages);
+			if (reclaim_state) {
+				sc.nr_reclaimed += reclaim_state->reclaimed_slab;
+				reclaim_state->reclaimed_slab = 0;
+			}
+			total_reclaimed += sc.nr_reclaimed;
+			total_scanned += sc.nr_scanned;
+			if (zone->all_unreclaimable)
+				continue;
+			if (atomic_long_read(&zone->pages_scanned) >=
+					(zone_nr_active_bs(zone) +
+					zone_nr_inactive_bs(zone)) * 4) {
+				zone->all_unreclaimable = 1;
+				zone->watermark_boost = 0;
+			}
 		}
-	} 
+		if (nr_pages && to_free > total_reclaimed)
+			continue;	/* swsusp: need to do more work */
+		if (all_zones_ok)
+			break;		/* kswapd: all done */
+		/*
+		 * OK, kswapd is getting into trouble.  Take a nap, then take
+		 * another pass across the zones.
+		 */
+		if (total_scanned && priority < DEF_PRIORITY_BS - 2)
+			cond_resched();
+
+		/*
+		 * We do this so kswapd doesn't build up large priorities for
+		 * example when it is freeing in parallel with allocators. It
+		 * matches the direct reclaim path behaviour in terms of impact
+		 * on zone->*_priority.
+		 */
+		if (total_reclaimed >= SWAP_CLUSTER_MAX_BS)
+			break;
+	}
 out:
-	return 0;
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		struct zone_bs *zone = pgdat->node_zones + i;
+
+		zone->prev_priority = zone->temp_priority;
+		/* Boosted targets met, back to plain pages_high */
+		if (all_zones_ok)
+			zone->watermark_boost = 0;
+	}
+	if (!all_zones_ok) {
+		cond_resched();
+		goto loop_again;
+	}
+
+	return total_reclaimed;
 }
 
 /*
@@ -528,6 +1474,9 @@ static int kswapd_bs(void *p)
 		finish_wait(&pgdat->kswapd_wait, &wait);
 
 		balance_pgdat_bs(pgdat, 0, order);
+		/* Free pages alone may not add up to a block of this order */
+		if (order)
+			compact_pgdat_bs(pgdat, order);
 	}
 
 	return 0;
@@ -544,7 +1493,9 @@ void wakeup_kswapd_bs(struct zone_bs *zone, int order)
 		return;
 
 	pgdat = zone->zone_pgdat;
-	if (zone_watermark_ok_bs(zone, order, zone->pages_low, 0, 0, 0))
+	/* A boosted zone wants kswapd even while above pages_low */
+	if (!zone->watermark_boost &&
+	    zone_watermark_ok_bs(zone, order, zone->pages_low, 0, 0, 0))
 		return;
 	if (pgdat->kswapd_max_order < order)
 		pgdat->kswapd_max_order = order;
@@ -560,6 +1511,11 @@ static int __init kswapd_init_bs(void)
 {
 	pg_data_t_bs *pgdat;
 	swap_setup_bs();
+#ifndef CONFIG_LRU_GEN_BS
+	/* Without it reclaim simply stays on the calling thread */
+	reclaim_wq_bs = alloc_workqueue("reclaim-bs",
+					WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+#endif
 	for_each_pgdat_bs(pgdat)
 		pgdat->kswapd = kthread_run(kswapd_bs, pgdat, "kswapd-bs%d", 0);
 	total_memory_bs = nr_free_pagecache_pages_bs();
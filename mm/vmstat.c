@@ -8,6 +8,8 @@
 extern struct seq_operations vmstat_op_bs;
 extern struct seq_operations fragmentation_op_bs;
 extern struct seq_operations slabinfo_op_bs;
+extern struct seq_operations vmallocinfo_op_bs;
+extern struct seq_operations mempoolinfo_op_bs;
 
 static int __init init_mm_internals_bs(void)
 {
@@ -15,6 +17,8 @@ static int __init init_mm_internals_bs(void)
 	proc_create_seq("vmstat_bs", 0444, NULL, &vmstat_op_bs);
 	proc_create_seq("buddyinfo_bs", 0444, NULL, &fragmentation_op_bs);
 	proc_create_seq("slabinfo_bs", 0444, NULL, &slabinfo_op_bs);
+	proc_create_seq("vmallocinfo_bs", 0444, NULL, &vmallocinfo_op_bs);
+	proc_create_seq("mempoolinfo_bs", 0444, NULL, &mempoolinfo_op_bs);
 #endif
 	return 0;
 }
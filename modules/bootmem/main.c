@@ -14,6 +14,7 @@
 #include "biscuitos/init.h"
 #include "biscuitos/bootmem.h"
 #include "biscuitos/mm.h"
+#include "biscuitos/memblock.h"
 
 /*
  * TestCase: alloc/free on bootmem
@@ -121,3 +122,62 @@ static int TestCase_bootmem_reserve(void)
 	return 0;
 }
 bootmem_initcall_bs(TestCase_bootmem_reserve);
+
+#define MEMBLOCK_TEST_ALIGN	(1UL << 20)
+
+/*
+ * TestCase: memblock regions behind bootmem
+ *
+ * A top-down allocation must be the highest aligned fit below
+ * high_memory, and reserved until it is freed again.
+ */
+static int TestCase_memblock(void)
+{
+	unsigned long addr, end, this_start, this_end, cand;
+	int ret = 0;
+	u64 i;
+
+	end = min((unsigned long)__pa_bs(high_memory_bs),
+					memblock_bs.current_limit);
+	memblock_set_bottom_up_bs(0);
+	addr = memblock_alloc_range_bs(PAGE_SIZE_BS, MEMBLOCK_TEST_ALIGN,
+								0, end);
+	memblock_set_bottom_up_bs(1);
+	if (!addr) {
+		printk("%s memblock_alloc_range() failed\n", __func__);
+		return -ENOMEM;
+	}
+	if (addr & (MEMBLOCK_TEST_ALIGN - 1) || addr + PAGE_SIZE_BS > end) {
+		printk("%s %#lx misaligned or above %#lx\n", __func__,
+							addr, end);
+		ret = -EINVAL;
+	}
+
+	/* Nothing left free above it may fit the same request */
+	for_each_free_mem_range_bs(i, &this_start, &this_end) {
+		this_end = min(this_end, end);
+		if (this_end <= this_start ||
+				this_end - this_start < PAGE_SIZE_BS)
+			continue;
+		cand = (this_end - PAGE_SIZE_BS) & ~(MEMBLOCK_TEST_ALIGN - 1);
+		if (cand >= this_start && cand > addr) {
+			printk("%s %#lx is free above top-down %#lx\n",
+						__func__, cand, addr);
+			ret = -EINVAL;
+		}
+	}
+
+	if (!memblock_is_reserved_bs(addr)) {
+		printk("%s %#lx not reserved\n", __func__, addr);
+		ret = -EINVAL;
+	}
+	memblock_free_bs(addr, PAGE_SIZE_BS);
+	if (memblock_is_reserved_bs(addr)) {
+		printk("%s %#lx still reserved after free\n", __func__, addr);
+		ret = -EINVAL;
+	}
+	if (ret)
+		memblock_dump_all_bs();
+	return ret;
+}
+bootmem_initcall_bs(TestCase_memblock);
@@ -9,10 +9,20 @@
  */
 #include <linux/kernel.h>
 #include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "biscuitos/kernel.h"
 #include "biscuitos/init.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/gfp.h"
+#include "biscuitos/page-flags.h"
+#include "biscuitos/swap.h"
+#include "biscuitos/cma.h"
+#include "biscuitos/rmap.h"
+#include "biscuitos/vmalloc.h"
+#include "asm-generated/pgtable.h"
 
 /*
  * TestCase: alloc page from Normal Zone
@@ -111,3 +121,164 @@ static int __unused TestCase_get_zero_page(void)
 	free_page_bs((unsigned long)addr);
 	return 0;
 }
+
+#define CMA_TEST_PAGES		(256)	/* 1M */
+#define CMA_TEST_MAGIC		(0x68UL)
+
+/* The page a vmapped kernel address is mapped to now */
+static struct page_bs *cma_test_mapped_page(void *addr)
+{
+	unsigned long vaddr = (unsigned long)addr;
+
+	return pte_page_bs(*pte_offset_kernel_bs(pmd_off_k_bs(vaddr), vaddr));
+}
+
+/*
+ * TestCase: contiguous allocations from a CMA area
+ *
+ * Two ranges are taken from the same pageblock.  The first page of the
+ * second is then lent out the way the buddy allocator lends free CMA
+ * pages, to an anonymous mapping on the LRU.  Taking the second range
+ * again has to migrate that page out and keep its mapping and contents.
+ */
+static int TestCase_cma(void)
+{
+	struct cma_bs *cma = &cma_areas_bs[0];
+	struct page_bs *first, *second, *again, *page;
+	struct anon_vma_bs anon_vma;
+	struct vm_area_struct vma;
+	void *addr;
+	int ret = 0;
+
+	if (!cma_area_count_bs) {
+		printk("%s: no CMA area, add cma-size to the DTS\n", __func__);
+		return 0;
+	}
+
+	first = cma_alloc_bs(cma, CMA_TEST_PAGES, 0);
+	if (!first) {
+		printk("%s: first cma_alloc failed.\n", __func__);
+		return -ENOMEM;
+	}
+	second = cma_alloc_bs(cma, CMA_TEST_PAGES, 0);
+	if (!second) {
+		printk("%s: second cma_alloc in the pageblock failed.\n",
+								__func__);
+		cma_release_bs(cma, first, CMA_TEST_PAGES);
+		return -EBUSY;
+	}
+	if ((page_to_pfn_bs(first) ^ page_to_pfn_bs(second)) >>
+						pageblock_order_bs) {
+		printk("%s: ranges landed in different pageblocks\n",
+								__func__);
+		ret = -EINVAL;
+	}
+
+	/* Lend the first page of the second range out */
+	page = second;
+	cma_release_bs(cma, second + 1, CMA_TEST_PAGES - 1);
+	mutex_lock(&cma->lock);
+	bitmap_clear(cma->bitmap, page_to_pfn_bs(page) - cma->base_pfn, 1);
+	mutex_unlock(&cma->lock);
+
+	addr = vmap_bs(&page, 1, VM_MAP_BS, PAGE_KERNEL_BS);
+	if (!addr) {
+		cma_release_bs(cma, first, CMA_TEST_PAGES);
+		__free_page_bs(page);
+		return -ENOMEM;
+	}
+	spin_lock_init(&anon_vma.lock);
+	INIT_LIST_HEAD(&anon_vma.head);
+	memset(&vma, 0, sizeof(vma));
+	vma.vm_mm = (struct mm_struct *)&init_mm_bs;
+	vma.vm_start = (unsigned long)addr;
+	vma.vm_end = vma.vm_start + PAGE_SIZE_BS;
+	vma.vm_flags = VM_READ | VM_WRITE;
+	vma.anon_vma = (struct anon_vma *)&anon_vma;
+	list_add(&vma.anon_vma_chain, &anon_vma.head);
+	spin_lock(&init_mm_bs.page_table_lock);
+	page_add_anon_rmap_bs(page, &vma, vma.vm_start);
+	spin_unlock(&init_mm_bs.page_table_lock);
+	*(unsigned long *)addr = CMA_TEST_MAGIC;
+	lru_cache_add_bs(page);
+	lru_add_drain_bs();
+
+	again = cma_alloc_bs(cma, CMA_TEST_PAGES, 0);
+	if (again != second) {
+		printk("%s: lent page not migrated out of the range\n",
+								__func__);
+		ret = -EBUSY;
+	} else if (page_mapped_bs(second) ||
+			cma_test_mapped_page(addr) == second ||
+			*(unsigned long *)addr != CMA_TEST_MAGIC) {
+		printk("%s: migration lost the lent page's mapping\n",
+								__func__);
+		ret = -EINVAL;
+	}
+	if (again)
+		cma_release_bs(cma, again, CMA_TEST_PAGES);
+	cma_release_bs(cma, first, CMA_TEST_PAGES);
+
+	/* Unmap the lent page, wherever it is now, and free it */
+	lru_add_drain_bs();
+	page = cma_test_mapped_page(addr);
+	vunmap_bs(addr);
+	page_remove_rmap_bs(page);
+	release_pages_bs(&page, 1, 0);
+	return ret;
+}
+module_initcall_bs(TestCase_cma);
+
+/*
+ * TestCase: mem_map footprint
+ *
+ * Report what struct page_bs costs per GB of RAM and time a walk over
+ * mem_map that reads the fields the buddy allocator checks, and one
+ * that reads the fields rmap checks.
+ */
+static int TestCase_memmap_footprint(void)
+{
+	pg_data_t_bs *pgdat = NODE_DATA_BS(0);
+	unsigned long end = pgdat->node_start_pfn + pgdat->node_spanned_pages;
+	unsigned long pfn, nr = 0, buddy = 0, mapped = 0;
+	struct page_bs *page;
+	u64 start, t_buddy, t_rmap;
+
+	/* pfn walk: with SPARSEMEM the mem_map has holes */
+	start = ktime_get_ns();
+	for (pfn = pgdat->node_start_pfn; pfn < end; pfn++) {
+		if (!pfn_valid_bs(pfn))
+			continue;
+		page = pfn_to_page_bs(pfn);
+		nr++;
+		if (PagePrivate_bs(page) && !page_count_bs(page) &&
+		    page->private < MAX_ORDER_BS && !list_empty(&page->lru))
+			buddy++;
+	}
+	t_buddy = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (pfn = pgdat->node_start_pfn; pfn < end; pfn++) {
+		if (!pfn_valid_bs(pfn))
+			continue;
+		page = pfn_to_page_bs(pfn);
+		if (page->mapping && page->index != ~0UL &&
+		    page_mapcount_bs(page))
+			mapped++;
+	}
+	t_rmap = ktime_get_ns() - start;
+
+	if (!nr)
+		return 0;
+	printk("%s: struct page_bs %u bytes, %lu KB of mem_map per GB, "
+		"%lu KB for %lu pages\n", __func__,
+		(unsigned int)sizeof(struct page_bs),
+		(sizeof(struct page_bs) << (30 - PAGE_SHIFT_BS)) >> 10,
+		(nr * sizeof(struct page_bs)) >> 10, nr);
+	printk("%s: buddy walk %llu ns/Kpage (%lu free blocks), "
+		"rmap walk %llu ns/Kpage (%lu mapped)\n", __func__,
+		div_u64(t_buddy * 1024, nr), buddy,
+		div_u64(t_rmap * 1024, nr), mapped);
+	return 0;
+}
+buddy_initcall_bs(TestCase_memmap_footprint);
@@ -145,3 +145,73 @@ static int TestCase_kmap_atomic(void)
 	return 0;
 }
 kmap_initcall_bs(TestCase_kmap_atomic);
+
+/*
+ * TestCase: kmap_local/kunmap_local
+ */
+static int TestCase_kmap_local(void)
+{
+	struct page_bs *page0, *page1;
+	void *addr0, *addr1;
+
+	/* alloc page */
+	page0 = alloc_page_bs(__GFP_HIGHMEM_BS);
+	page1 = alloc_page_bs(__GFP_HIGHMEM_BS);
+	if (!page0 || !page1) {
+		printk("%s alloc_page() failed.\n", __func__);
+		if (page0)
+			__free_page_bs(page0);
+		return -ENOMEM;
+	}
+
+	/* nested map */
+	addr0 = kmap_local_page_bs(page0);
+	addr1 = kmap_local_page_bs(page1);
+
+	sprintf((char *)addr0, "BiscuitOS-%s", __func__);
+	memcpy(addr1, addr0, 64);
+	bs_debug("[%#lx] %s\n", (unsigned long)addr1, (char *)addr1);
+
+	/* unmap in reverse order */
+	kunmap_local_bs(addr1);
+	kunmap_local_bs(addr0);
+	__free_page_bs(page1);
+	__free_page_bs(page0);
+	return 0;
+}
+kmap_initcall_bs(TestCase_kmap_local);
+
+/*
+ * TestCase: clear_highpage/copy_highpage
+ */
+static int TestCase_copy_highpage(void)
+{
+	struct page_bs *from, *to;
+	char *addr;
+
+	/* alloc page */
+	from = alloc_page_bs(__GFP_HIGHMEM_BS);
+	to = alloc_page_bs(__GFP_HIGHMEM_BS);
+	if (!from || !to) {
+		printk("%s alloc_page() failed.\n", __func__);
+		if (from)
+			__free_page_bs(from);
+		return -ENOMEM;
+	}
+
+	clear_highpage_bs(from);
+	addr = kmap_local_page_bs(from);
+	sprintf(addr, "BiscuitOS-%s", __func__);
+	kunmap_local_bs(addr);
+
+	copy_highpage_bs(to, from);
+
+	addr = kmap_local_page_bs(to);
+	bs_debug("[%#lx] %s\n", (unsigned long)addr, addr);
+	kunmap_local_bs(addr);
+
+	__free_page_bs(to);
+	__free_page_bs(from);
+	return 0;
+}
+kmap_initcall_bs(TestCase_copy_highpage);
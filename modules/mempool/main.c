@@ -84,3 +84,104 @@ out_kmem:
 	return ret;
 }
 module_initcall_bs(TestCase_mempool);
+
+/*
+ * TestCase: reserve-first mempool with per-CPU stashes
+ */
+static int TestCase_mempool_reserve(void)
+{
+	mempool_t_bs *BiscuitOS_mempool;
+	kmem_cache_t_bs *BiscuitOS_cache;
+	struct node_default_bs *np[4];
+	int i, ret = 0;
+#define MIN_POOL_RESERVE	(8)
+#define HIGH_POOL_RESERVE	(8)
+
+	/* Create kmem cache */
+	BiscuitOS_cache = kmem_cache_create_bs(
+				"BiscuitOS mempool reserve",
+				sizeof(struct node_default_bs),
+				0,
+				SLAB_HWCACHE_ALIGN_BS,
+				NULL,
+				NULL);
+	if (!BiscuitOS_cache) {
+		printk("%s kmem_cache_create failed.\n", __func__);
+		return -ENOMEM;
+	}
+
+	/* Create mempool */
+	BiscuitOS_mempool = mempool_create_reserve_bs(
+				MIN_POOL_RESERVE,
+				HIGH_POOL_RESERVE,
+				mempool_alloc_slab_bs,
+				mempool_free_slab_bs,
+				BiscuitOS_cache,
+				MEMPOOL_PERCPU_BS);
+	if (!BiscuitOS_mempool) {
+		printk("%s mempool_create failed.\n", __func__);
+		ret = -ENOMEM;
+		goto out_kmem;
+	}
+
+	/* alloc from reserve, free back to the per-CPU stash */
+	for (i = 0; i < ARRAY_SIZE(np); i++) {
+		np[i] = mempool_alloc_bs(BiscuitOS_mempool, SLAB_NOFS_BS);
+		np[i]->index = i;
+	}
+	for (i = 0; i < ARRAY_SIZE(np); i++)
+		mempool_free_bs(np[i], BiscuitOS_mempool);
+
+	/* Grow both marks */
+	mempool_resize_marks_bs(BiscuitOS_mempool, MIN_POOL_RESERVE * 2,
+				HIGH_POOL_RESERVE * 2, GFP_KERNEL_BS);
+	bs_debug("reserved %d min_nr %d high_nr %d low_nr %d\n",
+			atomic_read(&BiscuitOS_mempool->reserved),
+			BiscuitOS_mempool->min_nr, BiscuitOS_mempool->high_nr,
+			BiscuitOS_mempool->low_nr);
+
+	/* Destroy mempool */
+	mempool_destroy_bs(BiscuitOS_mempool);
+out_kmem:
+	kmem_cache_destroy_bs(BiscuitOS_cache);
+	return ret;
+}
+module_initcall_bs(TestCase_mempool_reserve);
+
+/*
+ * TestCase: zeroed page mempool
+ */
+static int TestCase_mempool_page(void)
+{
+	mempool_t_bs *BiscuitOS_mempool;
+	struct page_bs *page;
+	unsigned long *addr;
+#define MIN_POOL_PAGE		(4)
+#define HIGH_POOL_PAGE		(8)
+#define ORDER_POOL_PAGE		(2)	/* 16K */
+
+	/* Create mempool */
+	BiscuitOS_mempool = mempool_create_page_pool_bs(
+				MIN_POOL_PAGE,
+				ORDER_POOL_PAGE,
+				HIGH_POOL_PAGE,
+				MEMPOOL_ZERO_BS);
+	if (!BiscuitOS_mempool) {
+		printk("%s mempool_create failed.\n", __func__);
+		return -ENOMEM;
+	}
+
+	/* alloc zeroed buffer */
+	page = mempool_alloc_bs(BiscuitOS_mempool, GFP_KERNEL_BS);
+	addr = page_address_bs(page);
+	bs_debug("[%#lx] first word %#lx\n", (unsigned long)addr, addr[0]);
+	addr[0] = 0x68;
+
+	/* free to mempool */
+	mempool_free_bs(page, BiscuitOS_mempool);
+
+	/* Destroy mempool */
+	mempool_destroy_bs(BiscuitOS_mempool);
+	return 0;
+}
+module_initcall_bs(TestCase_mempool_page);
@@ -13,6 +13,7 @@
 #include "biscuitos/init.h"
 #include "biscuitos/mm.h"
 #include "biscuitos/gfp.h"
+#include "biscuitos/slab.h"
 #include "biscuitos/vmalloc.h"
 
 /*
@@ -107,3 +108,89 @@ out_vmap:
 	return ret;
 }
 vmalloc_initcall_bs(TestCase_vmap);
+
+/*
+ * TestCase: vmap/vunmap across a PTE table boundary
+ */
+#define VMAP_WALK_PAGES_BS	(PTRS_PER_PTE_BS + 2)
+
+static int vmap_count_pte_bs(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	unsigned long *present = walk->private;
+
+	do {
+		if (!pte_none_bs(*pte))
+			(*present)++;
+	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
+	return 0;
+}
+
+static unsigned long vmap_present_bs(unsigned long addr, unsigned long size)
+{
+	unsigned long present = 0;
+	struct mm_walk_bs walk = {
+		.pte_entry	= vmap_count_pte_bs,
+		.mm		= &init_mm_bs,
+		.private	= &present,
+	};
+
+	spin_lock(&init_mm_bs.page_table_lock);
+	walk_page_range_bs(addr, addr + size, &walk);
+	spin_unlock(&init_mm_bs.page_table_lock);
+	return present;
+}
+
+static int TestCase_vmap_walk(void)
+{
+	unsigned long size = VMAP_WALK_PAGES_BS * PAGE_SIZE_BS;
+	struct page_bs **pages;
+	unsigned long before, after;
+	int i, ret = 0;
+	char *addr;
+
+	pages = kmalloc_bs(VMAP_WALK_PAGES_BS * sizeof(*pages), GFP_KERNEL_BS);
+	if (!pages)
+		return -ENOMEM;
+	for (i = 0; i < VMAP_WALK_PAGES_BS; i++) {
+		pages[i] = alloc_page_bs(GFP_KERNEL_BS);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	addr = vmap_bs(pages, VMAP_WALK_PAGES_BS, VM_MAP_BS, PAGE_KERNEL_BS);
+	if (!addr) {
+		printk("%s vmap failed\n", __func__);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* every page lands where it should, on both sides of the table */
+	for (i = 0; i < VMAP_WALK_PAGES_BS; i++)
+		*(unsigned long *)(addr + i * PAGE_SIZE_BS) = i;
+	for (i = 0; i < VMAP_WALK_PAGES_BS; i++) {
+		if (*(unsigned long *)page_address_bs(pages[i]) != i) {
+			printk("%s page %d mapped at the wrong address\n",
+							__func__, i);
+			ret = -EINVAL;
+		}
+	}
+
+	before = vmap_present_bs((unsigned long)addr, size);
+	vunmap_bs(addr);
+	after = vmap_present_bs((unsigned long)addr, size);
+	if (before != VMAP_WALK_PAGES_BS || after) {
+		printk("%s present ptes %lu after vmap, %lu after vunmap\n",
+						__func__, before, after);
+		ret = -EINVAL;
+	}
+
+out:
+	while (i--)
+		__free_page_bs(pages[i]);
+	kfree_bs(pages);
+	return ret;
+}
+vmalloc_initcall_bs(TestCase_vmap_walk);
@@ -0,0 +1,639 @@
+/*
+ * BiscuitOS Memory Manager: vmscan
+ *
+ * (C) 2019.10.01 BuddyZhang1 <buddy.zhang@aliyun.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include "biscuitos/kernel.h"
+#include "biscuitos/init.h"
+#include "biscuitos/mm.h"
+#include "biscuitos/gfp.h"
+#include "biscuitos/swap.h"
+#include "biscuitos/mm_inline.h"
+#include "biscuitos/compaction.h"
+#include "biscuitos/rmap.h"
+#include "biscuitos/vmalloc.h"
+#include "asm-generated/pgtable.h"
+
+#ifdef CONFIG_LRU_GEN_BS
+#define LRU_NAME_BS		"multi-gen"
+#else
+#define LRU_NAME_BS		"active/inactive"
+#endif
+
+#define LRU_BENCH_PAGES		(1024)
+#define LRU_BENCH_HOT		(4)	/* one page in four is referenced */
+
+static unsigned long lru_bench_scanned(void)
+{
+	return read_page_state_bs(pgscan_direct_high) +
+		read_page_state_bs(pgscan_direct_normal) +
+		read_page_state_bs(pgscan_direct_dma);
+}
+
+static unsigned long lru_bench_stolen(void)
+{
+	return read_page_state_bs(pgsteal_high) +
+		read_page_state_bs(pgsteal_normal) +
+		read_page_state_bs(pgsteal_dma);
+}
+
+static struct page_bs *lru_bench_pages[LRU_BENCH_PAGES];
+
+/*
+ * TestCase: reclaim cost
+ *
+ * Fill the LRU with LRU_BENCH_PAGES unmapped pages, one in LRU_BENCH_HOT
+ * of them referenced, and reclaim half as many.  Reports the pages
+ * scanned and the time spent per reclaimed page, for comparison with a
+ * build with the other LRU, and how many referenced and unreferenced
+ * pages each survived.  The multi-gen LRU promotes referenced pages as
+ * it scans them, so it must keep them at least as well as the others.
+ */
+static int TestCase_lru_reclaim_cost(void)
+{
+	struct zone_bs **zones;
+	unsigned long scanned, stolen;
+	int hot = 0, hot_kept = 0, cold_kept = 0;
+	u64 start, delta;
+	int i, nr, ret;
+
+	/* Each page's only reference goes to the LRU, so reclaim can free it */
+	for (nr = 0; nr < LRU_BENCH_PAGES; nr++) {
+		struct page_bs *page = alloc_page_bs(GFP_KERNEL_BS);
+
+		if (!page)
+			break;
+		if (nr % LRU_BENCH_HOT == 0) {
+			SetPageReferenced_bs(page);
+			hot++;
+		}
+		lru_cache_add_bs(page);
+		lru_bench_pages[nr] = page;
+	}
+	lru_add_drain_bs();
+
+	zones = NODE_DATA_BS(0)->node_zonelists[GFP_KERNEL_BS &
+						GFP_ZONEMASK_BS].zones;
+	scanned = lru_bench_scanned();
+	stolen = lru_bench_stolen();
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr / 2; i += ret) {
+		ret = try_to_free_pages_bs(zones, GFP_KERNEL_BS, 0);
+		if (!ret)
+			break;
+	}
+	delta = ktime_get_ns() - start;
+
+	scanned = lru_bench_scanned() - scanned;
+	stolen = lru_bench_stolen() - stolen;
+
+	/* Reclaim frees a page off the LRU, survivors are still on it */
+	lru_add_drain_bs();
+	for (i = 0; i < nr; i++) {
+		struct page_bs *page = lru_bench_pages[i];
+
+		if (!PageLRU_bs(page))
+			continue;
+		if (i % LRU_BENCH_HOT == 0)
+			hot_kept++;
+		else
+			cold_kept++;
+		release_pages_bs(&page, 1, 0);
+	}
+
+	if (!stolen) {
+		printk("%s: %s LRU reclaimed nothing.\n", __func__, LRU_NAME_BS);
+		return -ENOMEM;
+	}
+	printk("%s: %s LRU reclaimed %lu pages, scanned %lu: "
+		"%lu.%02lu scans and %llu ns per page; kept %d/%d "
+		"referenced and %d/%d unreferenced pages\n", __func__,
+		LRU_NAME_BS, stolen, scanned, scanned / stolen,
+		(scanned % stolen) * 100 / stolen, div_u64(delta, stolen),
+		hot_kept, hot, cold_kept, nr - hot);
+#ifdef CONFIG_LRU_GEN_BS
+	if ((u64)hot_kept * (nr - hot) < (u64)cold_kept * hot) {
+		printk("%s: referenced pages were evicted ahead of "
+					"unreferenced ones\n", __func__);
+		return -EINVAL;
+	}
+#endif
+	return 0;
+}
+module_initcall_bs(TestCase_lru_reclaim_cost);
+
+static int lru_page_active(struct page_bs *page)
+{
+	struct lru_sublist_bs *lru = page_lru_sublist_bs(page);
+	int active;
+
+	spin_lock_irq(&lru->lock);
+	active = page_lru_active_bs(lru, page);
+	spin_unlock_irq(&lru->lock);
+	return active;
+}
+
+/*
+ * TestCase: per-CPU LRU move batches
+ *
+ * mark_page_accessed(), deactivate_page() and rotate_reclaimable_page()
+ * only queue the page; it moves when the batch is drained.
+ */
+static int TestCase_lru_pvecs(void)
+{
+	struct page_bs *page = alloc_page_bs(GFP_KERNEL_BS);
+	unsigned long rotated;
+	int ret = 0;
+
+	if (!page)
+		return -ENOMEM;
+	/*
+	 * A second reference keeps reclaim, which frees an unmapped page
+	 * holding a single one, away from the page while it is tested.
+	 */
+	get_page_bs(page);
+	lru_cache_add_bs(page);
+	lru_add_drain_bs();
+
+	/* Second access of an inactive page activates it */
+	mark_page_accessed_bs(page);
+	mark_page_accessed_bs(page);
+	lru_add_drain_bs();
+	if (!lru_page_active(page)) {
+		printk("%s: mark_page_accessed didn't activate\n", __func__);
+		ret = -EINVAL;
+	}
+
+	deactivate_page_bs(page);
+	lru_add_drain_bs();
+	if (lru_page_active(page)) {
+		printk("%s: deactivate_page left the page active\n", __func__);
+		ret = -EINVAL;
+	}
+
+	rotated = read_page_state_bs(pgrotated);
+	rotate_reclaimable_page_bs(page);
+	lru_add_drain_bs();
+	if (read_page_state_bs(pgrotated) != rotated + 1) {
+		printk("%s: rotate_reclaimable_page didn't rotate\n", __func__);
+		ret = -EINVAL;
+	}
+
+	/* The last put takes the page off the LRU and frees it */
+	__put_page_bs(page);
+	release_pages_bs(&page, 1, 0);
+	return ret;
+}
+module_initcall_bs(TestCase_lru_pvecs);
+
+/*
+ * Anonymous pages for the rmap users below.  The pages are mapped into
+ * init_mm, by vmap() unless the test sets up its own ptes, and are
+ * given an anon_vma with a single vma spanning the mapping,
+ * the way a private anonymous mapping would have them.  The reference a
+ * page was allocated with becomes its pte's reference.
+ */
+struct anon_map {
+	struct anon_vma_bs anon_vma;
+	struct vm_area_struct vma;
+	struct page_bs **pages;
+	int nr;
+};
+
+/* Give pages already mapped at @start in init_mm their vma and rmap */
+static void anon_map_rmap(struct anon_map *am, unsigned long start,
+				struct page_bs **pages, int nr)
+{
+	int i;
+
+	spin_lock_init(&am->anon_vma.lock);
+	INIT_LIST_HEAD(&am->anon_vma.head);
+	memset(&am->vma, 0, sizeof(am->vma));
+	am->vma.vm_mm = (struct mm_struct *)&init_mm_bs;
+	am->vma.vm_start = start;
+	am->vma.vm_end = start + nr * PAGE_SIZE_BS;
+	am->vma.vm_flags = VM_READ | VM_WRITE;
+	am->vma.anon_vma = (struct anon_vma *)&am->anon_vma;
+	list_add(&am->vma.anon_vma_chain, &am->anon_vma.head);
+
+	spin_lock(&init_mm_bs.page_table_lock);
+	for (i = 0; i < nr; i++)
+		page_add_anon_rmap_bs(pages[i], &am->vma,
+					am->vma.vm_start + i * PAGE_SIZE_BS);
+	spin_unlock(&init_mm_bs.page_table_lock);
+	am->pages = pages;
+	am->nr = nr;
+}
+
+static int anon_map(struct anon_map *am, struct page_bs **pages, int nr)
+{
+	void *addr;
+
+	addr = vmap_bs(pages, nr, VM_MAP_BS, PAGE_KERNEL_BS);
+	if (!addr)
+		return -ENOMEM;
+	anon_map_rmap(am, (unsigned long)addr, pages, nr);
+	return 0;
+}
+
+static int anon_map_pte(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	struct page_bs **page = walk->private;
+
+	*page = pte_present_bs(*pte) ? pte_page_bs(*pte) : NULL;
+	return 0;
+}
+
+/* The page slot @i is mapped to now, which migration may have changed */
+static struct page_bs *anon_map_page(struct anon_map *am, int i)
+{
+	unsigned long addr = am->vma.vm_start + i * PAGE_SIZE_BS;
+	struct page_bs *page = NULL;
+	struct mm_walk_bs walk = {
+		.pte_entry	= anon_map_pte,
+		.mm		= &init_mm_bs,
+		.private	= &page,
+	};
+
+	spin_lock(&init_mm_bs.page_table_lock);
+	walk_page_range_bs(addr, addr + PAGE_SIZE_BS, &walk);
+	spin_unlock(&init_mm_bs.page_table_lock);
+	return page;
+}
+
+/* Tear the mapping down and drop the pte references, freeing the pages */
+static void anon_unmap(struct anon_map *am)
+{
+	int i;
+
+	lru_add_drain_bs();
+	for (i = 0; i < am->nr; i++)
+		am->pages[i] = anon_map_page(am, i);
+	vunmap_bs((void *)am->vma.vm_start);
+	for (i = 0; i < am->nr; i++)
+		page_remove_rmap_bs(am->pages[i]);
+	release_pages_bs(am->pages, am->nr, 0);
+}
+
+#ifdef CONFIG_LRU_GEN_BS
+#define LRU_HARVEST_PAGES	(32)
+/* A user address in init_mm, which the aging walk covers */
+#define LRU_HARVEST_ADDR	(0x10000000UL)
+
+struct lru_harvest {
+	struct page_bs **pages;
+	int young;
+};
+
+/* Map every other page young, the rest old */
+static int lru_harvest_map_pte(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	struct lru_harvest *lh = walk->private;
+
+	do {
+		int i = (addr - LRU_HARVEST_ADDR) >> PAGE_SHIFT_BS;
+		pte_t_bs entry = mk_pte_bs(lh->pages[i], PAGE_KERNEL_BS);
+
+		if (i % 2)
+			entry = pte_mkold_bs(entry);
+		else
+			entry = __pte_bs(pte_val_bs(entry) | L_PTE_YOUNG_BS);
+		set_pte_at_bs(walk->mm, addr, pte, entry);
+	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
+	return 0;
+}
+
+static int lru_harvest_young_pte(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	struct lru_harvest *lh = walk->private;
+
+	do {
+		if (pte_present_bs(*pte) && pte_young_bs(*pte))
+			lh->young++;
+	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
+	return 0;
+}
+
+static int lru_harvest_unmap_pte(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	do {
+		pte_clear_bs(walk->mm, addr, pte);
+	} while (pte++, addr += PAGE_SIZE_BS, addr != end);
+	return 0;
+}
+
+static int lru_harvest_walk(struct lru_harvest *lh, unsigned int flags,
+		int (*pte_entry)(pte_t_bs *, unsigned long, unsigned long,
+						struct mm_walk_bs *))
+{
+	struct mm_walk_bs walk = {
+		.pte_entry	= pte_entry,
+		.mm		= &init_mm_bs,
+		.flags		= flags,
+		.private	= lh,
+	};
+	int err;
+
+	spin_lock(&init_mm_bs.page_table_lock);
+	err = walk_page_range_bs(LRU_HARVEST_ADDR, LRU_HARVEST_ADDR +
+				LRU_HARVEST_PAGES * PAGE_SIZE_BS, &walk);
+	spin_unlock(&init_mm_bs.page_table_lock);
+	return err;
+}
+
+/*
+ * TestCase: multi-gen LRU aging
+ *
+ * Map LRU_HARVEST_PAGES anonymous pages on the LRU into a registered mm,
+ * half of them through young ptes, and reclaim until aging has run.  It
+ * must have found the young ptes through the page tables and cleared
+ * them, while the pages themselves stay mapped.
+ */
+static int TestCase_lru_gen_harvest(void)
+{
+	struct page_bs *pages[LRU_HARVEST_PAGES];
+	struct lru_harvest lh = { .pages = pages };
+	struct zone_bs **zones;
+	struct anon_map am;
+	int i, nr, ret = 0;
+
+	for (nr = 0; nr < LRU_HARVEST_PAGES; nr++) {
+		pages[nr] = alloc_page_bs(GFP_KERNEL_BS);
+		if (!pages[nr]) {
+			while (nr--)
+				__free_page_bs(pages[nr]);
+			return -ENOMEM;
+		}
+	}
+	if (lru_harvest_walk(&lh, MM_WALK_ALLOC_BS, lru_harvest_map_pte)) {
+		for (i = 0; i < nr; i++)
+			__free_page_bs(pages[i]);
+		return -ENOMEM;
+	}
+	anon_map_rmap(&am, LRU_HARVEST_ADDR, pages, nr);
+	for (i = 0; i < nr; i++)
+		lru_cache_add_bs(pages[i]);
+	lru_add_drain_bs();
+	lru_gen_add_mm_bs(&init_mm_bs);
+
+	/* Mapped pages can't be reclaimed, so reclaim ends up aging */
+	zones = NODE_DATA_BS(0)->node_zonelists[GFP_KERNEL_BS &
+						GFP_ZONEMASK_BS].zones;
+	for (i = 0; i < MAX_NR_GENS_BS * 4; i++) {
+		try_to_free_pages_bs(zones, GFP_KERNEL_BS, 0);
+		lh.young = 0;
+		lru_harvest_walk(&lh, 0, lru_harvest_young_pte);
+		if (!lh.young)
+			break;
+	}
+	lru_gen_del_mm_bs(&init_mm_bs);
+
+	if (lh.young) {
+		printk("%s: aging left %d young ptes\n", __func__, lh.young);
+		ret = -EINVAL;
+	}
+	for (i = 0; i < nr; i++) {
+		if (!page_mapped_bs(pages[i]) || !PageLRU_bs(pages[i])) {
+			printk("%s: mapped page %d reclaimed\n", __func__, i);
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	lru_harvest_walk(&lh, 0, lru_harvest_unmap_pte);
+	for (i = 0; i < nr; i++)
+		page_remove_rmap_bs(pages[i]);
+	release_pages_bs(pages, nr, 0);
+	return ret;
+}
+module_initcall_bs(TestCase_lru_gen_harvest);
+#endif /* CONFIG_LRU_GEN_BS */
+
+#define COMPACT_TEST_ORDER	(3)
+#define COMPACT_TEST_BLOCKS	(64)
+
+static struct page_bs *compact_test_alloc(void)
+{
+	return alloc_pages_bs(GFP_ATOMIC_BS | __GFP_NOWARN_BS,
+					COMPACT_TEST_ORDER);
+}
+
+/*
+ * TestCase: compaction
+ *
+ * Pin the first page of COMPACT_TEST_BLOCKS blocks of COMPACT_TEST_ORDER
+ * with an anonymous mapping on the LRU and free the rest, so that none
+ * of them can merge back.  Compaction must leave a block of that order
+ * free for an allocation that cannot compact, and any pinned page it
+ * moved must still be mapped with its contents intact.
+ */
+static int TestCase_compaction(void)
+{
+	struct page_bs *pinned[COMPACT_TEST_BLOCKS];
+	struct page_bs *pages[COMPACT_TEST_BLOCKS];
+	struct zone_bs **zones;
+	struct zone_bs *zone;
+	struct page_bs *page;
+	struct anon_map am;
+	int i, j, nr, moved = 0, ret = 0;
+
+	for (nr = 0; nr < COMPACT_TEST_BLOCKS; nr++) {
+		page = alloc_pages_bs(GFP_KERNEL_BS | __GFP_MOVABLE_BS |
+				__GFP_NOWARN_BS, COMPACT_TEST_ORDER);
+		if (!page)
+			break;
+		/* Only the head of a non-compound block is counted */
+		for (j = 1; j < (1 << COMPACT_TEST_ORDER); j++) {
+			set_page_count_bs(page + j, 1);
+			__free_page_bs(page + j);
+		}
+		pinned[nr] = pages[nr] = page;
+	}
+	if (!nr)
+		return -ENOMEM;
+
+	if (anon_map(&am, pages, nr)) {
+		while (nr--)
+			__free_page_bs(pinned[nr]);
+		return -ENOMEM;
+	}
+	for (i = 0; i < nr; i++) {
+		*(unsigned long *)(am.vma.vm_start + i * PAGE_SIZE_BS) = i;
+		lru_cache_add_bs(pages[i]);
+	}
+	lru_add_drain_bs();
+
+	zones = NODE_DATA_BS(0)->node_zonelists[GFP_KERNEL_BS &
+						GFP_ZONEMASK_BS].zones;
+	/* Earlier failures must not defer this run */
+	for (i = 0; (zone = zones[i]) != NULL; i++) {
+		zone->compact_considered = 0;
+		zone->compact_defer_shift = 0;
+	}
+	if (try_to_compact_pages_bs(zones, COMPACT_TEST_ORDER,
+					GFP_KERNEL_BS) != COMPACT_PARTIAL_BS) {
+		printk("%s: compaction didn't free an order-%d block\n",
+					__func__, COMPACT_TEST_ORDER);
+		ret = -EINVAL;
+	}
+
+	page = compact_test_alloc();
+	if (!page) {
+		printk("%s: order-%d block not available after compaction\n",
+					__func__, COMPACT_TEST_ORDER);
+		ret = -EINVAL;
+	} else
+		__free_pages_bs(page, COMPACT_TEST_ORDER);
+
+	for (i = 0; i < nr; i++) {
+		page = anon_map_page(&am, i);
+		if (!page || *(unsigned long *)page_address_bs(page) != i) {
+			printk("%s: pinned page %d lost by migration\n",
+							__func__, i);
+			ret = -EINVAL;
+		} else if (page != pinned[i])
+			moved++;
+	}
+	printk("%s: %d of %d pinned pages migrated\n", __func__, moved, nr);
+
+	anon_unmap(&am);
+	return ret;
+}
+module_initcall_bs(TestCase_compaction);
+
+static int anon_map_young_pte(pte_t_bs *pte, unsigned long addr,
+				unsigned long end, struct mm_walk_bs *walk)
+{
+	int young = *(int *)walk->private;
+
+	if (young)
+		set_pte_at_bs(walk->mm, addr, pte,
+			__pte_bs(pte_val_bs(*pte) | L_PTE_YOUNG_BS));
+	else
+		set_pte_at_bs(walk->mm, addr, pte, pte_mkold_bs(*pte));
+	return 0;
+}
+
+static void anon_map_set_young(struct anon_map *am, int i, int young)
+{
+	unsigned long addr = am->vma.vm_start + i * PAGE_SIZE_BS;
+	struct mm_walk_bs walk = {
+		.pte_entry	= anon_map_young_pte,
+		.mm		= &init_mm_bs,
+		.private	= &young,
+	};
+
+	spin_lock(&init_mm_bs.page_table_lock);
+	walk_page_range_bs(addr, addr + PAGE_SIZE_BS, &walk);
+	spin_unlock(&init_mm_bs.page_table_lock);
+}
+
+#define REFERENCED_TEST_MAPPED	(12)	/* split over two anon_vmas */
+
+/* Slot @k has a young pte when k % 3 == 0 and PG_referenced when k % 4 == 1 */
+static void referenced_test_set(struct anon_map *am, struct pagevec_bs *pvec)
+{
+	int k;
+
+	for (k = 0; k < pagevec_count_bs(pvec); k++) {
+		if (k < REFERENCED_TEST_MAPPED)
+			anon_map_set_young(&am[k % 2], k / 2, k % 3 == 0);
+		if (k % 4 == 1)
+			SetPageReferenced_bs(pvec->pages[k]);
+		else
+			ClearPageReferenced_bs(pvec->pages[k]);
+	}
+}
+
+static int referenced_test_expected(int k)
+{
+	return (k < REFERENCED_TEST_MAPPED && k % 3 == 0) + (k % 4 == 1);
+}
+
+/*
+ * TestCase: batched page_referenced
+ *
+ * Fill a pagevec with pages of two anon_vmas, interleaved so that each
+ * group is scattered over the batch, and with unmapped pages at the
+ * end.  page_referenced_batch() must report for every slot what
+ * page_referenced() reports for that page on its own, given the same
+ * young bits and PG_referenced flags.
+ */
+static int TestCase_page_referenced_batch(void)
+{
+	struct page_bs *pages[2][REFERENCED_TEST_MAPPED / 2];
+	struct page_bs *unmapped[PAGEVEC_SIZE_BS - REFERENCED_TEST_MAPPED];
+	int batch[PAGEVEC_SIZE_BS];
+	struct pagevec_bs pvec;
+	struct anon_map am[2];
+	int i, k, ret = 0;
+
+	for (k = 0; k < ARRAY_SIZE(unmapped); k++) {
+		unmapped[k] = alloc_page_bs(GFP_KERNEL_BS);
+		if (!unmapped[k]) {
+			while (k--)
+				__free_page_bs(unmapped[k]);
+			return -ENOMEM;
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		for (k = 0; k < REFERENCED_TEST_MAPPED / 2; k++) {
+			pages[i][k] = alloc_page_bs(GFP_KERNEL_BS);
+			if (!pages[i][k])
+				break;
+		}
+		if (k == REFERENCED_TEST_MAPPED / 2 &&
+				!anon_map(&am[i], pages[i], k))
+			continue;
+		while (k--)
+			__free_page_bs(pages[i][k]);
+		if (i)
+			anon_unmap(&am[0]);
+		for (k = 0; k < ARRAY_SIZE(unmapped); k++)
+			__free_page_bs(unmapped[k]);
+		return -ENOMEM;
+	}
+
+	pagevec_init_bs(&pvec, 0);
+	for (k = 0; k < PAGEVEC_SIZE_BS; k++)
+		pagevec_add_bs(&pvec, k < REFERENCED_TEST_MAPPED ?
+				pages[k % 2][k / 2] :
+				unmapped[k - REFERENCED_TEST_MAPPED]);
+
+	referenced_test_set(am, &pvec);
+	page_referenced_batch_bs(&pvec, batch, 0, 1);
+
+	referenced_test_set(am, &pvec);
+	for (k = 0; k < PAGEVEC_SIZE_BS; k++) {
+		int single = page_referenced_bs(pvec.pages[k], 0, 1);
+
+		if (batch[k] != single ||
+				single != referenced_test_expected(k)) {
+			printk("%s: slot %d: batch %d, single %d, expected %d\n",
+				__func__, k, batch[k], single,
+				referenced_test_expected(k));
+			ret = -EINVAL;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+		anon_unmap(&am[i]);
+	for (k = 0; k < ARRAY_SIZE(unmapped); k++)
+		__free_page_bs(unmapped[k]);
+	return ret;
+}
+module_initcall_bs(TestCase_page_referenced_batch);